@@ -0,0 +1,419 @@
+#include "../kpapi.h"
+#include <cstring>
+#include <cctype>
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+
+#if defined (__unix__) || defined (__APPLE__)
+#define KPAPI_CATALOG_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+constexpr std::chrono::seconds ProfilingAmp::Catalog::pauseAfterRigChange;
+constexpr std::chrono::seconds ProfilingAmp::Catalog::preselectionTimeout;
+
+ProfilingAmp::Catalog::Catalog (ProfilingAmp &amp) : amp (amp), inMemoryIndex (numPerformances) {
+    std::memset (inMemoryIndex.data(), 0, numPerformances * sizeof (IndexRecord));
+    records = inMemoryIndex.data();
+    thread = std::thread (&Catalog::run, this);
+}
+
+ProfilingAmp::Catalog::~Catalog() {
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        shouldExit = true;
+    }
+    stateChanged.notify_all();
+    thread.join();
+
+    closeIndexFile();
+}
+
+bool ProfilingAmp::Catalog::openIndexFile (const char *indexFilePath) {
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    closeIndexFile();
+
+    std::FILE *file = std::fopen (indexFilePath, "r+b");
+    if (file == nullptr)
+        file = std::fopen (indexFilePath, "w+b");
+    if (file == nullptr)
+        return false;
+
+    IndexHeader header;
+    bool isValidIndex = (std::fread (&header, sizeof (header), 1, file) == 1) &&
+                        (std::memcmp (header.magic, "KPCT", 4) == 0) &&
+                        (header.version == indexFileVersion) &&
+                        (header.numPerformances == numPerformances) &&
+                        (header.nameLength == stringBufferLength) &&
+                        (std::fseek (file, 0, SEEK_END) == 0) &&
+                        (std::ftell (file) == (long)indexFileSize);
+
+    if (!isValidIndex) {
+        // start over with the names crawled so far
+        std::memcpy (header.magic, "KPCT", 4);
+        header.version = indexFileVersion;
+        header.numPerformances = numPerformances;
+        header.nameLength = stringBufferLength;
+        header.reserved = 0;
+
+        std::rewind (file);
+        if ((std::fwrite (&header, sizeof (header), 1, file) != 1) ||
+            (std::fwrite (inMemoryIndex.data(), sizeof (IndexRecord), numPerformances, file) != (size_t)numPerformances) ||
+            (std::fflush (file) != 0)) {
+            std::fclose (file);
+            return false;
+        }
+    }
+
+    indexFile = file;
+
+#ifdef KPAPI_CATALOG_MMAP
+    // updates of the mapped records are written back to the file by the OS
+    void *mapping = mmap (nullptr, indexFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno (file), 0);
+    if (mapping != MAP_FAILED) {
+        mappedIndexFile = mapping;
+        records = reinterpret_cast<IndexRecord*> (static_cast<char*> (mapping) + sizeof (IndexHeader));
+        return true;
+    }
+#endif
+
+    // no memory mapping available, so read the whole index and write back each record on changes
+    if (isValidIndex) {
+        std::fseek (file, sizeof (IndexHeader), SEEK_SET);
+        if (std::fread (inMemoryIndex.data(), sizeof (IndexRecord), numPerformances, file) != (size_t)numPerformances)
+            std::memset (inMemoryIndex.data(), 0, numPerformances * sizeof (IndexRecord));
+    }
+    return true;
+}
+
+void ProfilingAmp::Catalog::closeIndexFile() {
+#ifdef KPAPI_CATALOG_MMAP
+    if (mappedIndexFile != nullptr) {
+        // keep the names available after the file is closed
+        std::memcpy (inMemoryIndex.data(), records, numPerformances * sizeof (IndexRecord));
+        records = inMemoryIndex.data();
+
+        msync (mappedIndexFile, indexFileSize, MS_SYNC);
+        munmap (mappedIndexFile, indexFileSize);
+        mappedIndexFile = nullptr;
+    }
+#endif
+
+    if (indexFile != nullptr) {
+        std::fclose (indexFile);
+        indexFile = nullptr;
+    }
+}
+
+void ProfilingAmp::Catalog::storeRecord (uint8_t performanceIdx) {
+    if ((indexFile == nullptr) || (mappedIndexFile != nullptr))
+        return;
+
+    std::fseek (indexFile, (long)(sizeof (IndexHeader) + performanceIdx * sizeof (IndexRecord)), SEEK_SET);
+    std::fwrite (records + performanceIdx, sizeof (IndexRecord), 1, indexFile);
+    std::fflush (indexFile);
+}
+
+void ProfilingAmp::Catalog::startCrawl() {
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        crawlMode = Crawl;
+    }
+    stateChanged.notify_all();
+}
+
+void ProfilingAmp::Catalog::startRefresh() {
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        crawlMode = Refresh;
+    }
+    stateChanged.notify_all();
+}
+
+void ProfilingAmp::Catalog::stopCrawling() {
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        crawlMode = Idle;
+    }
+    stateChanged.notify_all();
+}
+
+bool ProfilingAmp::Catalog::isCrawling() {
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    return crawlMode != Idle;
+}
+
+void ProfilingAmp::Catalog::setCrawlFinishedCallback (CrawlFinishedCallbackFn newCrawlFinishedCallback) {
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    crawlFinishedCallback = newCrawlFinishedCallback;
+}
+
+void ProfilingAmp::Catalog::setMaxRequestsPerSecond (double newMaxRequestsPerSecond) {
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        maxRequestsPerSecond = newMaxRequestsPerSecond;
+        nextRequestAllowedAt = std::chrono::steady_clock::now();
+    }
+    stateChanged.notify_all();
+}
+
+int ProfilingAmp::Catalog::getNumPerformancesCrawled() {
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    int numCrawled = 0;
+    for (int i = 0; i < numPerformances; i++) {
+        if (records[i].crawled)
+            numCrawled++;
+    }
+    return numCrawled;
+}
+
+ProfilingAmp::returnStringType ProfilingAmp::Catalog::getPerformanceName (uint8_t performanceIdx) {
+    if (performanceIdx >= numPerformances)
+        return returnStringType();
+
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    return records[performanceIdx].performanceName;
+}
+
+ProfilingAmp::returnStringType ProfilingAmp::Catalog::getRigName (uint8_t performanceIdx, RigNr rig) {
+    if ((performanceIdx >= numPerformances) || (rig < Rig1) || (rig > Rig5))
+        return returnStringType();
+
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    return records[performanceIdx].rigNames[rig - Rig1];
+}
+
+static bool startsWithIgnoringCase (const char *name, const char *prefix) {
+    for (; *prefix != '\0'; prefix++, name++) {
+        if (std::tolower ((unsigned char)*name) != std::tolower ((unsigned char)*prefix))
+            return false;
+    }
+    return true;
+}
+
+std::vector<ProfilingAmp::Catalog::SearchResult> ProfilingAmp::Catalog::search (const char *prefix, size_t maxNumResults) {
+    std::vector<SearchResult> results;
+
+    std::lock_guard<std::mutex> lk (catalogMutex);
+    for (int i = 0; (i < numPerformances) && (results.size() < maxNumResults); i++) {
+        const IndexRecord &record = records[i];
+        if (!record.crawled)
+            continue;
+
+        if (startsWithIgnoringCase (record.performanceName, prefix))
+            results.push_back ({(uint8_t)i, -1, record.performanceName});
+
+        for (int rig = 0; (rig < numRigsPerPerformance) && (results.size() < maxNumResults); rig++) {
+            if (startsWithIgnoringCase (record.rigNames[rig], prefix))
+                results.push_back ({(uint8_t)i, (int8_t)rig, record.rigNames[rig]});
+        }
+    }
+    return results;
+}
+
+void ProfilingAmp::Catalog::rigChangeFollows (int newActivePerformanceIdx) {
+    const auto now = std::chrono::steady_clock::now();
+    int performanceToPreselect = activePerformanceUnknown;
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        pausedUntil = now + pauseAfterRigChange;
+        rigChangeCount++;
+
+        // the amp would switch to the performance preselected by the crawler otherwise
+        const bool preselectionPending = now < lastPreselectionSentAt + preselectionTimeout;
+        if (preselectionPending && (newActivePerformanceIdx < 0) && (activePerformanceIdx >= 0))
+            performanceToPreselect = activePerformanceIdx;
+        lastPreselectionSentAt = std::chrono::steady_clock::time_point();
+
+        if (newActivePerformanceIdx != keepActivePerformance) {
+            activePerformanceIdx = newActivePerformanceIdx;
+            activePerformanceName = (newActivePerformanceIdx >= 0) ? returnStringType (records[newActivePerformanceIdx].performanceName) : returnStringType();
+        }
+    }
+    stateChanged.notify_all();
+
+    if (performanceToPreselect >= 0)
+        amp.preselectPerformance ((uint8_t)performanceToPreselect);
+}
+
+void ProfilingAmp::Catalog::activeRigChanged() {
+    {
+        std::lock_guard<std::mutex> lk (catalogMutex);
+        pausedUntil = std::chrono::steady_clock::now() + pauseAfterRigChange;
+        rigChangeCount++;
+    }
+    stateChanged.notify_all();
+}
+
+void ProfilingAmp::Catalog::run() {
+    std::unique_lock<std::mutex> lk (catalogMutex);
+
+    while (!shouldExit) {
+        if (crawlMode == Idle) {
+            stateChanged.wait (lk);
+            continue;
+        }
+
+        const CrawlMode mode = crawlMode;
+        bool interrupted = false;
+        int numAttempts = 0;
+
+        for (int i = 0; (i < numPerformances) && !interrupted;) {
+            if ((mode == Crawl) && records[i].crawled) {
+                i++;
+                continue;
+            }
+
+            switch (crawlPerformance (lk, (uint8_t)i, (mode == Refresh) && records[i].crawled)) {
+                case Crawled: i++; numAttempts = 0; break;
+                case Retry:
+                    if (++numAttempts >= maxAttemptsPerPerformance) {
+                        i++;
+                        numAttempts = 0;
+                    }
+                    break;
+                case Stopped: interrupted = true; break;
+            }
+
+            interrupted |= (crawlMode != mode);
+        }
+
+        if (shouldExit)
+            return;
+
+        // the crawl was stopped or another one was started in the meantime
+        if (interrupted)
+            continue;
+
+        crawlMode = Idle;
+        if (crawlFinishedCallback) {
+            CrawlFinishedCallbackFn callback = crawlFinishedCallback;
+            lk.unlock();
+            callback();
+            lk.lock();
+        }
+    }
+}
+
+bool ProfilingAmp::Catalog::waitForBandwidth (std::unique_lock<std::mutex> &lk, int numRequests) {
+    const CrawlMode mode = crawlMode;
+
+    while (true) {
+        if (shouldExit || (crawlMode != mode))
+            return false;
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto allowedAt = std::max (nextRequestAllowedAt, pausedUntil);
+
+        if (now >= allowedAt) {
+            nextRequestAllowedAt = std::max (nextRequestAllowedAt, now) +
+                                   std::chrono::duration_cast<std::chrono::steady_clock::duration> (std::chrono::duration<double> (numRequests / maxRequestsPerSecond));
+            return true;
+        }
+
+        // wakes up early if the crawl is stopped, the limit changes or a rig change pauses the crawler
+        stateChanged.wait_until (lk, allowedAt);
+    }
+}
+
+bool ProfilingAmp::Catalog::findActivePerformance (std::unique_lock<std::mutex> &lk) {
+    // while a preselection is pending, the amp reports the names of the preselected performance
+    if (std::chrono::steady_clock::now() < lastPreselectionSentAt + preselectionTimeout) {
+        stateChanged.wait_until (lk, lastPreselectionSentAt + preselectionTimeout);
+        return !shouldExit;
+    }
+
+    if (!waitForBandwidth (lk, 1))
+        return false;
+
+    const uint32_t rigChangeCountBefore = rigChangeCount;
+    lk.unlock();
+    char performanceName[stringBufferLength];
+    StringRequest request = {true, activePerformanceNameControllerNumber, performanceName};
+    amp.getStringParameters (&request, 1, false, BackgroundRequest);
+    lk.lock();
+
+    if (rigChangeCount != rigChangeCountBefore)
+        return true;
+
+    // the request failed, try again later
+    if (performanceName[0] == '\0')
+        return true;
+
+    activePerformanceName = performanceName;
+    activePerformanceIdx = keepActivePerformance;
+    for (int i = 0; i < numPerformances; i++) {
+        if (records[i].crawled && (activePerformanceName == returnStringType (records[i].performanceName))) {
+            activePerformanceIdx = i;
+            break;
+        }
+    }
+    return true;
+}
+
+ProfilingAmp::Catalog::CrawlResult ProfilingAmp::Catalog::crawlPerformance (std::unique_lock<std::mutex> &lk, uint8_t performanceIdx, bool onlyIfPerformanceNameChanged) {
+    // keepActivePerformance marks an active performance whose name is known but was not found in the index yet
+    if ((activePerformanceIdx == activePerformanceUnknown) && !findActivePerformance (lk))
+        return Stopped;
+
+    if (activePerformanceIdx == activePerformanceUnknown)
+        return Retry;
+
+    const int numRequests = onlyIfPerformanceNameChanged ? 1 : 1 + numRigsPerPerformance;
+    if (!waitForBandwidth (lk, numRequests))
+        return Stopped;
+
+    const uint32_t rigChangeCountBefore = rigChangeCount;
+    lastPreselectionSentAt = std::chrono::steady_clock::now();
+    lk.unlock();
+
+    char names[1 + numRigsPerPerformance][stringBufferLength];
+    StringRequest requests[1 + numRigsPerPerformance];
+    requests[0] = {true, activePerformanceNameControllerNumber, names[0]};
+    for (int rig = 0; rig < numRigsPerPerformance; rig++) {
+        requests[1 + rig] = {true, Rig1 + rig + rigNameControllerNumberOffset, names[1 + rig]};
+    }
+
+    // the amp answers name requests for the preselected performance, so the requests can be sent back to back
+    amp.preselectPerformance (performanceIdx);
+    bool allNamesReceived = amp.getStringParameters (requests, numRequests, false, BackgroundRequest) == numRequests;
+
+    lk.lock();
+    IndexRecord &record = records[performanceIdx];
+
+    // every performance has a name, an empty one means the request failed. The record is kept as it is then
+    if (!allNamesReceived || (names[0][0] == '\0') || (rigChangeCount != rigChangeCountBefore))
+        return Retry;
+
+    const bool rigNamesNeeded = !onlyIfPerformanceNameChanged || (std::strncmp (record.performanceName, names[0], stringBufferLength) != 0);
+
+    if (onlyIfPerformanceNameChanged && rigNamesNeeded) {
+        // the bandwidth for these was not reserved, so the next requests wait a bit longer
+        nextRequestAllowedAt += std::chrono::duration_cast<std::chrono::steady_clock::duration> (std::chrono::duration<double> (numRigsPerPerformance / maxRequestsPerSecond));
+        lastPreselectionSentAt = std::chrono::steady_clock::now();
+        lk.unlock();
+        allNamesReceived = amp.getStringParameters (requests + 1, numRigsPerPerformance, false, BackgroundRequest) == numRigsPerPerformance;
+        lk.lock();
+    }
+
+    // a rig change while the names were requested ended the preselection
+    if (!allNamesReceived || (rigChangeCount != rigChangeCountBefore))
+        return Retry;
+
+    std::memcpy (record.performanceName, names[0], stringBufferLength);
+    if (rigNamesNeeded) {
+        for (int rig = 0; rig < numRigsPerPerformance; rig++) {
+            std::memcpy (record.rigNames[rig], names[1 + rig], stringBufferLength);
+        }
+    }
+    record.crawled = 1;
+    storeRecord (performanceIdx);
+
+    if ((activePerformanceIdx == keepActivePerformance) && (activePerformanceName == returnStringType (record.performanceName)))
+        activePerformanceIdx = performanceIdx;
+
+    return Crawled;
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include "../kpapi.h"
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+
+ProfilingAmp::Setlist::Setlist (ProfilingAmp &amp) : amp (amp) {
+    thread = std::thread (&Setlist::run, this);
+}
+
+ProfilingAmp::Setlist::~Setlist() {
+    {
+        std::lock_guard<std::mutex> lk (setlistMutex);
+        shouldExit = true;
+    }
+    stateChanged.notify_all();
+    thread.join();
+}
+
+size_t ProfilingAmp::Setlist::addEntry (uint8_t performanceIdx, RigNr rig, returnStringType expectedPerformanceName, returnStringType expectedRigName) {
+    // encode the transition once, so that advancing to this entry only has to send it
+    Macro transition = amp.compileMacro ([this, performanceIdx, rig]() { amp.selectPerformanceAndRig (performanceIdx, rig); });
+
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    entries.push_back ({performanceIdx, rig, expectedPerformanceName, expectedRigName, transition, Unverified});
+    return entries.size() - 1;
+}
+
+void ProfilingAmp::Setlist::clear() {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    // the rig was changed already, even if the verification thread didn't catch up yet
+    applyPendingSideEffects();
+    entries.clear();
+    currentEntryIdx = -1;
+
+    // discard a verification in progress without starting a new one
+    advanceCount++;
+    advanceCountHandled = advanceCount;
+    fullVerificationRequested = false;
+}
+
+size_t ProfilingAmp::Setlist::getNumEntries() {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    return entries.size();
+}
+
+int ProfilingAmp::Setlist::getCurrentEntryIdx() {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    return currentEntryIdx;
+}
+
+bool ProfilingAmp::Setlist::goToEntry (size_t entryIdx) {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    if (entryIdx >= entries.size())
+        return false;
+
+    advanceTo (entryIdx);
+    return true;
+}
+
+bool ProfilingAmp::Setlist::next() {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    const size_t nextEntryIdx = currentEntryIdx + 1;
+    if (nextEntryIdx >= entries.size())
+        return false;
+
+    advanceTo (nextEntryIdx);
+    return true;
+}
+
+bool ProfilingAmp::Setlist::previous() {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    if (currentEntryIdx <= 0)
+        return false;
+
+    advanceTo (currentEntryIdx - 1);
+    return true;
+}
+
+ProfilingAmp::Setlist::EntryStatus ProfilingAmp::Setlist::getEntryStatus (size_t entryIdx) {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    if (entryIdx >= entries.size())
+        return Unverified;
+
+    return entries[entryIdx].status;
+}
+
+bool ProfilingAmp::Setlist::allEntriesVerified() {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    for (auto &entry : entries) {
+        if (entry.status != Verified)
+            return false;
+    }
+    return true;
+}
+
+void ProfilingAmp::Setlist::setMismatchCallback (MismatchCallbackFn newMismatchCallback) {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    mismatchCallback = newMismatchCallback;
+}
+
+void ProfilingAmp::Setlist::setVerificationDelay (std::chrono::milliseconds delay) {
+    std::lock_guard<std::mutex> lk (setlistMutex);
+    verificationDelay = delay;
+}
+
+void ProfilingAmp::Setlist::verifyAllEntries() {
+    {
+        std::lock_guard<std::mutex> lk (setlistMutex);
+        for (auto &entry : entries) {
+            entry.status = Unverified;
+        }
+        fullVerificationRequested = true;
+    }
+    stateChanged.notify_all();
+}
+
+void ProfilingAmp::Setlist::advanceTo (size_t entryIdx) {
+    amp.sendMacro (entries[entryIdx].transition);
+    currentEntryIdx = (int)entryIdx;
+    entryIdxWithPendingSideEffects = (int)entryIdx;
+    advanceCount++;
+    stateChanged.notify_all();
+}
+
+void ProfilingAmp::Setlist::applyPendingSideEffects() {
+    if (entryIdxWithPendingSideEffects < 0)
+        return;
+
+    // the transitions only differ in the performance and rig selected, so the side effects of the latest one cover
+    // all transitions sent before
+    amp.applyMacroSideEffects (entries[entryIdxWithPendingSideEffects].transition);
+    entryIdxWithPendingSideEffects = -1;
+}
+
+void ProfilingAmp::Setlist::run() {
+    std::unique_lock<std::mutex> lk (setlistMutex);
+
+    while (!shouldExit) {
+        if (advanceCountHandled != advanceCount) {
+            applyPendingSideEffects();
+
+            const uint32_t advance = advanceCount;
+            const size_t entryIdx = currentEntryIdx;
+            advanceCountHandled = advance;
+            lk.unlock();
+
+            // the stomp types can only be requested once the rig is active, so scan them as early as possible
+            bool stompScanStarted;
+            {
+                std::lock_guard<std::mutex> stompLock (amp.stompListMutex);
+                stompScanStarted = amp.stompSlotsAreScannedOnRigChange();
+            }
+            if (!stompScanStarted)
+                amp.scanStompSlotsAsync();
+
+            lk.lock();
+            if (!waitForRigToLoad (lk))
+                return;
+
+            if (advance == advanceCount)
+                verifyActivePerformance (lk, entryIdx, advance);
+
+            continue;
+        }
+
+        if (fullVerificationRequested) {
+            fullVerificationRequested = false;
+            const int entryIdxBefore = currentEntryIdx;
+
+            bool interrupted = false;
+            for (size_t i = 0; (i < entries.size()) && !interrupted; i++) {
+                // entries sharing a performance with an entry checked before are verified already
+                if (entries[i].status != Unverified)
+                    continue;
+
+                advanceTo (i);
+                applyPendingSideEffects();
+                const uint32_t advance = advanceCount;
+                advanceCountHandled = advance;
+
+                if (!waitForRigToLoad (lk))
+                    return;
+
+                interrupted = (advance != advanceCount) || !verifyActivePerformance (lk, i, advance);
+            }
+
+            // if the setlist was advanced in the meantime, the show has started, so don't go back
+            if (!interrupted) {
+                if (entryIdxBefore >= 0) {
+                    advanceTo (entryIdxBefore);
+                    applyPendingSideEffects();
+                }
+                else {
+                    currentEntryIdx = -1;
+                }
+            }
+            continue;
+        }
+
+        stateChanged.wait (lk);
+    }
+}
+
+bool ProfilingAmp::Setlist::waitForRigToLoad (std::unique_lock<std::mutex> &lk) {
+    stateChanged.wait_for (lk, verificationDelay, [this]() { return shouldExit; });
+    return !shouldExit;
+}
+
+bool ProfilingAmp::Setlist::verifyActivePerformance (std::unique_lock<std::mutex> &lk, size_t entryIdx, uint32_t advance) {
+    const uint8_t performanceIdx = entries[entryIdx].performanceIdx;
+
+    // the rig names of the active performance that need to be checked, indexed by rig
+    const int numRigs = Rig5 - Rig1 + 1;
+    bool rigNameNeeded[numRigs] = {};
+    for (auto &entry : entries) {
+        if ((entry.performanceIdx == performanceIdx) && !(entry.expectedRigName == returnStringType()))
+            rigNameNeeded[entry.rig - Rig1] = true;
+    }
+
+    lk.unlock();
+    const returnStringType performanceName = amp.getActivePerformanceName();
+    returnStringType rigNames[numRigs];
+    for (int i = 0; i < numRigs; i++) {
+        if (rigNameNeeded[i])
+            rigNames[i] = amp.getRigName ((RigNr)(Rig1 + i));
+    }
+    lk.lock();
+
+    // another rig was selected while the names were requested, so they might belong to that one
+    if (advance != advanceCount)
+        return false;
+
+    // an empty name means the request failed, the entry stays unverified then
+    if (performanceName == returnStringType())
+        return true;
+
+    std::vector<std::pair<size_t, EntryStatus>> mismatches;
+    for (size_t i = 0; i < entries.size(); i++) {
+        Entry &entry = entries[i];
+        if (entry.performanceIdx != performanceIdx)
+            continue;
+
+        const returnStringType &rigName = rigNames[entry.rig - Rig1];
+        if (!(entry.expectedPerformanceName == returnStringType()) && !(entry.expectedPerformanceName == performanceName))
+            entry.status = PerformanceNameMismatch;
+        else if (!(entry.expectedRigName == returnStringType()) && (rigName == returnStringType()))
+            continue;
+        else if (!(entry.expectedRigName == returnStringType()) && !(entry.expectedRigName == rigName))
+            entry.status = RigNameMismatch;
+        else
+            entry.status = Verified;
+
+        if (entry.status != Verified)
+            mismatches.push_back (std::make_pair (i, entry.status));
+    }
+
+    if (!mismatches.empty() && mismatchCallback) {
+        MismatchCallbackFn callback = mismatchCallback;
+        lk.unlock();
+        for (auto &mismatch : mismatches) {
+            callback (mismatch.first, mismatch.second);
+        }
+        lk.lock();
+    }
+    return true;
+}
+
+#endif
@@ -4,13 +4,26 @@ ProfilingAmp::StompType ProfilingAmp::StompBase::getStompType() {
     return stompType;
 }
 
+bool ProfilingAmp::StompBase::isStillValid() {
+    return (stompType != StompType::Empty) && (_slotPage != PageUninitialized);
+}
+
 void ProfilingAmp::StompBase::setToggleState (bool onOff) {
-    _amp.updateLowResNRPN (_slotPage, NRPNParameter::OnOff, onOff);
+    setParameter<ParameterID::OnOff> (onOff);
 }
 
 bool ProfilingAmp::StompBase::getToggleState() {
-    return _amp.getSingleParameter (_slotPage, NRPNParameter::OnOff);
+    return getParameter<ParameterID::OnOff>();
 }
 
+#ifndef SIMPLE_MIDI_ARDUINO
+std::future<bool> ProfilingAmp::StompBase::getToggleStateAsync() {
+    return makeFuture<bool> ([this] (ToggleStateCallbackFn handler) { getToggleStateAsync (handler); });
+}
 
-
+void ProfilingAmp::StompBase::getToggleStateAsync (ToggleStateCallbackFn completionHandler) {
+    _amp.getSingleParameterAsync (_slotPage, NRPNParameter::OnOff, [completionHandler] (int16_t toggleState) {
+        completionHandler (toggleState);
+    });
+}
+#endif
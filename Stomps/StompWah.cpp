@@ -8,13 +8,17 @@ bool ProfilingAmp::GenericWahStomp::isStillValid() {
 }
 
 void ProfilingAmp::GenericWahStomp::setManual (uint16_t manual) {
-    _amp.updateHighResNRPN (_slotPage, WahManual, manual);
+    _amp.queueContinuousController (true, _slotPage, WahManual, manual);
 }
 
 ProfilingAmp::GenericWahStomp* ProfilingAmp::getGenericWahStomp (StompSlot stompSlot) {
     return (GenericWahStomp*) getGenericStompInstance (StompType::GenericWah, stompSlot);
 }
 
+ProfilingAmp::StompHandle<ProfilingAmp::GenericWahStomp> ProfilingAmp::getGenericWahStompHandle (StompSlot stompSlot) {
+    return StompHandle<GenericWahStomp> (*this, StompType::GenericWah, stompSlot);
+}
+
 bool ProfilingAmp::WahWahStomp::isStillValid() {
     if (((stompType & StompType::SpecificMask) == StompType::WahWah) && (_slotPage != PageUninitialized)) {
         return true;
@@ -0,0 +1,257 @@
+#include "../kpapi.h"
+#include <cmath>
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+
+ProfilingAmp::ClockEngine::ClockEngine (ProfilingAmp &amp) : amp (amp) {
+    resetJitterReport();
+    thread = std::thread (&ClockEngine::run, this);
+}
+
+ProfilingAmp::ClockEngine::~ClockEngine() {
+    {
+        std::lock_guard<std::mutex> lk (clockMutex);
+        shouldExit = true;
+    }
+    stateChanged.notify_all();
+    thread.join();
+}
+
+bool ProfilingAmp::ClockEngine::start (double beatsPerMinute) {
+    if (!isValidTempo (beatsPerMinute))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lk (clockMutex);
+        tempo = beatsPerMinute;
+        rampLengthInTicks = 0;
+        scheduleAnchor = std::chrono::steady_clock::now();
+        nanosecondsSinceAnchor = 0.0;
+        lastTickSentAt = TimePoint();
+        scheduleGeneration++;
+        tickIndex = 0;
+        running = true;
+    }
+    stateChanged.notify_all();
+    return true;
+}
+
+void ProfilingAmp::ClockEngine::stop() {
+    {
+        std::lock_guard<std::mutex> lk (clockMutex);
+        running = false;
+    }
+    stateChanged.notify_all();
+}
+
+bool ProfilingAmp::ClockEngine::isRunning() {
+    std::lock_guard<std::mutex> lk (clockMutex);
+    return running;
+}
+
+bool ProfilingAmp::ClockEngine::setTempo (double beatsPerMinute) {
+    if (!isValidTempo (beatsPerMinute))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lk (clockMutex);
+        tempo = beatsPerMinute;
+        rampLengthInTicks = 0;
+
+        // move the deadline of the tick already scheduled according to the new tempo
+        if (running && (lastTickSentAt != TimePoint())) {
+            const double intervalNanoseconds = 60e9 / (tempo * ticksPerQuarterNote);
+            nanosecondsSinceAnchor += intervalNanoseconds - lastScheduledIntervalNanoseconds;
+            lastScheduledIntervalNanoseconds = intervalNanoseconds;
+        }
+    }
+    stateChanged.notify_all();
+    return true;
+}
+
+bool ProfilingAmp::ClockEngine::rampTempo (double targetBeatsPerMinute, double rampLengthInQuarterNotes) {
+    if (!isValidTempo (targetBeatsPerMinute))
+        return false;
+
+    std::lock_guard<std::mutex> lk (clockMutex);
+    rampStartTempo = tempo;
+    rampTargetTempo = targetBeatsPerMinute;
+    rampLengthInTicks = std::max (1, (int)(rampLengthInQuarterNotes * ticksPerQuarterNote + 0.5));
+    rampTicksDone = 0;
+    return true;
+}
+
+double ProfilingAmp::ClockEngine::getTempo() {
+    std::lock_guard<std::mutex> lk (clockMutex);
+    return tempo;
+}
+
+uint64_t ProfilingAmp::ClockEngine::getNextTickIndex() {
+    std::lock_guard<std::mutex> lk (clockMutex);
+    return tickIndex;
+}
+
+uint64_t ProfilingAmp::ClockEngine::getTickIndexOfNextBeat (int beatsPerBar) {
+    if (beatsPerBar < 1)
+        return invalidTickIndex;
+
+    const uint64_t ticksPerBar = (uint64_t)beatsPerBar * ticksPerQuarterNote;
+    std::lock_guard<std::mutex> lk (clockMutex);
+    return ((tickIndex + ticksPerBar - 1) / ticksPerBar) * ticksPerBar;
+}
+
+void ProfilingAmp::ClockEngine::setSpinTime (std::chrono::microseconds newSpinTime) {
+    {
+        std::lock_guard<std::mutex> lk (clockMutex);
+        spinTime = newSpinTime;
+    }
+    stateChanged.notify_all();
+}
+
+ProfilingAmp::ClockEngine::JitterReport ProfilingAmp::ClockEngine::getJitterReport() {
+    std::lock_guard<std::mutex> lk (clockMutex);
+    JitterReport report = jitterReport;
+    if (report.numIntervals > 0)
+        report.meanAbsoluteDeviationMicroseconds = sumAbsoluteDeviationMicroseconds / report.numIntervals;
+
+    return report;
+}
+
+void ProfilingAmp::ClockEngine::resetJitterReport() {
+    std::lock_guard<std::mutex> lk (clockMutex);
+    jitterReport = JitterReport();
+    sumAbsoluteDeviationMicroseconds = 0.0;
+}
+
+void ProfilingAmp::ClockEngine::synchronize (uint64_t tickIndexDue, TimePoint dueTime, double intervalNanoseconds) {
+    // e.g. two ticks with the same timestamp
+    if (!std::isfinite (intervalNanoseconds) || (intervalNanoseconds <= 0.0))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk (clockMutex);
+        tempo = 60e9 / (intervalNanoseconds * ticksPerQuarterNote);
+        rampLengthInTicks = 0;
+
+        // after a restart of the external clock, the indices of the ticks already sent don't count anymore. Otherwise
+        // an engine ahead of the new indices would wait for them to catch up without sending anything. Being more
+        // than a few ticks ahead can only mean that a restart was missed
+        if (!running || tickIndexRestarted || (tickIndex > tickIndexDue + maxTicksToCatchUp)) {
+            lastTickSentAt = TimePoint();
+            scheduleGeneration++;
+            tickIndex = tickIndexDue;
+            tickIndexRestarted = false;
+            running = true;
+        }
+
+        // a tick that is just a bit late is sent right away. If the engine is further behind, the missing ticks are
+        // skipped rather than sent in a burst
+        if (tickIndex + maxTicksToCatchUp < tickIndexDue)
+            tickIndex = tickIndexDue;
+
+        scheduleAnchor = dueTime;
+        nanosecondsSinceAnchor = ((int64_t)tickIndex - (int64_t)tickIndexDue) * intervalNanoseconds;
+
+        if (lastTickSentAt != TimePoint()) {
+            const TimePoint nextDeadline = scheduleAnchor + std::chrono::nanoseconds ((int64_t)nanosecondsSinceAnchor);
+            lastScheduledIntervalNanoseconds = std::chrono::duration<double, std::nano> (nextDeadline - lastTickSentAt).count();
+        }
+    }
+    stateChanged.notify_all();
+}
+
+void ProfilingAmp::ClockEngine::restartTickIndex() {
+    std::lock_guard<std::mutex> lk (clockMutex);
+    tickIndexRestarted = true;
+}
+
+double ProfilingAmp::ClockEngine::nextIntervalNanoseconds() {
+    if (rampTicksDone < rampLengthInTicks) {
+        rampTicksDone++;
+        tempo = rampStartTempo + (rampTargetTempo - rampStartTempo) * rampTicksDone / rampLengthInTicks;
+    }
+
+    return 60e9 / (tempo * ticksPerQuarterNote);
+}
+
+void ProfilingAmp::ClockEngine::recordTick (TimePoint sentAt, TimePoint deadline, double scheduledIntervalNanoseconds) {
+    const int32_t latenessMicroseconds = (int32_t)std::chrono::duration_cast<std::chrono::microseconds> (sentAt - deadline).count();
+    jitterReport.maxLatenessMicroseconds = std::max (jitterReport.maxLatenessMicroseconds, latenessMicroseconds);
+
+    // the first tick after starting or a resync has no interval to compare to
+    if (lastTickSentAt != TimePoint()) {
+        const double intervalNanoseconds = std::chrono::duration<double, std::nano> (sentAt - lastTickSentAt).count();
+        const double deviationMicroseconds = (intervalNanoseconds - lastScheduledIntervalNanoseconds) / 1000.0;
+        const double absoluteDeviationMicroseconds = std::abs (deviationMicroseconds);
+
+        int bin = (int)std::lround (deviationMicroseconds / JitterReport::histogramBinWidthMicroseconds) + JitterReport::numHistogramBins / 2;
+        bin = std::min (std::max (bin, 0), JitterReport::numHistogramBins - 1);
+
+        jitterReport.intervalDeviationHistogram[bin]++;
+        jitterReport.numIntervals++;
+        jitterReport.maxAbsoluteDeviationMicroseconds = std::max (jitterReport.maxAbsoluteDeviationMicroseconds, (int32_t)absoluteDeviationMicroseconds);
+        sumAbsoluteDeviationMicroseconds += absoluteDeviationMicroseconds;
+    }
+
+    lastTickSentAt = sentAt;
+    lastScheduledIntervalNanoseconds = scheduledIntervalNanoseconds;
+}
+
+void ProfilingAmp::ClockEngine::run() {
+    std::unique_lock<std::mutex> lk (clockMutex);
+    TimePoint lastAnnouncedDeadline;
+
+    while (!shouldExit) {
+        if (!running) {
+            stateChanged.wait (lk);
+            continue;
+        }
+
+        const TimePoint deadline = scheduleAnchor + std::chrono::nanoseconds ((int64_t)nanosecondsSinceAnchor);
+
+        // the deadline only moves if the tempo changes, so this is mostly done once per tick
+        if (deadline != lastAnnouncedDeadline) {
+            amp.announceRealtimeMessage (deadline);
+            lastAnnouncedDeadline = deadline;
+        }
+
+        // sleep until shortly before the deadline. Wakes up early on tempo changes, so the deadline is recomputed
+        if (std::chrono::steady_clock::now() < deadline - spinTime) {
+            stateChanged.wait_until (lk, deadline - spinTime);
+            continue;
+        }
+
+        const uint32_t generation = scheduleGeneration;
+        const uint64_t tickIndexSent = tickIndex;
+        lk.unlock();
+        while (std::chrono::steady_clock::now() < deadline);
+
+        amp.transmitClockTick();
+        const TimePoint sentAt = std::chrono::steady_clock::now();
+        amp.sendScheduledCommands (tickIndexSent, deadline);
+        lk.lock();
+
+        // the clock might have been stopped or restarted while spinning
+        if (!running || (generation != scheduleGeneration))
+            continue;
+
+        tickIndex++;
+        const double intervalNanoseconds = nextIntervalNanoseconds();
+        recordTick (sentAt, deadline, intervalNanoseconds);
+
+        // the next deadline is computed from the schedule, not from the time this tick was sent, so a late tick
+        // doesn't delay all following ones
+        nanosecondsSinceAnchor += intervalNanoseconds;
+
+        if (sentAt > scheduleAnchor + std::chrono::nanoseconds ((int64_t)nanosecondsSinceAnchor)) {
+            // more than a whole interval late, e.g. after the system was suspended. Rather than sending a burst of
+            // ticks to catch up, restart the schedule
+            scheduleAnchor = sentAt;
+            nanosecondsSinceAnchor = intervalNanoseconds;
+            lastTickSentAt = TimePoint();
+            jitterReport.numResyncs++;
+        }
+    }
+}
+
+#endif
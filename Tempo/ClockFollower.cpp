@@ -0,0 +1,139 @@
+#include "../kpapi.h"
+#include <cmath>
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+
+// M_PI is not part of standard C++ and missing on MSVC without _USE_MATH_DEFINES
+static constexpr double pi = 3.14159265358979323846;
+
+void ProfilingAmp::ClockFollower::receivedClockTick() {
+    receivedClockTick (std::chrono::steady_clock::now());
+}
+
+void ProfilingAmp::ClockFollower::receivedClockTick (TimePoint timestamp) {
+    std::unique_lock<std::mutex> lk (followerMutex);
+
+    // keep the raw timestamps of the last ticks, the oldest one first
+    for (int i = 0; i < tempoChangeWindow; i++) {
+        recentTicks[i] = recentTicks[i + 1];
+    }
+    recentTicks[tempoChangeWindow] = timestamp;
+    numTicksReceived++;
+
+    if (numTicksReceived < 2)
+        return;
+
+    const double lastIntervalNanoseconds = std::chrono::duration<double, std::nano> (timestamp - recentTicks[tempoChangeWindow - 1]).count();
+
+    if (!filterInitialized) {
+        relock (timestamp, lastIntervalNanoseconds);
+    }
+    else {
+        const double errorNanoseconds = std::chrono::duration<double, std::nano> (timestamp - predictedNextTick).count();
+
+        if (std::abs (errorNanoseconds) > 4.0 * filteredIntervalNanoseconds) {
+            // the input paused or jumped, start over with the last interval
+            relock (timestamp, lastIntervalNanoseconds);
+        }
+        else {
+            // second order delay locked loop: the phase follows the error quickly, the interval slowly
+            predictedNextTick += std::chrono::nanoseconds ((int64_t)(filteredIntervalNanoseconds + b * errorNanoseconds));
+            filteredIntervalNanoseconds += c * errorNanoseconds;
+
+            // tempo change detection based on the average interval of the last few ticks
+            if (numTicksReceived > tempoChangeWindow) {
+                const double recentIntervalNanoseconds = std::chrono::duration<double, std::nano> (timestamp - recentTicks[0]).count() / tempoChangeWindow;
+
+                if (std::abs (recentIntervalNanoseconds - filteredIntervalNanoseconds) > tempoChangeThreshold * filteredIntervalNanoseconds)
+                    numTicksOutsideThreshold++;
+                else
+                    numTicksOutsideThreshold = 0;
+
+                if (numTicksOutsideThreshold >= tempoChangeWindow) {
+                    relock (timestamp, recentIntervalNanoseconds);
+                    numTempoChangesDetected++;
+                }
+            }
+        }
+    }
+
+    const uint64_t nextTickIndex = numTicksReceived;
+    const TimePoint nextTickDue = predictedNextTick;
+    const double intervalNanoseconds = filteredIntervalNanoseconds;
+    lk.unlock();
+
+    engine.synchronize (nextTickIndex, nextTickDue, intervalNanoseconds);
+}
+
+void ProfilingAmp::ClockFollower::relock (TimePoint timestamp, double intervalNanoseconds) {
+    filteredIntervalNanoseconds = intervalNanoseconds;
+    predictedNextTick = timestamp + std::chrono::nanoseconds ((int64_t)intervalNanoseconds);
+
+    // filter coefficients for a critically damped loop with the bandwidth set, relative to the tick interval
+    const double omega = 2.0 * pi * loopBandwidth * intervalNanoseconds * 1e-9;
+    b = std::sqrt (2.0) * omega;
+    c = omega * omega;
+
+    numTicksOutsideThreshold = 0;
+    filterInitialized = true;
+}
+
+void ProfilingAmp::ClockFollower::receivedStart() {
+    {
+        std::lock_guard<std::mutex> lk (followerMutex);
+        numTicksReceived = 0;
+        filterInitialized = false;
+    }
+    // the tick indices start over
+    engine.restartTickIndex();
+}
+
+void ProfilingAmp::ClockFollower::receivedStop() {
+    {
+        std::lock_guard<std::mutex> lk (followerMutex);
+        numTicksReceived = 0;
+        filterInitialized = false;
+    }
+    engine.stop();
+}
+
+bool ProfilingAmp::ClockFollower::isLocked() {
+    std::lock_guard<std::mutex> lk (followerMutex);
+    if (!filterInitialized)
+        return false;
+
+    // the input is considered lost if a few ticks are missing
+    const auto timeSinceLastTick = std::chrono::steady_clock::now() - recentTicks[tempoChangeWindow];
+    return std::chrono::duration<double, std::nano> (timeSinceLastTick).count() < 4.0 * filteredIntervalNanoseconds;
+}
+
+double ProfilingAmp::ClockFollower::getTempo() {
+    std::lock_guard<std::mutex> lk (followerMutex);
+    if (!filterInitialized)
+        return 0.0;
+
+    return 60e9 / (filteredIntervalNanoseconds * ClockEngine::ticksPerQuarterNote);
+}
+
+uint32_t ProfilingAmp::ClockFollower::getNumTempoChangesDetected() {
+    std::lock_guard<std::mutex> lk (followerMutex);
+    return numTempoChangesDetected;
+}
+
+void ProfilingAmp::ClockFollower::setLoopBandwidth (double bandwidthInHz) {
+    std::lock_guard<std::mutex> lk (followerMutex);
+    loopBandwidth = bandwidthInHz;
+
+    if (filterInitialized) {
+        const double omega = 2.0 * pi * loopBandwidth * filteredIntervalNanoseconds * 1e-9;
+        b = std::sqrt (2.0) * omega;
+        c = omega * omega;
+    }
+}
+
+void ProfilingAmp::ClockFollower::setTempoChangeThreshold (double relativeDeviation) {
+    std::lock_guard<std::mutex> lk (followerMutex);
+    tempoChangeThreshold = relativeDeviation;
+}
+
+#endif
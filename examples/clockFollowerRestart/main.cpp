@@ -0,0 +1,68 @@
+//
+//  main.cpp
+//  clockFollowerRestart
+//
+//  Checks that the clock engine keeps sending ticks if the external clock it follows is restarted in the middle of
+//  a bar. An external clock at 120 BPM is simulated by feeding ticks to the clock follower, a MIDI start message is
+//  received after one and a half bars. The engine must continue right away with the tick indices of the restarted
+//  clock instead of waiting for them to catch up. Needs a MIDI device to send the ticks to, pass its index as the
+//  first argument. Returns 0 if the check passed.
+//
+
+
+#include "../../kpapi.h"
+
+#ifndef SIMPLE_MIDI_ARDUINO // avoid any Arduino IDE from compiling this example
+
+#include <iostream>
+#include <cstdlib>
+
+
+static const double tickIntervalMilliseconds = 60000.0 / (120.0 * ProfilingAmp::ClockEngine::ticksPerQuarterNote);
+
+// Feeds ticks in real time, as the engine sends its own ticks at the times the follower predicts
+static void feedTicks (ProfilingAmp::ClockFollower &follower, std::chrono::steady_clock::time_point &nextTick, int numTicks) {
+    for (int i = 0; i < numTicks; i++) {
+        std::this_thread::sleep_until (nextTick);
+        follower.receivedClockTick (nextTick);
+        nextTick += std::chrono::microseconds ((int64_t)(tickIntervalMilliseconds * 1000.0));
+    }
+}
+
+int main (int argc, const char * argv[]) {
+
+    auto connectedDevices = SimpleMIDI::PlatformSpecificImplementation::searchMIDIDevices();
+    const size_t deviceIdx = (argc > 1) ? std::strtoul (argv[1], nullptr, 10) : 0;
+
+    if (deviceIdx >= connectedDevices.size()) {
+        std::cout << "No MIDI device " << deviceIdx << std::endl;
+        return 1;
+    }
+
+    ProfilingAmp profilingAmp (connectedDevices[deviceIdx]);
+    ProfilingAmp::ClockFollower &follower = profilingAmp.getClockFollower();
+    ProfilingAmp::ClockEngine &engine = profilingAmp.getClockEngine();
+
+    const int ticksPerBar = 4 * ProfilingAmp::ClockEngine::ticksPerQuarterNote;
+    auto nextTick = std::chrono::steady_clock::now();
+
+    follower.receivedStart();
+    feedTicks (follower, nextTick, ticksPerBar + ticksPerBar / 2);
+    std::cout << "Before the restart the engine is at tick " << engine.getNextTickIndex() << std::endl;
+
+    // the external clock starts over in the middle of the bar
+    follower.receivedStart();
+    feedTicks (follower, nextTick, ticksPerBar / 2);
+    const uint64_t tickIndexAfterRestart = engine.getNextTickIndex();
+    std::cout << "Half a bar after the restart the engine is at tick " << tickIndexAfterRestart << std::endl;
+
+    engine.stop();
+
+    // the engine is at most a few ticks off while the follower locks to the restarted clock
+    const bool passed = (tickIndexAfterRestart + 3 >= (uint64_t)(ticksPerBar / 2)) && (tickIndexAfterRestart <= (uint64_t)(ticksPerBar / 2) + 3);
+    std::cout << (passed ? "Passed" : "Failed: the engine did not follow the restart") << std::endl;
+
+    return passed ? 0 : 1;
+}
+
+#endif // SIMPLE_MIDI_ARDUINO
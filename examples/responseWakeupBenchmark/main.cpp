@@ -0,0 +1,163 @@
+//
+//  main.cpp
+//  responseWakeupBenchmark
+//
+//  Measures the time from a MIDI thread delivering a response until the thread waiting for it wakes up. The
+//  requests go through the ResponseMessageManager of a ProfilingAmp, using the same registerRequest,
+//  receivedResponse and waitForResponsesOrTimeout calls as the getters, so matching and copying are included but
+//  not the time on the wire. For comparison, the mutex & condition variable handshake the manager used before is
+//  modeled on its own. Nothing is sent, so no Kemper needs to be connected, but the ProfilingAmp needs any MIDI
+//  device to be created with.
+//  Note that without C++20 atomic waits, the manager wakes up waiters through a condition variable as well.
+//  Build with optimizations enabled, e.g.
+//  c++ -std=c++20 -O2 -pthread main.cpp ../../kpapi.cpp ../../Stomps/*.cpp ../../Tempo/*.cpp ../../Setlist/*.cpp
+//      ../../Catalog/*.cpp -o responseWakeupBenchmark
+//
+
+
+#include "../../kpapi.h"
+
+#ifndef SIMPLE_MIDI_ARDUINO // avoid any Arduino IDE from compiling this example
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+
+static const int numResponses = 20000;
+
+typedef std::chrono::steady_clock Clock;
+
+// A model of the waiting side of the old implementation: the slot state is guarded by a mutex
+struct MutexSlot {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool filled = false;
+    Clock::time_point deliveredAt;
+
+    void waitForResponse() {
+        std::unique_lock<std::mutex> lk (mutex);
+        cv.wait (lk, [this]() { return filled; });
+        filled = false;
+    }
+
+    void deliver() {
+        std::lock_guard<std::mutex> lk (mutex);
+        deliveredAt = Clock::now();
+        filled = true;
+        cv.notify_all();
+    }
+};
+
+static std::vector<double> measureMutexSlotLatencies() {
+    MutexSlot slot;
+    std::vector<double> latencies;
+    latencies.reserve (numResponses);
+    std::atomic<bool> waiterReady (false);
+
+    std::thread waiter ([&]() {
+        for (int i = 0; i < numResponses; i++) {
+            waiterReady.store (true, std::memory_order_release);
+            slot.waitForResponse();
+            const auto wokenUpAt = Clock::now();
+            latencies.push_back (std::chrono::duration<double, std::micro> (wokenUpAt - slot.deliveredAt).count());
+        }
+    });
+
+    // plays the MIDI thread, responses arrive roughly at the rate of a MIDI DIN connection
+    for (int i = 0; i < numResponses; i++) {
+        while (!waiterReady.exchange (false, std::memory_order_acq_rel))
+            std::this_thread::yield();
+        std::this_thread::sleep_for (std::chrono::microseconds (300));
+        slot.deliver();
+    }
+
+    waiter.join();
+    std::sort (latencies.begin(), latencies.end());
+    return latencies;
+}
+
+// A friend of the ProfilingAmp, so it can reach its response manager
+struct ResponseMessageManagerBenchmark {
+    static std::vector<double> measureLatencies (ProfilingAmp &amp) {
+        typedef ProfilingAmp::ResponseMessageManager<int8_t> ResponseManager;
+
+        ResponseManager &manager = amp.parameterResponseManager;
+        const uint32_t key = ProfilingAmp::responseKey (ProfilingAmp::FunctionCode::SingleParamChange, (ProfilingAmp::Amp << 8) | ProfilingAmp::AmpGain);
+        const int8_t response[4] = {ProfilingAmp::Amp, ProfilingAmp::AmpGain, 0x40, 0x00};
+
+        std::vector<double> latencies;
+        latencies.reserve (numResponses);
+        std::atomic<bool> waiterReady (false);
+        Clock::time_point deliveredAt;
+
+        std::thread waiter ([&]() {
+            int8_t responseBuffer[4];
+            for (int i = 0; i < numResponses; i++) {
+                ResponseManager::RequestHandle handle = manager.registerRequest (key, responseBuffer, 4, ProfilingAmp::ForegroundRequest, true);
+                ResponseManager::ErrorCode errorCode;
+                waiterReady.store (true, std::memory_order_release);
+                manager.waitForResponsesOrTimeout (&handle, &errorCode, 1);
+                const auto wokenUpAt = Clock::now();
+
+                if (errorCode == ResponseManager::success)
+                    latencies.push_back (std::chrono::duration<double, std::micro> (wokenUpAt - deliveredAt).count());
+            }
+        });
+
+        // plays the MIDI thread, responses arrive roughly at the rate of a MIDI DIN connection
+        for (int i = 0; i < numResponses; i++) {
+            while (!waiterReady.exchange (false, std::memory_order_acq_rel))
+                std::this_thread::yield();
+            std::this_thread::sleep_for (std::chrono::microseconds (300));
+            deliveredAt = Clock::now();
+            manager.receivedResponse (key, response, 4);
+        }
+
+        waiter.join();
+        std::sort (latencies.begin(), latencies.end());
+        return latencies;
+    }
+};
+
+static void printPercentiles (const char *name, const std::vector<double> &latencies) {
+    if (latencies.empty()) {
+        std::cout << std::left << std::setw (26) << name << "no responses delivered" << std::endl;
+        return;
+    }
+
+    auto percentile = [&](double p) { return latencies[std::min (latencies.size() - 1, (size_t)(p / 100.0 * latencies.size()))]; };
+
+    std::cout << std::left << std::setw (26) << name << std::right << std::fixed << std::setprecision (1)
+              << std::setw (9) << percentile (50)
+              << std::setw (9) << percentile (90)
+              << std::setw (9) << percentile (99)
+              << std::setw (9) << percentile (99.9)
+              << std::setw (9) << latencies.back() << std::endl;
+}
+
+int main() {
+    auto connectedDevices = SimpleMIDI::PlatformSpecificImplementation::searchMIDIDevices();
+    if (connectedDevices.empty()) {
+        std::cout << "No MIDI device found to create the ProfilingAmp with" << std::endl;
+        return 1;
+    }
+
+    ProfilingAmp profilingAmp (connectedDevices[0]);
+
+#ifndef KPAPI_ATOMIC_WAIT
+    std::cout << "No C++20 atomic wait available, the response manager falls back to a condition variable" << std::endl;
+#endif
+    std::cout << "Wake-up latency in microseconds over " << numResponses << " responses" << std::endl;
+    std::cout << std::left << std::setw (26) << "" << std::right
+              << std::setw (9) << "p50" << std::setw (9) << "p90" << std::setw (9) << "p99"
+              << std::setw (9) << "p99.9" << std::setw (9) << "max" << std::endl;
+
+    printPercentiles ("mutex & cv (model)", measureMutexSlotLatencies());
+    printPercentiles ("ResponseMessageManager", ResponseMessageManagerBenchmark::measureLatencies (profilingAmp));
+
+    return 0;
+}
+
+#endif // SIMPLE_MIDI_ARDUINO
@@ -9,37 +9,401 @@ void ProfilingAmp::setCommunicationErrorCallback (MidiCommErrorCallbackFn midiCo
 
 // --------------------------- Tempo -------------------------------
 
-void ProfilingAmp::startExternalMIDIClocking (uint64_t quarterNoteIntervalInMilliseconds) {
-    if (midiClockGenerator == nullptr)
-        midiClockGenerator = new MIDIClockGenerator (*this);
+#ifdef SIMPLE_MIDI_MULTITHREADED
+ProfilingAmp::ClockEngine &ProfilingAmp::getClockEngine() {
+    if (clockEngine == nullptr)
+        clockEngine = new ClockEngine (*this);
 
-    midiClockGenerator->setIntervall (quarterNoteIntervalInMilliseconds);
+    return *clockEngine;
+}
+
+ProfilingAmp::ClockFollower &ProfilingAmp::getClockFollower() {
+    if (clockFollower == nullptr)
+        clockFollower = new ClockFollower (getClockEngine());
+
+    return *clockFollower;
+}
+
+// --------------------------- Setlist -----------------------------
+
+ProfilingAmp::Setlist &ProfilingAmp::getSetlist() {
+    if (setlist == nullptr)
+        setlist = new Setlist (*this);
+
+    return *setlist;
+}
+
+// --------------------------- Catalog -----------------------------
+
+ProfilingAmp::Catalog &ProfilingAmp::getCatalog() {
+    if (catalog == nullptr)
+        catalog = new Catalog (*this);
+
+    return *catalog;
+}
+
+void ProfilingAmp::catalogRigChangeFollows (int newActivePerformanceIdx) {
+    // captured commands are sent later, the catalog learns about them right before they are sent
+    if (CapturedCommands *capture = captureOfThisThread()) {
+        if (newActivePerformanceIdx != Catalog::keepActivePerformance)
+            capture->catalogPerformanceHint = newActivePerformanceIdx;
+        return;
+    }
+
+    if (catalog != nullptr)
+        catalog->rigChangeFollows (newActivePerformanceIdx);
+}
+
+// ------------------- Beat-quantized commands ------------------
+
+thread_local ProfilingAmp::CapturedCommands *ProfilingAmp::currentCapture = nullptr;
+
+ProfilingAmp::ScheduledCommandsID ProfilingAmp::scheduleCommands (uint64_t tickIndex, std::function<void()> commands, ScheduledCommandsCallbackFn sentCallback) {
+    // e.g. the result of getTickIndexOfNextBeat for an invalid bar length
+    if (tickIndex == ClockEngine::invalidTickIndex)
+        return invalidScheduledCommandsID;
+
+    ScheduledCommands scheduled;
+    scheduled.sentCallback = sentCallback;
+    captureCommands (commands, scheduled.commands);
+
+    std::lock_guard<std::mutex> lk (scheduledCommandsMutex);
+    if (++lastScheduledCommandsID == invalidScheduledCommandsID)
+        ++lastScheduledCommandsID;
+    scheduled.id = lastScheduledCommandsID;
+    const ScheduledCommandsID id = scheduled.id;
+    scheduledCommands.insert (std::make_pair (tickIndex, std::move (scheduled)));
+    return id;
+}
+
+bool ProfilingAmp::cancelScheduledCommands (ScheduledCommandsID id) {
+    std::lock_guard<std::mutex> lk (scheduledCommandsMutex);
+    for (auto it = scheduledCommands.begin(); it != scheduledCommands.end(); ++it) {
+        if (it->second.id == id) {
+            scheduledCommands.erase (it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ProfilingAmp::captureCommands (const std::function<void()> &commands, CapturedCommands &capture) {
+    capture.owner = this;
+    CapturedCommands *previousCapture = currentCapture;
+    currentCapture = &capture;
+    commands();
+    currentCapture = previousCapture;
+}
+
+void ProfilingAmp::appendMIDIBytes (std::vector<char> &midiBytes, OutgoingMessageType type, const char *bytes, uint16_t length) {
+    switch (type) {
+        case ControlChanges:
+            for (uint16_t i = 0; i < length; i += 2) {
+                midiBytes.push_back ((char)0xB0);
+                midiBytes.push_back (bytes[i]);
+                midiBytes.push_back (bytes[i + 1]);
+            }
+            break;
+
+        case SysEx:
+            midiBytes.insert (midiBytes.end(), bytes, bytes + length);
+            break;
+
+        case ClockTick:
+            midiBytes.push_back ((char)0xF8);
+            break;
+    }
+}
+
+void ProfilingAmp::dispatchMIDIBytes (const char *midiBytes, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        switch ((uint8_t)midiBytes[i]) {
+            case 0xB0:
+                dispatch (ControlChanges, midiBytes + i + 1, 2);
+                i += numBytesControlChange;
+                break;
+
+            case 0xF0: {
+                size_t end = i + 1;
+                while ((uint8_t)midiBytes[end] != 0xF7)
+                    end++;
+
+                dispatch (SysEx, midiBytes + i, (uint16_t)(end + 1 - i));
+                i = end + 1;
+                break;
+            }
+
+            default:
+                dispatch (ClockTick, nullptr, 0);
+                i++;
+                break;
+        }
+    }
+}
+
+std::chrono::steady_clock::time_point ProfilingAmp::sendCapturedCommands (const CapturedCommands &capture) {
+    std::lock_guard<std::mutex> nrpnLock (nrpnMutex);
+    std::lock_guard<std::mutex> lk (transmitMutex);
+
+    const NRPNPage pageBefore = wireNRPNPage;
+    const NRPNParameter parameterBefore = wireNRPNParameter;
+
+    dispatchMIDIBytes (capture.midiBytes.data(), capture.midiBytes.size());
+    const auto sentAt = std::chrono::steady_clock::now();
+
+    if ((wireNRPNPage == pageBefore) && (wireNRPNParameter == parameterBefore))
+        return sentAt;
+
+    // The captured messages changed the NRPN selection. If nothing NRPN related is queued, the selection on the wire
+    // is the one the next NRPN will rely on. Otherwise, the first queued NRPN message needs to restore the selection
+    // it was encoded for, if it doesn't select a parameter by itself anyway
+    for (auto &message : transmitQueues[ParameterPriority]) {
+        if (message.type != ControlChanges)
+            continue;
+
+        const uint8_t firstControl = (uint8_t)message.bytes[0];
+        if (firstControl == 99)
+            return sentAt;
+
+        if ((firstControl == NRPNValMSB) || (firstControl == NRPNValLSB) || (firstControl == NRPNValLowResolution)) {
+            const char selection[4] = {99, (char)pageBefore, 98, (char)parameterBefore};
+            message.bytes.insert (message.bytes.begin(), selection, selection + 4);
+            return sentAt;
+        }
+    }
+
+    lastNRPNPage = wireNRPNPage;
+    lastNRPNParameter = wireNRPNParameter;
+    return sentAt;
+}
+
+void ProfilingAmp::applyCapturedSideEffects (const CapturedCommands &capture) {
+    for (auto &parameterWrite : capture.parameterWrites) {
+        parameterValueChanged (parameterWrite.page, parameterWrite.parameter, parameterWrite.value);
+    }
+
+    if (capture.rigChanged)
+        activeRigChanged();
+}
+
+void ProfilingAmp::sendScheduledCommands (uint64_t tickIndex, std::chrono::steady_clock::time_point tickDeadline) {
+    {
+        std::lock_guard<std::mutex> lk (scheduledCommandsMutex);
+        while (!scheduledCommands.empty() && (scheduledCommands.begin()->first <= tickIndex)) {
+            dueScheduledCommands.push_back (std::move (scheduledCommands.begin()->second));
+            scheduledCommands.erase (scheduledCommands.begin());
+        }
+    }
+
+    if (dueScheduledCommands.empty())
+        return;
+
+    // send everything first, so that the side effects can't delay any of the commands
+    for (auto &scheduled : dueScheduledCommands) {
+        if (scheduled.commands.rigChanged)
+            catalogRigChangeFollows (scheduled.commands.catalogPerformanceHint);
+
+        const auto sentAt = sendCapturedCommands (scheduled.commands);
+        scheduled.latenessMicroseconds = (int32_t)std::chrono::duration_cast<std::chrono::microseconds> (sentAt - tickDeadline).count();
+    }
+
+    for (auto &scheduled : dueScheduledCommands) {
+        applyCapturedSideEffects (scheduled.commands);
+
+        if (scheduled.sentCallback)
+            scheduled.sentCallback ({scheduled.id, tickIndex, scheduled.latenessMicroseconds});
+    }
+
+    dueScheduledCommands.clear();
+}
+
+// ------------------------- Macros -------------------------------
+
+ProfilingAmp::Macro ProfilingAmp::compileMacro (std::function<void()> operations) {
+    Macro macro (*this);
+    captureCommands (operations, macro.commands);
+    macro.numBytesUnoptimized = macro.commands.midiBytes.size();
+
+    optimizeCapturedNRPN (macro.commands);
+    macro.commands.midiBytes.shrink_to_fit();
+    return macro;
+}
+
+void ProfilingAmp::Macro::fire() const {
+    amp->fireMacro (*this);
+}
+
+void ProfilingAmp::fireMacro (const Macro &macro) {
+    const CapturedCommands &commands = macro.commands;
+
+    if (CapturedCommands *capture = captureOfThisThread()) {
+        // fired from within scheduled commands or another macro. The macro selects all NRPN parameters it needs by
+        // itself, so the selection it leaves behind is the one following messages of the capture can rely on
+        capture->midiBytes.insert (capture->midiBytes.end(), commands.midiBytes.begin(), commands.midiBytes.end());
+        capture->parameterWrites.insert (capture->parameterWrites.end(), commands.parameterWrites.begin(), commands.parameterWrites.end());
+        capture->rigChanged |= commands.rigChanged;
+        if (commands.catalogPerformanceHint != Catalog::keepActivePerformance)
+            capture->catalogPerformanceHint = commands.catalogPerformanceHint;
+        if (commands.lastNRPNPage != PageUninitialized) {
+            capture->lastNRPNPage = commands.lastNRPNPage;
+            capture->lastNRPNParameter = commands.lastNRPNParameter;
+        }
+        return;
+    }
+
+    sendMacro (macro);
+    applyCapturedSideEffects (commands);
+}
+
+void ProfilingAmp::sendMacro (const Macro &macro) {
+    if (macro.commands.rigChanged)
+        catalogRigChangeFollows (macro.commands.catalogPerformanceHint);
+
+    sendCapturedCommands (macro.commands);
+}
+
+void ProfilingAmp::applyMacroSideEffects (const Macro &macro) {
+    applyCapturedSideEffects (macro.commands);
+}
+
+void ProfilingAmp::optimizeCapturedNRPN (CapturedCommands &capture) {
+    struct NRPNWrite {
+        NRPNPage page;
+        NRPNParameter parameter;
+        // the value controls and their values, as sent
+        char bytes[4];
+        uint8_t numBytes;
+    };
+
+    std::vector<char> optimized;
+    optimized.reserve (capture.midiBytes.size());
+    std::vector<NRPNWrite> writes;
+
+    NRPNPage page = PageUninitialized;
+    NRPNParameter parameter = ParameterUninitialized;
+    NRPNPage selectedPage = PageUninitialized;
+    NRPNParameter selectedParameter = ParameterUninitialized;
+
+    // sends the NRPN values collected since the last other message, sorted and with only the last value per parameter
+    auto flushWrites = [&]() {
+        std::stable_sort (writes.begin(), writes.end(), [] (const NRPNWrite &a, const NRPNWrite &b) {
+            return (a.page < b.page) || ((a.page == b.page) && (a.parameter < b.parameter));
+        });
+
+        for (size_t w = 0; w < writes.size(); w++) {
+            const NRPNWrite &write = writes[w];
+            if ((w + 1 < writes.size()) && (writes[w + 1].page == write.page) && (writes[w + 1].parameter == write.parameter))
+                continue;
+
+            if (write.page != selectedPage) {
+                const char selectPage[3] = {(char)0xB0, 99, (char)write.page};
+                optimized.insert (optimized.end(), selectPage, selectPage + 3);
+                selectedPage = write.page;
+            }
+            if (write.parameter != selectedParameter) {
+                const char selectParameter[3] = {(char)0xB0, 98, (char)write.parameter};
+                optimized.insert (optimized.end(), selectParameter, selectParameter + 3);
+                selectedParameter = write.parameter;
+            }
+            for (uint8_t i = 0; i < write.numBytes; i += 2) {
+                const char valueChange[3] = {(char)0xB0, write.bytes[i], write.bytes[i + 1]};
+                optimized.insert (optimized.end(), valueChange, valueChange + 3);
+            }
+        }
+        writes.clear();
+    };
+
+    const std::vector<char> &midiBytes = capture.midiBytes;
+    size_t i = 0;
+    while (i < midiBytes.size()) {
+        if ((uint8_t)midiBytes[i] == 0xB0) {
+            const uint8_t control = (uint8_t)midiBytes[i + 1];
+            const char value = midiBytes[i + 2];
+            i += numBytesControlChange;
+
+            if (control == 99) {
+                page = (NRPNPage)value;
+                continue;
+            }
+            if (control == 98) {
+                parameter = (NRPNParameter)value;
+                continue;
+            }
+            if ((control == NRPNValMSB) && (i < midiBytes.size()) && ((uint8_t)midiBytes[i + 1] == NRPNValLSB)) {
+                writes.push_back ({page, parameter, {(char)NRPNValMSB, value, (char)NRPNValLSB, midiBytes[i + 2]}, 4});
+                i += numBytesControlChange;
+                continue;
+            }
+            if ((control == NRPNValMSB) || (control == NRPNValLSB) || (control == NRPNValLowResolution)) {
+                writes.push_back ({page, parameter, {(char)control, value}, 2});
+                continue;
+            }
+
+            flushWrites();
+            const char controlChange[3] = {(char)0xB0, (char)control, value};
+            optimized.insert (optimized.end(), controlChange, controlChange + 3);
+            continue;
+        }
+
+        // SysEx or clock ticks are kept in place as well
+        size_t end = i;
+        if ((uint8_t)midiBytes[i] == 0xF0) {
+            while ((uint8_t)midiBytes[end] != 0xF7)
+                end++;
+        }
+
+        flushWrites();
+        optimized.insert (optimized.end(), midiBytes.begin() + i, midiBytes.begin() + end + 1);
+        i = end + 1;
+    }
+    flushWrites();
+
+    capture.midiBytes.swap (optimized);
+    capture.lastNRPNPage = selectedPage;
+    capture.lastNRPNParameter = selectedParameter;
+}
+
+bool ProfilingAmp::startExternalMIDIClocking (uint64_t quarterNoteIntervalInMilliseconds) {
+    if (quarterNoteIntervalInMilliseconds == 0)
+        return false;
+
+    return getClockEngine().start (60000.0 / quarterNoteIntervalInMilliseconds);
 }
 
 void ProfilingAmp::stopExternalMIDIClocking(bool deleteThread) {
-    midiClockGenerator->stop();
+    if (clockEngine == nullptr)
+        return;
 
-    if (deleteThread) {
-        delete midiClockGenerator;
-        midiClockGenerator = nullptr;
+    clockEngine->stop();
+
+    // the follower holds a reference to the engine
+    if (deleteThread && (clockFollower == nullptr)) {
+        delete clockEngine;
+        clockEngine = nullptr;
     }
 }
+#endif
 
 
 #ifdef SIMPLE_MIDI_ARDUINO
 
-void ProfilingAmp::setTempo (uint64_t quarterNoteIntervalInMilliseconds) {
+bool ProfilingAmp::setTempo (uint64_t quarterNoteIntervalInMilliseconds) {
+    if (quarterNoteIntervalInMilliseconds == 0)
+        return false;
+
     quarterNoteIntervalInMilliseconds /= 24; // scaled to midi beat clock intervals
     quarterNoteIntervalInMilliseconds += millis();
-    sendMIDIClockTick();
+    transmitClockTick();
 
     while (quarterNoteIntervalInMilliseconds < millis());
 
-    sendMIDIClockTick();
+    transmitClockTick();
+    return true;
 }
 
 int16_t ProfilingAmp::tapDown() {
-    sendControlChange (ControlChange::TapTempo, 1);
+    transmitControlChange (PerformancePriority, ControlChange::TapTempo, 1);
 
     unsigned long timeNow = millis();
     unsigned long timeDiff = timeNow - timePointLastTap;
@@ -53,17 +417,27 @@ int16_t ProfilingAmp::tapDown() {
 
 #else
 
-void ProfilingAmp::setTempo (uint64_t quarterNoteIntervalInMilliseconds) {
+bool ProfilingAmp::setTempo (uint64_t quarterNoteIntervalInMilliseconds) {
+    if (quarterNoteIntervalInMilliseconds == 0)
+        return false;
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    if ((clockEngine != nullptr) && clockEngine->isRunning())
+        return clockEngine->setTempo (60000.0 / quarterNoteIntervalInMilliseconds);
+#endif
+
     quarterNoteIntervalInMilliseconds *= 1000000; // actually nanoseconds now
     quarterNoteIntervalInMilliseconds /= 24; // scaled to midi beat clock intervals
-    auto timepoint = std::chrono::system_clock::now() + std::chrono::nanoseconds (quarterNoteIntervalInMilliseconds);
-    sendMIDIClockTick();
+    auto timepoint = std::chrono::steady_clock::now() + std::chrono::nanoseconds (quarterNoteIntervalInMilliseconds);
+    transmitClockTick();
+    announceRealtimeMessage (timepoint);
     std::this_thread::sleep_until (timepoint);
-    sendMIDIClockTick();
+    transmitClockTick();
+    return true;
 }
 
 int16_t ProfilingAmp::tapDown() {
-    sendControlChange (ControlChange::TapTempo, 1);
+    transmitControlChange (PerformancePriority, ControlChange::TapTempo, 1);
 
     auto timeNow = std::chrono::system_clock::now();
     auto timeDiff = std::chrono::duration_cast<std::chrono::milliseconds> (timeNow - timePointLastTap);
@@ -80,58 +454,72 @@ int16_t ProfilingAmp::tapDown() {
 #endif
 
 void ProfilingAmp::tapUp() {
-    sendControlChange (ControlChange::TapTempo, 0);
+    transmitControlChange (PerformancePriority, ControlChange::TapTempo, 0);
 }
 
 // ------------------- Rigs & Performances ------------------
 
 void ProfilingAmp::selectRig (RigNr rig) {
-    sendControlChange (rig, 1);
-    needStompListUpdate = true;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    catalogRigChangeFollows (Catalog::keepActivePerformance);
+#endif
+    transmitControlChange (PerformancePriority, rig, 1);
+    activeRigChanged();
 }
 
 void ProfilingAmp::preselectPerformance (uint8_t performanceIdx) {
-    sendControlChange (ControlChange ::PerformancePreselect, performanceIdx);
+    transmitControlChange (PerformancePriority, ControlChange::PerformancePreselect, performanceIdx);
 }
 
 void ProfilingAmp::selectPerformanceAndRig (uint8_t performanceIdx, RigNr rig) {
-    sendControlChange (ControlChange ::PerformancePreselect, performanceIdx);
-    sendControlChange (rig, 1);
-    needStompListUpdate = true;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    catalogRigChangeFollows (performanceIdx);
+#endif
+    transmitControlChange (PerformancePriority, ControlChange::PerformancePreselect, performanceIdx);
+    transmitControlChange (PerformancePriority, rig, 1);
+    activeRigChanged();
 }
 
 void ProfilingAmp::selectNextPerformance() {
-    sendControlChange (ControlChange::PerformanceUp, 0);
-    needStompListUpdate = true;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    catalogRigChangeFollows (Catalog::activePerformanceUnknown);
+#endif
+    transmitControlChange (PerformancePriority, ControlChange::PerformanceUp, 0);
+    activeRigChanged();
 }
 
 void ProfilingAmp::startScrollingPerformancesUpwards() {
-    sendControlChange (ControlChange::PerformanceUp, 1);
+    transmitControlChange (PerformancePriority, ControlChange::PerformanceUp, 1);
 }
 
 void ProfilingAmp::selectPreviousPerformance() {
-    sendControlChange (ControlChange::PerformanceDown, 0);
-    needStompListUpdate = true;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    catalogRigChangeFollows (Catalog::activePerformanceUnknown);
+#endif
+    transmitControlChange (PerformancePriority, ControlChange::PerformanceDown, 0);
+    activeRigChanged();
 }
 
 void ProfilingAmp::startScrollingPerformancesBackwards() {
-    sendControlChange (ControlChange::PerformanceDown, 1);
+    transmitControlChange (PerformancePriority, ControlChange::PerformanceDown, 1);
 }
 
 // -------------------------- Stomps ----------------------------
 
 void ProfilingAmp::toggleStompInSlot (StompSlot stompSlot, bool onOff, bool withReverbTail) {
+    parameterValueChanged (stompSlotToNRPNPage (stompSlot), NRPNParameter::OnOff, onOff);
+
     if (withReverbTail) {
         if ((stompSlot == Dly) || (stompSlot == Rev)) {
-            sendControlChange (stompToggleCC[stompSlot] + 2, onOff);
+            transmitControlChange (PerformancePriority, stompToggleCC[stompSlot] + 2, onOff);
         }
         else {
             // if it's no delay or reverb slot, switch it anyway
-            sendControlChange (stompToggleCC[stompSlot], onOff);
+            transmitControlChange (PerformancePriority, stompToggleCC[stompSlot], onOff);
         }
     }
     else {
-        sendControlChange (stompToggleCC[stompSlot], onOff);
+        transmitControlChange (PerformancePriority, stompToggleCC[stompSlot], onOff);
     }
 }
 
@@ -144,84 +532,289 @@ bool ProfilingAmp::getStompToggleState (NRPNPage stompSlotPage) {
 }
 
 void ProfilingAmp::setWahPedal (uint8_t wahPosition) {
-    sendControlChange (ControlChange::WahPedal, wahPosition);
+    queueContinuousController (false, PageUninitialized, ControlChange::WahPedal, wahPosition);
 }
 
 void ProfilingAmp::setVolumePedal (uint8_t volumePedalPosition) {
-    sendControlChange (ControlChange::VolumePedal, volumePedalPosition);
+    queueContinuousController (false, PageUninitialized, ControlChange::VolumePedal, volumePedalPosition);
 }
 
 void ProfilingAmp::setPitchPedal (uint8_t pitchPedalPosition) {
-    sendControlChange (ControlChange::PitchPedal, pitchPedalPosition);
+    queueContinuousController (false, PageUninitialized, ControlChange::PitchPedal, pitchPedalPosition);
 }
 
 void ProfilingAmp::setMorphPedal (uint8_t morphPedalPosition) {
-    sendControlChange (ControlChange::MorphPedal, morphPedalPosition);
+    queueContinuousController (false, PageUninitialized, ControlChange::MorphPedal, morphPedalPosition);
 }
 
 ProfilingAmp::WahWahStomp* ProfilingAmp::getWahWahStomp (StompSlot stompSlot) {
     return (WahWahStomp*) getSpecificStompInstance (StompType::WahWah, stompSlot);
 }
 
+ProfilingAmp::StompHandle<ProfilingAmp::WahWahStomp> ProfilingAmp::getWahWahStompHandle (StompSlot stompSlot) {
+    return StompHandle<WahWahStomp> (*this, StompType::WahWah, stompSlot);
+}
+
 void ProfilingAmp::scanStompSlots() {
-    needStompListUpdate = false;
+#ifndef SIMPLE_MIDI_ARDUINO
+    const uint32_t generation = rigGeneration;
+#endif
 
-    // scan all 8 stomp slots
-    for (int8_t i = 0; i < 8; i++) {
-        NRPNPage pageToScan = fxSlotNRPNPageMapping[i];
-        int16_t stompType = (StompType)getSingleParameter (pageToScan, NRPNParameter::StompTypeID);
+    // send out the requests for all slots at once
+    ParameterRequest requests[numStomps];
+    for (int8_t i = 0; i < numStomps; i++) {
+        requests[i] = {fxSlotNRPNPageMapping[i], NRPNParameter::StompTypeID, -1};
+    }
+    getSingleParameters (requests, numStomps);
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::lock_guard<std::mutex> lk (stompListMutex);
+    // if the rig changed in the meantime, the results are useless
+    if (generation != rigGeneration)
+        return;
+#endif
 
+    for (int8_t i = 0; i < numStomps; i++) {
+        rebuildStompSlot (i, requests[i].value);
+    }
+}
 
-        // if the response was matching the request, allocate a new stomp in that slot
-        char *memBlock = stompMemoryBlock + (i * sizeof (StompBase));
-        // although all stomps have an empty destructor until now, this is just to avoid errors in future
-        stompsInCurrentRig[i]->~StompBase();
-        if (stompType == -1) {
-            // some error. Create an empty stomp to prevent undefined states
-            stompsInCurrentRig[i] = new(memBlock) StompBase (pageToScan, *this);
-            needStompListUpdate = true;
-        }
-        else {
-            switch ((StompType)stompType) {
-                case StompType::WahWah:
-                    stompsInCurrentRig[i] = new(memBlock) WahWahStomp (pageToScan, *this);
-                    break;
-
-                default:
-                    stompsInCurrentRig[i] = new(memBlock) StompBase (pageToScan, *this);
-                    break;
+#ifndef SIMPLE_MIDI_ARDUINO
+void ProfilingAmp::scanStompSlotsAsync() {
+    scanStompSlotsAsync (allStompSlots);
+}
+
+void ProfilingAmp::scanStompSlotsAsync (uint8_t slotsToScan) {
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lk (stompListMutex);
+        generation = rigGeneration;
+        stompSlotsBeingScanned |= slotsToScan;
+    }
+
+    for (int8_t i = 0; i < numStomps; i++) {
+        if ((slotsToScan & (1 << i)) == 0)
+            continue;
+
+        getSingleParameterAsync (fxSlotNRPNPageMapping[i], NRPNParameter::StompTypeID, [this, i, generation] (int16_t stompTypeID) {
+            {
+                std::lock_guard<std::mutex> lk (stompListMutex);
+
+                if (generation != rigGeneration)
+                    return;
+
+                rebuildStompSlot (i, stompTypeID);
+                stompSlotsBeingScanned &= ~(1 << i);
             }
-        }
+            stompScanFinished.notify_all();
+        });
+    }
+}
+
+void ProfilingAmp::setAutomaticStompScan (bool shouldScanAfterRigChange) {
+    std::lock_guard<std::mutex> lk (stompListMutex);
+    automaticStompScan = shouldScanAfterRigChange;
+}
+#endif
+
+void ProfilingAmp::rebuildStompSlot (int8_t slotIndex, int16_t stompTypeID) {
+    NRPNPage slotPage = fxSlotNRPNPageMapping[slotIndex];
+
+    // all stomps are trivially destructible, so the previous stomp in that slot is simply overwritten
+    StompStorage &storage = stompStorage[slotIndex];
+    if (stompTypeID == -1) {
+        // some error. Create an empty stomp to prevent undefined states
+        stompsInCurrentRig[slotIndex] = new (&storage) StompBase (slotPage, *this, StompType::Empty);
+        stompSlotsNeedingUpdate |= (1 << slotIndex);
+        return;
+    }
+
+    const StompType stompType = stompTypeFromID (stompTypeID);
+
+    if (stompType == (StompType)(StompType::GenericWah | StompType::WahWah))
+        stompsInCurrentRig[slotIndex] = new (&storage) WahWahStomp (slotPage, *this);
+    else if ((stompType & StompType::GenericMask) == StompType::GenericWah)
+        stompsInCurrentRig[slotIndex] = new (&storage) GenericWahStomp (slotPage, *this, stompType);
+    else
+        stompsInCurrentRig[slotIndex] = new (&storage) StompBase (slotPage, *this, stompType);
+
+    stompSlotsNeedingUpdate &= ~(1 << slotIndex);
+}
+
+void ProfilingAmp::updateStompSlotIfNeeded (int8_t slotIndex) {
+    const uint8_t slotBit = 1 << slotIndex;
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    uint32_t generation;
+    {
+        std::unique_lock<std::mutex> lk (stompListMutex);
+        // if a background scan is running for this slot, wait for it instead of sending another request
+        stompScanFinished.wait (lk, [this, slotBit]() { return (stompSlotsBeingScanned & slotBit) == 0; });
+
+        if ((stompSlotsNeedingUpdate & slotBit) == 0)
+            return;
+
+        generation = rigGeneration;
     }
+#else
+    if ((stompSlotsNeedingUpdate & slotBit) == 0)
+        return;
+#endif
+
+    int16_t stompTypeID = getSingleParameter (fxSlotNRPNPageMapping[slotIndex], NRPNParameter::StompTypeID);
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::lock_guard<std::mutex> lk (stompListMutex);
+    if (generation != rigGeneration)
+        return;
+#endif
+
+    rebuildStompSlot (slotIndex, stompTypeID);
+}
+
+ProfilingAmp::StompType ProfilingAmp::stompTypeInSlot (int8_t slotIndex) {
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::lock_guard<std::mutex> lk (stompListMutex);
+#endif
+    return stompsInCurrentRig[slotIndex]->getStompType();
 }
 
 void ProfilingAmp::initializeStompsInCurrentRig () {
 
     for (int8_t i = 0; i < 8; i++) {
         NRPNPage pageToFill = fxSlotNRPNPageMapping[i];
-        // some stack allocation
-        char *memBlock = stompMemoryBlock + (i * sizeof (StompBase));
-        stompsInCurrentRig[i] = new (memBlock) StompBase (pageToFill, *this);
+        stompsInCurrentRig[i] = new (&stompStorage[i]) StompBase (pageToFill, *this, StompType::Empty);
+    }
+}
+
+ProfilingAmp::StompType ProfilingAmp::stompTypeFromID (int16_t stompTypeID) {
+    static_assert (stompTypeIDRangesAreValid(), "The stomp type ID ranges must be ascending and must not overlap");
+
+    if ((stompTypeID <= 0) || (stompTypeID > StompType::SpecificMask))
+        return StompType::Empty;
+
+    for (const StompTypeIDRange &range : stompTypeIDRanges) {
+        if ((stompTypeID >= range.firstID) && (stompTypeID <= range.lastID))
+            return (StompType)(range.genericType | stompTypeID);
+    }
+
+    return (StompType)stompTypeID;
+}
+
+void ProfilingAmp::activeRigChanged() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // the rig will change once the captured messages are sent
+    if (CapturedCommands *capture = captureOfThisThread()) {
+        capture->rigChanged = true;
+        return;
+    }
+#endif
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    bool shouldScanStompSlots;
+    {
+        std::lock_guard<std::mutex> lk (stompListMutex);
+        // results of scans for the previous rig are useless now
+        rigGeneration++;
+        stompSlotsBeingScanned = 0;
+        stompSlotsNeedingUpdate = allStompSlots;
+        shouldScanStompSlots = stompSlotsAreScannedOnRigChange();
+    }
+    stompScanFinished.notify_all();
+#else
+    rigGeneration++;
+    stompSlotsNeedingUpdate = allStompSlots;
+#endif
+
+#ifdef KPAPI_PARAMETER_MIRROR
+    invalidateParameterMirror();
+#endif
+    forgetContinuousControllerValues();
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    if (shouldScanStompSlots)
+        scanStompSlotsAsync();
+
+    restartRigChangePrefetch();
+#endif
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    if (catalog != nullptr)
+        catalog->activeRigChanged();
+#endif
+}
+
+#ifdef SIMPLE_MIDI_ARDUINO
+void ProfilingAmp::rigChangeReceived() {
+    activeRigChanged();
+}
+#else
+void ProfilingAmp::rigChangeReceived() {
+    // stomp handles and scan results of the previous rig are outdated right away
+    rigGeneration++;
+    numRigChangesReceived++;
+    wakeUpRigChangeThread();
+}
+
+void ProfilingAmp::rigChangeThreadLoop() {
+    uint32_t numRigChangesHandled = 0;
+
+    while (true) {
+        uint32_t numReceived;
+#ifdef KPAPI_ATOMIC_WAIT
+        while (((numReceived = numRigChangesReceived.load()) == numRigChangesHandled) && !rigChangeThreadShouldExit)
+            numRigChangesReceived.wait (numReceived);
+#else
+        {
+            std::unique_lock<std::mutex> lk (rigChangeMutex);
+            rigChangeReceivedCv.wait (lk, [&]() {
+                return ((numReceived = numRigChangesReceived.load()) != numRigChangesHandled) || rigChangeThreadShouldExit;
+            });
+        }
+#endif
+        if (rigChangeThreadShouldExit)
+            return;
+
+        // rig changes received in a row only need to be handled once
+        numRigChangesHandled = numReceived;
+        activeRigChanged();
     }
 }
 
+void ProfilingAmp::wakeUpRigChangeThread() {
+#ifdef KPAPI_ATOMIC_WAIT
+    numRigChangesReceived.notify_one();
+#else
+    // the rig change thread is asleep once the mutex is free, if it didn't see the change
+    { std::lock_guard<std::mutex> lk (rigChangeMutex); }
+    rigChangeReceivedCv.notify_one();
+#endif
+}
+
+void ProfilingAmp::stopRigChangeThread() {
+    rigChangeThreadShouldExit = true;
+    // the thread sleeps on the counter
+    numRigChangesReceived++;
+    wakeUpRigChangeThread();
+
+    if (rigChangeThread.joinable())
+        rigChangeThread.join();
+}
+#endif
+
 ProfilingAmp::StompSlot ProfilingAmp::getSlotOfFirstGenericStompType (StompType stompTypeToSearchFor) {
 
     if (stompTypeToSearchFor <= StompType::SpecificMask)
         return StompSlot::Unknown;
 
-    if (needStompListUpdate) {
-        scanStompSlots();
-    }
+    // scan the slots in order until that generic type was found, outdated slots are updated one by one on the way
+    for (int8_t i = 0; i < numStomps; i++) {
+        updateStompSlotIfNeeded (i);
 
-    // scan all stomps in current rig until that generic type was found
-    int8_t i = 0;
-    for (auto &s : stompsInCurrentRig) {
-        StompType maskedType = (StompType)(s->getStompType () & StompType::GenericMask);
+        StompType maskedType = (StompType)(stompTypeInSlot (i) & StompType::GenericMask);
         if (maskedType == stompTypeToSearchFor) {
             return (StompSlot)i;
         }
-        i++;
     }
 
     return StompSlot::Nonexistent;
@@ -232,254 +825,2144 @@ ProfilingAmp::StompSlot ProfilingAmp::getSlotOfFirstSpecificStompType (StompType
     if (stompTypeToSearchFor > StompType::SpecificMask)
         return StompSlot::Unknown;
 
-    if (needStompListUpdate) {
-        scanStompSlots();
-    }
+    // scan the slots in order until that specific type was found, outdated slots are updated one by one on the way
+    for (int8_t i = 0; i < numStomps; i++) {
+        updateStompSlotIfNeeded (i);
 
-    // scan all stomps in current rig until that specific type was found
-    int8_t i = 0;
-    for (auto &s : stompsInCurrentRig) {
-        StompType maskedType = (StompType)(s->getStompType () & StompType::SpecificMask);
+        StompType maskedType = (StompType)(stompTypeInSlot (i) & StompType::SpecificMask);
         if (maskedType == stompTypeToSearchFor) {
             return (StompSlot)i;
         }
-        i++;
     }
 
     return StompSlot::Nonexistent;
 }
 
 void ProfilingAmp::setAmpGain (int16_t gain) {
-    updateHighResNRPN (NRPNPage::Amp, NRPNParameter::AmpGain, gain);
+    setParameter<ParameterID::AmpGain> (gain);
 }
 
 int16_t ProfilingAmp::getAmpGain() {
-    int16_t ampGain = getSingleParameter (NRPNPage::Amp, NRPNParameter::AmpGain);
+    int16_t ampGain = getParameter<ParameterID::AmpGain>();
     return ampGain;
 }
 
 void ProfilingAmp::setAmpEQBassGain (int16_t bassGain) {
-    updateHighResNRPN (NRPNPage::Eq, NRPNParameter::EqBassGain, bassGain);
+    setParameter<ParameterID::EqBassGain> (bassGain);
 }
 
 int16_t ProfilingAmp::getAmpEQBassGain () {
-    int16_t bassGain = getSingleParameter (NRPNPage::Eq,  NRPNParameter::EqBassGain);
+    int16_t bassGain = getParameter<ParameterID::EqBassGain>();
     return bassGain;
 }
 
 void ProfilingAmp::setAmpEQMidGain (int16_t midGain) {
-    updateHighResNRPN (NRPNPage::Eq, NRPNParameter::EqMiddleGain, midGain);
+    setParameter<ParameterID::EqMiddleGain> (midGain);
 }
 
 int16_t ProfilingAmp::getAmpEQMidGain () {
-    int16_t midGain = getSingleParameter (NRPNPage::Eq, NRPNParameter::EqMiddleGain);
+    int16_t midGain = getParameter<ParameterID::EqMiddleGain>();
     return midGain;
 }
 
 void ProfilingAmp::setAmpEQTrebleGain (int16_t highGain) {
-    updateHighResNRPN (NRPNPage::Eq, NRPNParameter::EqTrebleGain, highGain);
+    setParameter<ParameterID::EqTrebleGain> (highGain);
 }
 
 int16_t ProfilingAmp::getAmpEQTrebleGain () {
-    int16_t trebleGain = getSingleParameter (NRPNPage::Eq, NRPNParameter::EqTrebleGain);
+    int16_t trebleGain = getParameter<ParameterID::EqTrebleGain>();
     return trebleGain;
 }
 
 void ProfilingAmp::setAmpEQPresenceGain (int16_t presenceGain) {
-    updateHighResNRPN (NRPNPage::Eq, NRPNParameter::EqPresenceGain, presenceGain);
+    setParameter<ParameterID::EqPresenceGain> (presenceGain);
 }
 
 int16_t ProfilingAmp::getAmpEQPresenceGain () {
-    int16_t presenceGain = getSingleParameter (NRPNPage::Eq, NRPNParameter::EqPresenceGain);
+    int16_t presenceGain = getParameter<ParameterID::EqPresenceGain>();
     return presenceGain;
 }
 
-ProfilingAmp::returnStringType ProfilingAmp::getActiveRigName () {
+ProfilingAmp::AmpSettings ProfilingAmp::getAmpSettings() {
+    AmpSettings settings;
+    int16_t eqGains[4];
+
+    // the EQ gains are consecutive parameters of the EQ page, so two requests are enough for all values
+    MultiParameterRequest requests[2] = {{NRPNPage::Amp, NRPNParameter::AmpGain,    1, &settings.gain},
+                                         {NRPNPage::Eq,  NRPNParameter::EqBassGain, 4, eqGains}};
+    getMultiParameters (requests, 2);
+
+    settings.eqBassGain     = eqGains[EqBassGain - EqBassGain];
+    settings.eqMidGain      = eqGains[EqMiddleGain - EqBassGain];
+    settings.eqTrebleGain   = eqGains[EqTrebleGain - EqBassGain];
+    settings.eqPresenceGain = eqGains[EqPresenceGain - EqBassGain];
 
-    constexpr int8_t activeRigNameControllerLSB = 1;
-    return getStringParameter (0, activeRigNameControllerLSB);
+    return settings;
 }
 
-ProfilingAmp::returnStringType ProfilingAmp::getActiveAmpName () {
+ProfilingAmp::returnStringType ProfilingAmp::getActiveRigName () {
+    return getStringParameter (0, ActiveRigNameLSB);
+}
 
-    constexpr int8_t activeAmpNameControllerLSB = 16;
-    return getStringParameter (0, activeAmpNameControllerLSB);
+ProfilingAmp::returnStringType ProfilingAmp::getActiveAmpName () {
+    return getStringParameter (0, ActiveAmpNameLSB);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getActiveAmpManufacturerName () {
-
-    constexpr int8_t activeAmpManufacturerNameControllerLSB = 21;
-    return getStringParameter (0, activeAmpManufacturerNameControllerLSB);
+    return getStringParameter (0, ActiveAmpManufacturerNameLSB);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getActiveAmpModelName () {
-
-    constexpr int8_t activeAmpModelNameControllerLSB = 24;
-    return getStringParameter (0, activeAmpModelNameControllerLSB);
+    return getStringParameter (0, ActiveAmpModelNameLSB);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getActiveCabName () {
-
-    constexpr int8_t activeCabNameControllerLSB = 32;
-    return getStringParameter (0, activeCabNameControllerLSB);
+    return getStringParameter (0, ActiveCabNameLSB);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getActiveCabManufacturerName () {
-
-    constexpr int8_t activeCabManufacturerNameControllerLSB = 37;
-    return getStringParameter (0, activeCabManufacturerNameControllerLSB);
+    return getStringParameter (0, ActiveCabManufacturerNameLSB);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getActiveCabModelName () {
-
-    constexpr int8_t activeCabModelNameControllerLSB = 42;
-    return getStringParameter (0, activeCabModelNameControllerLSB);
+    return getStringParameter (0, ActiveCabModelNameLSB);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getActivePerformanceName() {
-
-    constexpr uint32_t activePerformanceNameControllerNumber = 0x4000;
     return getExtendedStringParameter (activePerformanceNameControllerNumber);
 }
 
 ProfilingAmp::returnStringType ProfilingAmp::getRigName (RigNr rig) {
-
-    const uint32_t rigNameControllerNumber = rig + 0x3FCF;
-    return getExtendedStringParameter (rigNameControllerNumber);
+    return getExtendedStringParameter (rig + rigNameControllerNumberOffset);
 }
 
-void ProfilingAmp::defaultCommunicationErrorCallback (MIDICommunicationErrorCode ec) {
 #ifndef SIMPLE_MIDI_ARDUINO
+ProfilingAmp::ActiveRigNames ProfilingAmp::getActiveRigNames() {
+    char stringBuffers[8][stringBufferLength];
+
+    StringRequest requests[8] = {{false, ActiveRigNameLSB,               stringBuffers[0]},
+                                 {false, ActiveAmpNameLSB,               stringBuffers[1]},
+                                 {false, ActiveAmpManufacturerNameLSB,   stringBuffers[2]},
+                                 {false, ActiveAmpModelNameLSB,          stringBuffers[3]},
+                                 {false, ActiveCabNameLSB,               stringBuffers[4]},
+                                 {false, ActiveCabManufacturerNameLSB,   stringBuffers[5]},
+                                 {false, ActiveCabModelNameLSB,          stringBuffers[6]},
+                                 {true,  activePerformanceNameControllerNumber, stringBuffers[7]}};
+
+    getStringParameters (requests, 8);
+
+    ActiveRigNames names;
+    names.rigName             = stringBuffers[0];
+    names.ampName             = stringBuffers[1];
+    names.ampManufacturerName = stringBuffers[2];
+    names.ampModelName        = stringBuffers[3];
+    names.cabName             = stringBuffers[4];
+    names.cabManufacturerName = stringBuffers[5];
+    names.cabModelName        = stringBuffers[6];
+    names.performanceName     = stringBuffers[7];
+
+    return names;
+}
 
-    returnStringType errorMsg ("kpapi MIDI communication error: ");
-    switch (ec) {
-        case missingActiveSense:
-            errorMsg += "Missing active Sense";
-            break;
+// ------------------- Rig change prefetch ------------------
+
+void ProfilingAmp::initializePrefetchTable() {
+    // same order as the members of ActiveRigNames
+    const uint32_t nameAddresses[numPrefetchedStrings] = {ActiveRigNameLSB, ActiveAmpNameLSB, ActiveAmpManufacturerNameLSB,
+                                                          ActiveAmpModelNameLSB, ActiveCabNameLSB, ActiveCabManufacturerNameLSB,
+                                                          ActiveCabModelNameLSB, activePerformanceNameControllerNumber};
+    for (int i = 0; i < numPrefetchedStrings; i++) {
+        prefetchedStrings[i].extended = (nameAddresses[i] == activePerformanceNameControllerNumber);
+        prefetchedStrings[i].address = nameAddresses[i];
+        prefetchedStrings[i].state = PrefetchEmpty;
+        prefetchedStrings[i].value[0] = '\0';
+    }
 
-        case noResponseBeforeTimeout:
-            errorMsg += "No response before timeout";
-            break;
+    // same order as the members of AmpSettings, followed by the stomp slots
+    prefetchedParameters[0] = {NRPNPage::Amp, NRPNParameter::AmpGain,        PrefetchEmpty, -1};
+    prefetchedParameters[1] = {NRPNPage::Eq,  NRPNParameter::EqBassGain,     PrefetchEmpty, -1};
+    prefetchedParameters[2] = {NRPNPage::Eq,  NRPNParameter::EqMiddleGain,   PrefetchEmpty, -1};
+    prefetchedParameters[3] = {NRPNPage::Eq,  NRPNParameter::EqTrebleGain,   PrefetchEmpty, -1};
+    prefetchedParameters[4] = {NRPNPage::Eq,  NRPNParameter::EqPresenceGain, PrefetchEmpty, -1};
+    for (int8_t i = 0; i < numStomps; i++) {
+        prefetchedParameters[5 + i] = {fxSlotNRPNPageMapping[i], NRPNParameter::OnOff, PrefetchEmpty, -1};
+    }
+}
 
-        case responseNotMatchingToRequest:
-            errorMsg += "The response received was not matching the last request";
-            break;
+void ProfilingAmp::enableRigChangePrefetch (bool shouldBeEnabled) {
+    {
+        std::lock_guard<std::mutex> lk (stompListMutex);
+        rigChangePrefetch = shouldBeEnabled;
     }
 
-    Logger::writeToLog (errorMsg);
-#endif
+    // start with the rig that is active right now
+    if (shouldBeEnabled)
+        scanStompSlotsAsync();
+
+    restartRigChangePrefetch();
 }
 
-int16_t ProfilingAmp::getSingleParameter (int8_t pageOrMSB, int8_t parameterOrLSB) {
-    int8_t response[4];
+void ProfilingAmp::setRigSnapshotReadyCallback (RigSnapshotReadyCallbackFn newRigSnapshotReadyCallback) {
+    std::lock_guard<std::mutex> lk (prefetchMutex);
+    rigSnapshotReadyCallback = newRigSnapshotReadyCallback;
+}
 
-    // construct and send the request
-    char singleParamRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
-                                 KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
-                                 KemperSysEx::DeviceID, FunctionCode::SingleParamValueReq,
-                                 KemperSysEx::Instance, (char)pageOrMSB, (char)parameterOrLSB,
+bool ProfilingAmp::isRigSnapshotReady() {
+    std::lock_guard<std::mutex> lk (prefetchMutex);
+    return rigChangePrefetch && (numPrefetchesPending == 0);
+}
+
+ProfilingAmp::RigSnapshot ProfilingAmp::getRigSnapshot() {
+    std::unique_lock<std::mutex> lk (prefetchMutex);
+    prefetchUpdated.wait_for (lk, std::chrono::milliseconds (500), [this]() { return numPrefetchesPending == 0; });
+    return buildRigSnapshot();
+}
+
+ProfilingAmp::PrefetchStatistics ProfilingAmp::getPrefetchStatistics() {
+    std::lock_guard<std::mutex> lk (prefetchMutex);
+    return prefetchStatistics;
+}
+
+void ProfilingAmp::resetPrefetchStatistics() {
+    std::lock_guard<std::mutex> lk (prefetchMutex);
+    prefetchStatistics = {0, 0};
+}
+
+void ProfilingAmp::restartRigChangePrefetch() {
+    const bool enabled = rigChangePrefetch;
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lk (prefetchMutex);
+        generation = ++prefetchGeneration;
+
+        const PrefetchState newState = enabled ? PrefetchPending : PrefetchEmpty;
+        for (auto &prefetchedString : prefetchedStrings) {
+            prefetchedString.state = newState;
+        }
+        for (auto &prefetchedParameter : prefetchedParameters) {
+            prefetchedParameter.state = newState;
+        }
+        numPrefetchesPending = enabled ? numPrefetchedStrings + numPrefetchedParameters : 0;
+    }
+    // getters waiting for a value of the previous rig give up
+    prefetchUpdated.notify_all();
+
+    if (enabled)
+        requestPendingPrefetches (generation);
+}
+
+void ProfilingAmp::requestPendingPrefetches (uint32_t generation) {
+    bool stringPending[numPrefetchedStrings];
+    bool parameterPending[numPrefetchedParameters];
+    {
+        std::lock_guard<std::mutex> lk (prefetchMutex);
+        for (int i = 0; i < numPrefetchedStrings; i++) {
+            stringPending[i] = prefetchedStrings[i].state == PrefetchPending;
+        }
+        for (int i = 0; i < numPrefetchedParameters; i++) {
+            parameterPending[i] = prefetchedParameters[i].state == PrefetchPending;
+        }
+    }
+
+    // the addresses never change, so they can be read without the lock
+    for (int i = 0; i < numPrefetchedStrings; i++) {
+        if (!stringPending[i])
+            continue;
+
+        requestStringAsync (prefetchedStrings[i].extended, prefetchedStrings[i].address, [this, generation, i] (const char *value) {
+            storePrefetchedString (generation, i, value);
+        }, BackgroundRequest);
+    }
+    for (int i = 0; i < numPrefetchedParameters; i++) {
+        if (!parameterPending[i])
+            continue;
+
+        requestSingleParameterAsync (prefetchedParameters[i].page, prefetchedParameters[i].parameter, [this, generation, i] (int16_t value) {
+            storePrefetchedParameter (generation, i, value);
+        }, BackgroundRequest);
+    }
+}
+
+void ProfilingAmp::storePrefetchedString (uint32_t generation, int idx, const char *value) {
+    std::unique_lock<std::mutex> lk (prefetchMutex);
+    if (generation != prefetchGeneration)
+        return;
+
+    // an empty string means that the request failed, the getter will ask the amp again then
+    PrefetchedString &prefetchedString = prefetchedStrings[idx];
+    if (value[0] != '\0') {
+        strncpy (prefetchedString.value, value, stringBufferLength - 1);
+        prefetchedString.value[stringBufferLength - 1] = '\0';
+        prefetchedString.state = PrefetchFilled;
+    }
+    else {
+        prefetchedString.state = PrefetchEmpty;
+    }
+
+    prefetchedValueCompleted (lk);
+}
+
+void ProfilingAmp::storePrefetchedParameter (uint32_t generation, int idx, int16_t value) {
+    std::unique_lock<std::mutex> lk (prefetchMutex);
+    if (generation != prefetchGeneration)
+        return;
+
+    // if a setter changed the value in the meantime, the response might be outdated already
+    PrefetchedParameter &prefetchedParameter = prefetchedParameters[idx];
+    if (prefetchedParameter.state == PrefetchPending) {
+        prefetchedParameter.value = value;
+        prefetchedParameter.state = (value < 0) ? PrefetchEmpty : PrefetchFilled;
+    }
+
+    prefetchedValueCompleted (lk);
+}
+
+void ProfilingAmp::prefetchedValueCompleted (std::unique_lock<std::mutex> &lk) {
+    RigSnapshotReadyCallbackFn callback;
+    RigSnapshot snapshot;
+
+    if ((--numPrefetchesPending == 0) && rigSnapshotReadyCallback) {
+        callback = rigSnapshotReadyCallback;
+        snapshot = buildRigSnapshot();
+    }
+    lk.unlock();
+
+    prefetchUpdated.notify_all();
+
+    if (callback)
+        callback (snapshot);
+}
+
+ProfilingAmp::RigSnapshot ProfilingAmp::buildRigSnapshot() {
+    returnStringType names[numPrefetchedStrings];
+    for (int i = 0; i < numPrefetchedStrings; i++) {
+        if (prefetchedStrings[i].state == PrefetchFilled)
+            names[i] = prefetchedStrings[i].value;
+    }
+
+    int16_t values[numPrefetchedParameters];
+    for (int i = 0; i < numPrefetchedParameters; i++) {
+        values[i] = (prefetchedParameters[i].state == PrefetchFilled) ? prefetchedParameters[i].value : -1;
+    }
+
+    RigSnapshot snapshot;
+    snapshot.names = {names[0], names[1], names[2], names[3], names[4], names[5], names[6], names[7]};
+    snapshot.ampSettings = {values[0], values[1], values[2], values[3], values[4]};
+    for (int8_t i = 0; i < numStomps; i++) {
+        snapshot.stompToggleStates[i] = values[5 + i];
+    }
+    return snapshot;
+}
+
+bool ProfilingAmp::readPrefetchedString (bool extended, uint32_t address, char *stringBuffer, bool mayBlock) {
+    if (!rigChangePrefetch)
+        return false;
+
+    int idx = 0;
+    while ((idx < numPrefetchedStrings) && ((prefetchedStrings[idx].extended != extended) || (prefetchedStrings[idx].address != address)))
+        idx++;
+
+    if (idx == numPrefetchedStrings)
+        return false;
+
+    std::unique_lock<std::mutex> lk (prefetchMutex);
+    PrefetchedString &prefetchedString = prefetchedStrings[idx];
+
+    // the request is on its way already, waiting for it is faster than sending another one
+    if (mayBlock && (prefetchedString.state == PrefetchPending)) {
+        const uint32_t generation = prefetchGeneration;
+        prefetchUpdated.wait_for (lk, std::chrono::milliseconds (500), [&]() {
+            return (prefetchedString.state != PrefetchPending) || (generation != prefetchGeneration);
+        });
+    }
+
+    if (prefetchedString.state != PrefetchFilled) {
+        prefetchStatistics.numMisses++;
+        return false;
+    }
+
+    memcpy (stringBuffer, prefetchedString.value, stringBufferLength);
+    prefetchStatistics.numHits++;
+    return true;
+}
+
+bool ProfilingAmp::readPrefetchedParameters (int8_t page, int8_t firstParameter, int numValues, int16_t *values, bool mayBlock) {
+    if (!rigChangePrefetch)
+        return false;
+
+    auto findPrefetchedParameter = [this, page] (int parameter) -> PrefetchedParameter* {
+        for (auto &prefetchedParameter : prefetchedParameters) {
+            if ((prefetchedParameter.page == page) && (prefetchedParameter.parameter == parameter))
+                return &prefetchedParameter;
+        }
+        return nullptr;
+    };
+
+    int numPrefetched = 0;
+    for (int i = 0; i < numValues; i++) {
+        if (findPrefetchedParameter (firstParameter + i) != nullptr)
+            numPrefetched++;
+    }
+
+    // values that are never prefetched don't count as misses
+    if (numPrefetched == 0)
+        return false;
+
+    std::unique_lock<std::mutex> lk (prefetchMutex);
+
+    auto allValuesArrived = [&]() {
+        for (int i = 0; i < numValues; i++) {
+            PrefetchedParameter *prefetchedParameter = findPrefetchedParameter (firstParameter + i);
+            if ((prefetchedParameter != nullptr) && (prefetchedParameter->state == PrefetchPending))
+                return false;
+        }
+        return true;
+    };
+
+    if (mayBlock && (numPrefetched == numValues)) {
+        const uint32_t generation = prefetchGeneration;
+        prefetchUpdated.wait_for (lk, std::chrono::milliseconds (500), [&]() {
+            return allValuesArrived() || (generation != prefetchGeneration);
+        });
+    }
+
+    for (int i = 0; i < numValues; i++) {
+        PrefetchedParameter *prefetchedParameter = findPrefetchedParameter (firstParameter + i);
+        if ((prefetchedParameter == nullptr) || (prefetchedParameter->state != PrefetchFilled)) {
+            prefetchStatistics.numMisses++;
+            return false;
+        }
+        values[i] = prefetchedParameter->value;
+    }
+
+    prefetchStatistics.numHits++;
+    return true;
+}
+
+void ProfilingAmp::updatePrefetchedParameter (int8_t page, int8_t parameter, int16_t value) {
+    if (!rigChangePrefetch)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk (prefetchMutex);
+        for (auto &prefetchedParameter : prefetchedParameters) {
+            if ((prefetchedParameter.page == page) && (prefetchedParameter.parameter == parameter)) {
+                prefetchedParameter.value = value;
+                prefetchedParameter.state = PrefetchFilled;
+                break;
+            }
+        }
+    }
+    prefetchUpdated.notify_all();
+}
+
+// ------------------- State cache ------------------
+
+bool ProfilingAmp::saveStateCache (const char *stateCacheFilePath) {
+    StateCache cache;
+    memset (&cache, 0, sizeof (cache));
+    memcpy (cache.magic, "KPSC", 4);
+    cache.version = stateCacheVersion;
+    cache.nameLength = stringBufferLength;
+    cache.numStompSlots = numStomps;
+    cache.numNames = numPrefetchedStrings;
+    cache.numParameterValues = numPrefetchedParameters;
+    cache.hasParameterMirror = parameterMirrorEnabled;
+
+    {
+        std::lock_guard<std::mutex> lk (stompListMutex);
+        for (int8_t i = 0; i < numStomps; i++) {
+            const bool stompKnown = ((stompSlotsNeedingUpdate | stompSlotsBeingScanned) & (1 << i)) == 0;
+            cache.stompTypeIDs[i] = stompKnown ? (int16_t)(stompsInCurrentRig[i]->getStompType() & StompType::SpecificMask) : -1;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lk (prefetchMutex);
+        for (int i = 0; i < numPrefetchedStrings; i++) {
+            if (prefetchedStrings[i].state == PrefetchFilled)
+                memcpy (cache.names[i], prefetchedStrings[i].value, stringBufferLength);
+        }
+        for (int i = 0; i < numPrefetchedParameters; i++) {
+            cache.parameterValues[i] = (prefetchedParameters[i].state == PrefetchFilled) ? prefetchedParameters[i].value : -1;
+        }
+    }
+
+    std::FILE *file = std::fopen (stateCacheFilePath, "wb");
+    if (file == nullptr)
+        return false;
+
+    bool success = std::fwrite (&cache, sizeof (cache), 1, file) == 1;
+
+    if (success && cache.hasParameterMirror) {
+        int16_t mirroredValues[numMirroredPages][numParametersPerPage];
+        for (int page = 0; page < numMirroredPages; page++) {
+            for (int parameter = 0; parameter < numParametersPerPage; parameter++) {
+                mirroredValues[page][parameter] = parameterMirror[page][parameter];
+            }
+        }
+        success = std::fwrite (mirroredValues, sizeof (mirroredValues), 1, file) == 1;
+    }
+
+    return (std::fclose (file) == 0) && success;
+}
+
+bool ProfilingAmp::loadStateCache (const char *stateCacheFilePath) {
+    StateCache cache;
+    int16_t mirroredValues[numMirroredPages][numParametersPerPage];
+    bool isValidCache = false;
+
+    if (std::FILE *file = std::fopen (stateCacheFilePath, "rb")) {
+        isValidCache = (std::fread (&cache, sizeof (cache), 1, file) == 1) &&
+                       (memcmp (cache.magic, "KPSC", 4) == 0) &&
+                       (cache.version == stateCacheVersion) &&
+                       (cache.nameLength == stringBufferLength) &&
+                       (cache.numStompSlots == numStomps) &&
+                       (cache.numNames == numPrefetchedStrings) &&
+                       (cache.numParameterValues == numPrefetchedParameters);
+
+        if (isValidCache && cache.hasParameterMirror)
+            cache.hasParameterMirror = std::fread (mirroredValues, sizeof (mirroredValues), 1, file) == 1;
+
+        std::fclose (file);
+    }
+
+    // the two names identify the rig, so they are all that needs to be requested to validate the cache
+    if (isValidCache) {
+        char rigName[stringBufferLength];
+        char performanceName[stringBufferLength];
+        StringRequest requests[2] = {{false, ActiveRigNameLSB,                      rigName},
+                                     {true,  activePerformanceNameControllerNumber, performanceName}};
+        getStringParameters (requests, 2, false);
+
+        const int performanceNameIdx = numPrefetchedStrings - 1;
+        cache.names[0][stringBufferLength - 1] = '\0';
+        cache.names[performanceNameIdx][stringBufferLength - 1] = '\0';
+        isValidCache = (rigName[0] != '\0') &&
+                       (strcmp (rigName, cache.names[0]) == 0) &&
+                       (strcmp (performanceName, cache.names[performanceNameIdx]) == 0);
+    }
+
+    if (!isValidCache) {
+        enableRigChangePrefetch (true);
+        return false;
+    }
+
+    // as after a rig change, results of requests still on their way for the state before are dropped
+    uint8_t slotsToScan = 0;
+    {
+        std::lock_guard<std::mutex> lk (stompListMutex);
+        rigGeneration++;
+        stompSlotsBeingScanned = 0;
+        rigChangePrefetch = true;
+
+        // the cache holds the specific stomp type IDs as sent by the amp, anything else is scanned again
+        for (int8_t i = 0; i < numStomps; i++) {
+            if ((cache.stompTypeIDs[i] >= 0) && (cache.stompTypeIDs[i] <= StompType::SpecificMask))
+                rebuildStompSlot (i, cache.stompTypeIDs[i]);
+            else
+                slotsToScan |= (1 << i);
+        }
+    }
+    stompScanFinished.notify_all();
+
+#ifdef KPAPI_PARAMETER_MIRROR
+    invalidateParameterMirror();
+    if (parameterMirrorEnabled && cache.hasParameterMirror) {
+        for (int page = 0; page < numMirroredPages; page++) {
+            for (int parameter = 0; parameter < numParametersPerPage; parameter++) {
+                parameterMirror[page][parameter] = mirroredValues[page][parameter];
+            }
+        }
+    }
+#endif
+    forgetContinuousControllerValues();
+
+    uint32_t generation;
+    RigSnapshotReadyCallbackFn callback;
+    RigSnapshot snapshot;
+    {
+        std::lock_guard<std::mutex> lk (prefetchMutex);
+        generation = ++prefetchGeneration;
+        numPrefetchesPending = 0;
+
+        for (int i = 0; i < numPrefetchedStrings; i++) {
+            PrefetchedString &prefetchedString = prefetchedStrings[i];
+            memcpy (prefetchedString.value, cache.names[i], stringBufferLength);
+            prefetchedString.value[stringBufferLength - 1] = '\0';
+            prefetchedString.state = (prefetchedString.value[0] != '\0') ? PrefetchFilled : PrefetchPending;
+            numPrefetchesPending += (prefetchedString.state == PrefetchPending);
+        }
+        for (int i = 0; i < numPrefetchedParameters; i++) {
+            PrefetchedParameter &prefetchedParameter = prefetchedParameters[i];
+            prefetchedParameter.value = cache.parameterValues[i];
+            prefetchedParameter.state = (prefetchedParameter.value >= 0) ? PrefetchFilled : PrefetchPending;
+            numPrefetchesPending += (prefetchedParameter.state == PrefetchPending);
+        }
+
+        if ((numPrefetchesPending == 0) && rigSnapshotReadyCallback) {
+            callback = rigSnapshotReadyCallback;
+            snapshot = buildRigSnapshot();
+        }
+    }
+    prefetchUpdated.notify_all();
+
+    // only what the cache doesn't know is requested
+    if (slotsToScan != 0)
+        scanStompSlotsAsync (slotsToScan);
+
+    requestPendingPrefetches (generation);
+
+    if (callback)
+        callback (snapshot);
+
+    return true;
+}
+
+// ------------------- Asynchronous getters ------------------
+
+std::future<int16_t> ProfilingAmp::getAmpGainAsync() {
+    return makeFuture<int16_t> ([this] (ParameterCallbackFn handler) { getAmpGainAsync (handler); });
+}
+
+void ProfilingAmp::getAmpGainAsync (ParameterCallbackFn completionHandler) {
+    getParameterAsync<ParameterID::AmpGain> (completionHandler);
+}
+
+std::future<int16_t> ProfilingAmp::getAmpEQBassGainAsync() {
+    return makeFuture<int16_t> ([this] (ParameterCallbackFn handler) { getAmpEQBassGainAsync (handler); });
+}
+
+void ProfilingAmp::getAmpEQBassGainAsync (ParameterCallbackFn completionHandler) {
+    getParameterAsync<ParameterID::EqBassGain> (completionHandler);
+}
+
+std::future<int16_t> ProfilingAmp::getAmpEQMidGainAsync() {
+    return makeFuture<int16_t> ([this] (ParameterCallbackFn handler) { getAmpEQMidGainAsync (handler); });
+}
+
+void ProfilingAmp::getAmpEQMidGainAsync (ParameterCallbackFn completionHandler) {
+    getParameterAsync<ParameterID::EqMiddleGain> (completionHandler);
+}
+
+std::future<int16_t> ProfilingAmp::getAmpEQTrebleGainAsync() {
+    return makeFuture<int16_t> ([this] (ParameterCallbackFn handler) { getAmpEQTrebleGainAsync (handler); });
+}
+
+void ProfilingAmp::getAmpEQTrebleGainAsync (ParameterCallbackFn completionHandler) {
+    getParameterAsync<ParameterID::EqTrebleGain> (completionHandler);
+}
+
+std::future<int16_t> ProfilingAmp::getAmpEQPresenceGainAsync() {
+    return makeFuture<int16_t> ([this] (ParameterCallbackFn handler) { getAmpEQPresenceGainAsync (handler); });
+}
+
+void ProfilingAmp::getAmpEQPresenceGainAsync (ParameterCallbackFn completionHandler) {
+    getParameterAsync<ParameterID::EqPresenceGain> (completionHandler);
+}
+
+std::future<bool> ProfilingAmp::getStompToggleStateAsync (StompSlot stompSlot) {
+    return makeFuture<bool> ([this, stompSlot] (ToggleStateCallbackFn handler) { getStompToggleStateAsync (stompSlot, handler); });
+}
+
+void ProfilingAmp::getStompToggleStateAsync (StompSlot stompSlot, ToggleStateCallbackFn completionHandler) {
+    getSingleParameterAsync (stompSlotToNRPNPage (stompSlot), NRPNParameter::OnOff, [completionHandler] (int16_t toggleState) {
+        completionHandler (toggleState);
+    });
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveRigNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveRigNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveRigNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveRigNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveAmpNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveAmpNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveAmpNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveAmpNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveAmpManufacturerNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveAmpManufacturerNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveAmpManufacturerNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveAmpManufacturerNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveAmpModelNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveAmpModelNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveAmpModelNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveAmpModelNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveCabNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveCabNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveCabNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveCabNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveCabManufacturerNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveCabManufacturerNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveCabManufacturerNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveCabManufacturerNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActiveCabModelNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActiveCabModelNameAsync (handler); });
+}
+
+void ProfilingAmp::getActiveCabModelNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (false, ActiveCabModelNameLSB, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getActivePerformanceNameAsync() {
+    return makeFuture<returnStringType> ([this] (StringCallbackFn handler) { getActivePerformanceNameAsync (handler); });
+}
+
+void ProfilingAmp::getActivePerformanceNameAsync (StringCallbackFn completionHandler) {
+    getStringParameterAsync (true, activePerformanceNameControllerNumber, completionHandler);
+}
+
+std::future<ProfilingAmp::returnStringType> ProfilingAmp::getRigNameAsync (RigNr rig) {
+    return makeFuture<returnStringType> ([this, rig] (StringCallbackFn handler) { getRigNameAsync (rig, handler); });
+}
+
+void ProfilingAmp::getRigNameAsync (RigNr rig, StringCallbackFn completionHandler) {
+    getStringParameterAsync (true, rig + rigNameControllerNumberOffset, completionHandler);
+}
+#endif
+
+// ------------------- Coroutines ------------------
+
+#ifdef KPAPI_COROUTINES
+void ProfilingAmp::spawn (Task task) {
+    coroutineExecutor.post (task.handle);
+    // the task destroys itself when it's done
+    task.handle = nullptr;
+    coroutineExecutor.runPending();
+}
+
+ProfilingAmp::Awaitable<int16_t> ProfilingAmp::getAmpGainAwaitable() {
+    return getSingleParameterAwaitable (NRPNPage::Amp, NRPNParameter::AmpGain);
+}
+
+ProfilingAmp::Awaitable<int16_t> ProfilingAmp::getAmpEQBassGainAwaitable() {
+    return getSingleParameterAwaitable (NRPNPage::Eq, NRPNParameter::EqBassGain);
+}
+
+ProfilingAmp::Awaitable<int16_t> ProfilingAmp::getAmpEQMidGainAwaitable() {
+    return getSingleParameterAwaitable (NRPNPage::Eq, NRPNParameter::EqMiddleGain);
+}
+
+ProfilingAmp::Awaitable<int16_t> ProfilingAmp::getAmpEQTrebleGainAwaitable() {
+    return getSingleParameterAwaitable (NRPNPage::Eq, NRPNParameter::EqTrebleGain);
+}
+
+ProfilingAmp::Awaitable<int16_t> ProfilingAmp::getAmpEQPresenceGainAwaitable() {
+    return getSingleParameterAwaitable (NRPNPage::Eq, NRPNParameter::EqPresenceGain);
+}
+
+ProfilingAmp::Awaitable<bool> ProfilingAmp::getStompToggleStateAwaitable (StompSlot stompSlot) {
+    return Awaitable<bool> (*this, [this, stompSlot] (ToggleStateCallbackFn handler) {
+        getStompToggleStateAsync (stompSlot, handler);
+    });
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveRigNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveRigNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveAmpNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveAmpNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveAmpManufacturerNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveAmpManufacturerNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveAmpModelNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveAmpModelNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveCabNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveCabNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveCabManufacturerNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveCabManufacturerNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActiveCabModelNameAwaitable() {
+    return getStringParameterAwaitable (0, ActiveCabModelNameLSB);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getActivePerformanceNameAwaitable() {
+    return getExtendedStringParameterAwaitable (activePerformanceNameControllerNumber);
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getRigNameAwaitable (RigNr rig) {
+    return getExtendedStringParameterAwaitable (rig + rigNameControllerNumberOffset);
+}
+#endif
+
+void ProfilingAmp::defaultCommunicationErrorCallback (MIDICommunicationErrorCode ec) {
+#ifndef SIMPLE_MIDI_ARDUINO
+
+    returnStringType errorMsg ("kpapi MIDI communication error: ");
+    switch (ec) {
+        case missingActiveSense:
+            errorMsg += "Missing active Sense";
+            break;
+
+        case noResponseBeforeTimeout:
+            errorMsg += "No response before timeout";
+            break;
+
+        case responseNotMatchingToRequest:
+            errorMsg += "The response received was not matching the last request";
+            break;
+    }
+
+    Logger::writeToLog (errorMsg);
+#endif
+}
+
+int16_t ProfilingAmp::getSingleParameter (int8_t pageOrMSB, int8_t parameterOrLSB) {
+    ParameterRequest request = {pageOrMSB, parameterOrLSB, -1};
+    getSingleParameters (&request, 1);
+    return request.value;
+}
+
+void ProfilingAmp::getSingleParameters (ParameterRequest *requests, int numRequests) {
+    typedef ResponseMessageManager<int8_t> ResponseManager;
+
+    int8_t responses[ResponseManager::maxPendingRequests][4];
+    ResponseManager::RequestHandle requestHandles[ResponseManager::maxPendingRequests];
+    ResponseManager::ErrorCode errorCodes[ResponseManager::maxPendingRequests];
+    ParameterRequest *sentRequests[ResponseManager::maxPendingRequests];
+
+    // process the requests in chunks that fit into the slots available
+    while (numRequests > 0) {
+        int chunkSize = 0;
+        int numSent = 0;
+#ifdef KPAPI_PARAMETER_MIRROR
+        const MirrorSequenceNumber chunkSentAt = parameterMirrorWriteSequence;
+#endif
+
+        // register and send out all requests of this chunk back to back
+        for (; (chunkSize < numRequests) && (numSent < ResponseManager::maxPendingRequests); chunkSize++) {
+            const int i = chunkSize;
+            const int8_t pageOrMSB = requests[i].pageOrMSB;
+            const int8_t parameterOrLSB = requests[i].parameterOrLSB;
+
+#ifdef KPAPI_PARAMETER_MIRROR
+            // values already known by the mirror don't need any communication
+            requests[i].value = readParameterMirror (pageOrMSB, parameterOrLSB);
+            if (requests[i].value != mirrorValueUnknown)
+                continue;
+#endif
+#ifndef SIMPLE_MIDI_ARDUINO
+            // the value might have been prefetched after the last rig change
+            if (readPrefetchedParameters (pageOrMSB, parameterOrLSB, 1, &requests[i].value, true))
+                continue;
+#endif
+            const uint32_t key = responseKey (FunctionCode::SingleParamChange, ((uint8_t)pageOrMSB << 8) | (uint8_t)parameterOrLSB);
+
+            memset (responses[numSent], 0, sizeof (responses[numSent]));
+            requestHandles[numSent] = parameterResponseManager.registerRequest (key, responses[numSent], 4, ForegroundRequest, numSent == 0);
+
+            // other threads use the remaining slots, collect the responses of this chunk before queueing for more
+            if ((requestHandles[numSent] == ResponseManager::invalidRequestHandle) && (numSent > 0))
+                break;
+
+            sentRequests[numSent] = requests + i;
+
+            if (requestHandles[numSent] != ResponseManager::invalidRequestHandle)
+                sendSingleParameterRequest (pageOrMSB, parameterOrLSB);
+
+            numSent++;
+        }
+
+        // wait for all responses of this chunk
+        if (numSent > 0)
+            parameterResponseManager.waitForResponsesOrTimeout (requestHandles, errorCodes, numSent);
+
+        for (int i = 0; i < numSent; i++) {
+            ParameterRequest &request = *sentRequests[i];
+            request.value = -1;
+
+            // error handling, a timeout was already reported by the response manager
+            if (errorCodes[i] != ResponseManager::ErrorCode::success)
+                continue;
+
+            // check if the response is matching
+            if ((responses[i][0] == request.pageOrMSB) && (responses[i][1] == request.parameterOrLSB)) {
+                // put together lsb and msb
+                request.value = (responses[i][2] << 7) | responses[i][3];
+#ifdef KPAPI_PARAMETER_MIRROR
+                writeParameterMirrorResponse (request.pageOrMSB, request.parameterOrLSB, request.value, chunkSentAt);
+#endif
+            }
+            else {
+                midiCommunicationError (MIDICommunicationErrorCode::responseNotMatchingToRequest);
+            }
+        }
+
+        requests += chunkSize;
+        numRequests -= chunkSize;
+    }
+}
+
+void ProfilingAmp::sendSingleParameterRequest (int8_t pageOrMSB, int8_t parameterOrLSB) {
+    char singleParamRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
+                                 KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
+                                 KemperSysEx::DeviceID, FunctionCode::SingleParamValueReq,
+                                 KemperSysEx::Instance, (char)pageOrMSB, (char)parameterOrLSB,
                                  SysExEnd};
-    sendSysEx (singleParamRequest, sizeof (singleParamRequest));
+    transmitSysEx (BulkPriority, singleParamRequest, sizeof (singleParamRequest));
+}
+
+int ProfilingAmp::getMultiParameters (MultiParameterRequest *requests, int numRequests) {
+    typedef ResponseMessageManager<int8_t> ResponseManager;
+
+    ResponseManager::RequestHandle requestHandles[ResponseManager::maxPendingRequests];
+    ResponseManager::ErrorCode errorCodes[ResponseManager::maxPendingRequests];
+    int numBytesReceived[ResponseManager::maxPendingRequests];
+    MultiParameterRequest *sentRequests[ResponseManager::maxPendingRequests];
+    int numValuesReceived = 0;
+
+    // process the requests in chunks that fit into the slots available
+    while (numRequests > 0) {
+        int chunkSize = 0;
+        int numSent = 0;
+#ifdef KPAPI_PARAMETER_MIRROR
+        const MirrorSequenceNumber chunkSentAt = parameterMirrorWriteSequence;
+#endif
+
+        // register and send out all requests of this chunk back to back
+        for (; (chunkSize < numRequests) && (numSent < ResponseManager::maxPendingRequests); chunkSize++) {
+            const int i = chunkSize;
+            const MultiParameterRequest &request = requests[i];
+
+#ifdef KPAPI_PARAMETER_MIRROR
+            // if the mirror knows all values of this range, no communication is needed
+            int8_t numValuesMirrored = 0;
+            while ((numValuesMirrored < request.numValues) &&
+                   ((request.values[numValuesMirrored] = readParameterMirror (request.page, request.firstParameter + numValuesMirrored)) != mirrorValueUnknown)) {
+                numValuesMirrored++;
+            }
+            if (numValuesMirrored == request.numValues) {
+                numValuesReceived += numValuesMirrored;
+                continue;
+            }
+#endif
+#ifndef SIMPLE_MIDI_ARDUINO
+            if (readPrefetchedParameters (request.page, request.firstParameter, request.numValues, request.values, true)) {
+                numValuesReceived += request.numValues;
+                continue;
+            }
+#endif
+            const uint32_t key = responseKey (FunctionCode::MultiParamChange, ((uint8_t)request.page << 8) | (uint8_t)request.firstParameter);
+
+            // The response contains an MSB/LSB byte pair for each value. To avoid an additional buffer, the raw bytes are
+            // received directly into the memory of the value array and decoded in place afterwards.
+            requestHandles[numSent] = parameterResponseManager.registerRequest (key, (int8_t*)request.values, request.numValues * 2,
+                                                                                ForegroundRequest, numSent == 0);
+
+            // other threads use the remaining slots, collect the responses of this chunk before queueing for more
+            if ((requestHandles[numSent] == ResponseManager::invalidRequestHandle) && (numSent > 0))
+                break;
+
+            sentRequests[numSent] = requests + i;
+
+            if (requestHandles[numSent++] == ResponseManager::invalidRequestHandle)
+                continue;
+
+            char multiParamRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
+                                        KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
+                                        KemperSysEx::DeviceID, FunctionCode::MultiParamValueReq,
+                                        KemperSysEx::Instance, (char)request.page, (char)request.firstParameter,
+                                        SysExEnd};
+            transmitSysEx (BulkPriority, multiParamRequest, sizeof (multiParamRequest));
+        }
+
+        // wait for all responses of this chunk
+        if (numSent > 0)
+            parameterResponseManager.waitForResponsesOrTimeout (requestHandles, errorCodes, numSent, numBytesReceived);
+
+        for (int i = 0; i < numSent; i++) {
+            const MultiParameterRequest &request = *sentRequests[i];
+            const int8_t *rawBytes = (const int8_t*)request.values;
+            const int numValues = numBytesReceived[i] / 2;
+
+            // decode in place, each value is written to the position of the two bytes just read
+            for (int v = 0; v < numValues; v++) {
+                request.values[v] = (rawBytes[2 * v] << 7) | rawBytes[2 * v + 1];
+#ifdef KPAPI_PARAMETER_MIRROR
+                writeParameterMirrorResponse (request.page, request.firstParameter + v, request.values[v], chunkSentAt);
+#endif
+            }
+            for (int v = numValues; v < request.numValues; v++) {
+                request.values[v] = -1;
+            }
+
+            numValuesReceived += numValues;
+        }
+
+        requests += chunkSize;
+        numRequests -= chunkSize;
+    }
+
+    return numValuesReceived;
+}
+
+ProfilingAmp::returnStringType ProfilingAmp::getStringParameter (int8_t MSB, int8_t LSB) {
+    // Use a temporary char buffer on the stack for all platforms that return a std::string
+    KPAPI_TEMP_STRING_BUFFER_IF_NEEDED
+
+    StringRequest request = {false, ((uint32_t)(uint8_t)MSB << 8) | (uint8_t)LSB, stringBuffer};
+    getStringParameters (&request, 1);
+
+    // just return the buffer. If something went wrong, it will be empty
+    return stringBuffer;
+}
+
+ProfilingAmp::returnStringType ProfilingAmp::getExtendedStringParameter (uint32_t extendedControllerNumber) {
+    // Use a temporary char buffer on the stack for all platforms that return a std::string
+    KPAPI_TEMP_STRING_BUFFER_IF_NEEDED
+
+    StringRequest request = {true, extendedControllerNumber, stringBuffer};
+    getStringParameters (&request, 1);
+
+    // just return the buffer. If something went wrong, it will be empty
+    return stringBuffer;
+}
+
+int ProfilingAmp::getStringParameters (StringRequest *requests, int numRequests, bool mayUsePrefetchedStrings, RequestPriority priority) {
+    typedef ResponseMessageManager<char> ResponseManager;
+
+    ResponseManager::RequestHandle requestHandles[ResponseManager::maxPendingRequests];
+    ResponseManager::ErrorCode errorCodes[ResponseManager::maxPendingRequests];
+    int numStringsReceived = 0;
+
+    // process the requests in chunks that fit into the slots available
+    while (numRequests > 0) {
+        int chunkSize = 0;
+        int numSent = 0;
+
+        // register and send out all requests of this chunk back to back
+        for (; (chunkSize < numRequests) && (numSent < ResponseManager::maxPendingRequests); chunkSize++) {
+            const StringRequest &request = requests[chunkSize];
+            const FunctionCode responseFunctionCode = request.extended ? FunctionCode::ExtendedStringParam : FunctionCode::StringParam;
+
+#ifndef SIMPLE_MIDI_ARDUINO
+            // the string might have been prefetched after the last rig change
+            if (mayUsePrefetchedStrings && readPrefetchedString (request.extended, request.address, request.stringBuffer, true)) {
+                numStringsReceived++;
+                continue;
+            }
+#endif
+
+            request.stringBuffer[0] = '\0';
+            requestHandles[numSent] = stringResponseManager.registerRequest (responseKey (responseFunctionCode, request.address),
+                                                                             request.stringBuffer, stringBufferLength,
+                                                                             priority, numSent == 0);
+
+            // other threads use the remaining slots, collect the responses of this chunk before queueing for more
+            if ((requestHandles[numSent] == ResponseManager::invalidRequestHandle) && (numSent > 0))
+                break;
+
+            if (requestHandles[numSent++] != ResponseManager::invalidRequestHandle)
+                sendStringRequest (request);
+        }
+
+        // wait for all responses of this chunk
+        if (numSent > 0)
+            stringResponseManager.waitForResponsesOrTimeout (requestHandles, errorCodes, numSent);
+
+        for (int i = 0; i < numSent; i++) {
+            numStringsReceived += (errorCodes[i] == ResponseManager::success);
+        }
+
+        // the buffers of failed requests are already cleared, just make sure that all strings are terminated
+        for (int i = 0; i < chunkSize; i++) {
+            requests[i].stringBuffer[stringBufferLength - 1] = '\0';
+        }
+
+        requests += chunkSize;
+        numRequests -= chunkSize;
+    }
+
+    return numStringsReceived;
+}
+
+void ProfilingAmp::sendStringRequest (const StringRequest &request) {
+    if (request.extended) {
+        char extendedStringRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
+                                        KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
+                                        KemperSysEx::DeviceID, FunctionCode::ExtendedStringParamReq,
+                                        KemperSysEx::Instance, 'M', '1', '2', '3', 'L', SysExEnd};
+        // replace values 8 - 12
+        uint32_t extendedControllerNumber = request.address;
+        for (int8_t i = 12; i > 7; i--) {
+            uint8_t maskedContNumbByte = extendedControllerNumber & 0x0000007F;
+            extendedStringRequest[i] = (char)maskedContNumbByte;
+            extendedControllerNumber >>= 7;
+        }
+
+        transmitSysEx (BulkPriority, extendedStringRequest, sizeof (extendedStringRequest));
+    }
+    else {
+        char stringRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
+                                KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
+                                KemperSysEx::DeviceID, FunctionCode::StringParamReq,
+                                KemperSysEx::Instance, (char)(request.address >> 8), (char)(request.address & 0xFF),
+                                SysExEnd};
+
+        transmitSysEx (BulkPriority, stringRequest, sizeof (stringRequest));
+    }
+}
+
+#ifndef SIMPLE_MIDI_ARDUINO
+void ProfilingAmp::getSingleParameterAsync (int8_t pageOrMSB, int8_t parameterOrLSB, ParameterCallbackFn completionHandler) {
+#ifdef KPAPI_PARAMETER_MIRROR
+    // values already known by the mirror are delivered immediately
+    const int16_t mirroredValue = readParameterMirror (pageOrMSB, parameterOrLSB);
+    if (mirroredValue != mirrorValueUnknown) {
+        completionHandler (mirroredValue);
+        return;
+    }
+#endif
+
+    int16_t prefetchedValue;
+    if (readPrefetchedParameters (pageOrMSB, parameterOrLSB, 1, &prefetchedValue, false)) {
+        completionHandler (prefetchedValue);
+        return;
+    }
+
+    requestSingleParameterAsync (pageOrMSB, parameterOrLSB, completionHandler);
+}
+
+void ProfilingAmp::requestSingleParameterAsync (int8_t pageOrMSB, int8_t parameterOrLSB, ParameterCallbackFn completionHandler, RequestPriority priority) {
+    typedef ResponseMessageManager<int8_t> ResponseManager;
+
+    const uint32_t key = responseKey (FunctionCode::SingleParamChange, ((uint8_t)pageOrMSB << 8) | (uint8_t)parameterOrLSB);
+    // the mirror is always available without Arduino
+    const MirrorSequenceNumber requestSentAt = parameterMirrorWriteSequence;
+
+    parameterResponseManager.submitAsyncRequest (key, [this, pageOrMSB, parameterOrLSB, requestSentAt, completionHandler] (ResponseManager::ErrorCode ec, const int8_t *response, int numElementsReceived) {
+        // a timeout was already reported by the response manager
+        if (ec != ResponseManager::ErrorCode::success) {
+            completionHandler (-1);
+            return;
+        }
+
+        // check if the response is matching
+        if ((numElementsReceived < 4) || (response[0] != pageOrMSB) || (response[1] != parameterOrLSB)) {
+            midiCommunicationError (MIDICommunicationErrorCode::responseNotMatchingToRequest);
+            completionHandler (-1);
+            return;
+        }
+
+        // put together lsb and msb
+        const int16_t value = (response[2] << 7) | response[3];
+        writeParameterMirrorResponse (pageOrMSB, parameterOrLSB, value, requestSentAt);
+        completionHandler (value);
+    }, [this, pageOrMSB, parameterOrLSB]() {
+        sendSingleParameterRequest (pageOrMSB, parameterOrLSB);
+    }, priority);
+}
+
+void ProfilingAmp::getStringParameterAsync (bool extended, uint32_t address, StringCallbackFn completionHandler) {
+    KPAPI_TEMP_STRING_BUFFER_IF_NEEDED
+
+    if (readPrefetchedString (extended, address, stringBuffer, false)) {
+        completionHandler (stringBuffer);
+        return;
+    }
+
+    requestStringAsync (extended, address, [completionHandler] (const char *string) { completionHandler (string); });
+}
+
+void ProfilingAmp::requestStringAsync (bool extended, uint32_t address, std::function<void (const char*)> completionHandler, RequestPriority priority) {
+    typedef ResponseMessageManager<char> ResponseManager;
+
+    const FunctionCode responseFunctionCode = extended ? FunctionCode::ExtendedStringParam : FunctionCode::StringParam;
+
+    stringResponseManager.submitAsyncRequest (responseKey (responseFunctionCode, address), [completionHandler] (ResponseManager::ErrorCode ec, const char *response, int numElementsReceived) {
+        KPAPI_TEMP_STRING_BUFFER_IF_NEEDED
+
+        int stringLength = (ec == ResponseManager::ErrorCode::success) ? numElementsReceived : 0;
+        if (stringLength >= stringBufferLength)
+            stringLength = stringBufferLength - 1;
+
+        if (stringLength > 0)
+            memcpy (stringBuffer, response, stringLength);
+        stringBuffer[stringLength] = '\0';
+
+        completionHandler (stringBuffer);
+    }, [this, extended, address]() {
+        StringRequest request = {extended, address, nullptr};
+        sendStringRequest (request);
+    }, priority);
+}
+#endif
+
+#ifdef KPAPI_COROUTINES
+ProfilingAmp::Awaitable<int16_t> ProfilingAmp::getSingleParameterAwaitable (int8_t pageOrMSB, int8_t parameterOrLSB) {
+    return Awaitable<int16_t> (*this, [this, pageOrMSB, parameterOrLSB] (ParameterCallbackFn handler) {
+        getSingleParameterAsync (pageOrMSB, parameterOrLSB, handler);
+    });
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getStringParameterAwaitable (int8_t MSB, int8_t LSB) {
+    const uint32_t address = ((uint32_t)(uint8_t)MSB << 8) | (uint8_t)LSB;
+    return Awaitable<returnStringType> (*this, [this, address] (StringCallbackFn handler) {
+        getStringParameterAsync (false, address, handler);
+    });
+}
+
+ProfilingAmp::Awaitable<ProfilingAmp::returnStringType> ProfilingAmp::getExtendedStringParameterAwaitable (uint32_t extendedControllerNumber) {
+    return Awaitable<returnStringType> (*this, [this, extendedControllerNumber] (StringCallbackFn handler) {
+        getStringParameterAsync (true, extendedControllerNumber, handler);
+    });
+}
+#endif
+
+void ProfilingAmp::updateLowResNRPN (NRPNPage page, NRPNParameter parameter, uint8_t value) {
+    parameterValueChanged (page, parameter, value);
+
+    if (collectingParameterChanges) {
+        addToParameterChangeBatch (page, parameter, false, value);
+        return;
+    }
+
+    sendNRPN (page, parameter, false, value);
+}
+
+void ProfilingAmp::updateHighResNRPN (NRPNPage page, NRPNParameter parameter, int16_t value) {
+    parameterValueChanged (page, parameter, value);
+
+    if (collectingParameterChanges) {
+        addToParameterChangeBatch (page, parameter, true, value);
+        return;
+    }
+
+    sendNRPN (page, parameter, true, value);
+}
+
+void ProfilingAmp::sendNRPN (NRPNPage page, NRPNParameter parameter, bool highResolution, int16_t value) {
+    const NRPNTransaction transaction = {page, parameter, highResolution, value};
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // captured messages are sent later, so they can only rely on the selection made by captured messages
+    if (CapturedCommands *capture = captureOfThisThread()) {
+        transmitNRPN (transaction, capture->lastNRPNPage, capture->lastNRPNParameter);
+        return;
+    }
+#endif
+
+#ifdef SIMPLE_MIDI_ARDUINO
+    transmitNRPN (transaction, lastNRPNPage, lastNRPNParameter);
+#else
+    // if the queue is full, help draining it
+    uint32_t ticket;
+    while (!nrpnTransactions.push (transaction, ticket))
+        tryDrainNRPNTransactions();
+
+    // Whoever holds the nrpnMutex sends this transaction along with all others queued. Returning only after it was
+    // handed to the transmit scheduler keeps the messages of this thread in call order
+    while ((int32_t)(nrpnTransactionsSent.load (std::memory_order_acquire) - ticket) < 0)
+        tryDrainNRPNTransactions();
+#endif
+}
+
+void ProfilingAmp::transmitNRPN (const NRPNTransaction &transaction, NRPNPage &selectedPage, NRPNParameter &selectedParameter) {
+    // the whole NRPN sequence is transmitted as one message, so nothing can get in between
+    char controlValuePairs[8];
+    uint8_t numControlChanges = 0;
+
+    if ((transaction.page != selectedPage) || (transaction.parameter != selectedParameter)) {
+        controlValuePairs[numControlChanges * 2]     = 99;
+        controlValuePairs[numControlChanges++ * 2 + 1] = transaction.page;
+        controlValuePairs[numControlChanges * 2]     = 98;
+        controlValuePairs[numControlChanges++ * 2 + 1] = transaction.parameter;
+        selectedPage = transaction.page;
+        selectedParameter = transaction.parameter;
+    }
+
+    if (transaction.highResolution) {
+        controlValuePairs[numControlChanges * 2]     = NRPNValMSB;
+        controlValuePairs[numControlChanges++ * 2 + 1] = transaction.value >> 7;
+        controlValuePairs[numControlChanges * 2]     = NRPNValLSB;
+        controlValuePairs[numControlChanges++ * 2 + 1] = transaction.value & 0x7F;
+    }
+    else {
+        controlValuePairs[numControlChanges * 2]     = NRPNValLowResolution;
+        controlValuePairs[numControlChanges++ * 2 + 1] = transaction.value;
+    }
+
+    transmitControlChanges (ParameterPriority, controlValuePairs, numControlChanges);
+}
+
+#ifndef SIMPLE_MIDI_ARDUINO
+ProfilingAmp::NRPNTransactionQueue::NRPNTransactionQueue() {
+    for (uint32_t i = 0; i < size; i++)
+        cells[i].sequence.store (i, std::memory_order_relaxed);
+}
+
+bool ProfilingAmp::NRPNTransactionQueue::push (const NRPNTransaction &transaction, uint32_t &ticket) {
+    uint32_t pos = enqueuePos.load (std::memory_order_relaxed);
+    Cell *cell;
+
+    while (true) {
+        cell = cells + (pos & (size - 1));
+        const int32_t diff = (int32_t)(cell->sequence.load (std::memory_order_acquire) - pos);
+
+        if (diff == 0) {
+            // the cell is free, try to claim it
+            if (enqueuePos.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            // the cell still holds a transaction from the previous round
+            return false;
+        }
+        else {
+            // another thread claimed the cell first
+            pos = enqueuePos.load (std::memory_order_relaxed);
+        }
+    }
+
+    cell->transaction = transaction;
+    cell->sequence.store (pos + 1, std::memory_order_release);
+    ticket = pos + 1;
+    return true;
+}
+
+bool ProfilingAmp::NRPNTransactionQueue::pop (NRPNTransaction &transaction) {
+    Cell &cell = cells[dequeuePos & (size - 1)];
+
+    // empty, or the next cell is claimed but not written yet
+    if ((int32_t)(cell.sequence.load (std::memory_order_acquire) - (dequeuePos + 1)) < 0)
+        return false;
+
+    transaction = cell.transaction;
+    cell.sequence.store (dequeuePos + size, std::memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+void ProfilingAmp::tryDrainNRPNTransactions() {
+    if (!nrpnMutex.try_lock()) {
+        std::this_thread::yield();
+        return;
+    }
+
+    NRPNTransaction transaction;
+    while (nrpnTransactions.pop (transaction)) {
+        transmitNRPN (transaction, lastNRPNPage, lastNRPNParameter);
+        nrpnTransactionsSent.fetch_add (1, std::memory_order_release);
+    }
+
+    nrpnMutex.unlock();
+}
+#endif
+
+// ------------------- Continuous controller queue ------------------
+
+void ProfilingAmp::queueContinuousController (bool isNRPN, NRPNPage page, int8_t parameter, int16_t value) {
+    if (isNRPN) {
+        parameterValueChanged (page, parameter, value);
+        // batches already send each parameter only once
+        if (collectingParameterChanges) {
+            addToParameterChangeBatch (page, (NRPNParameter)parameter, true, value);
+            return;
+        }
+    }
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // captured values are sent at their scheduled time, coalescing doesn't apply
+    if (captureOfThisThread() != nullptr) {
+        if (isNRPN)
+            sendNRPN (page, (NRPNParameter)parameter, true, value);
+        else
+            transmitControlChange (ParameterPriority, parameter, value);
+        return;
+    }
+#endif
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::unique_lock<std::mutex> lk (continuousControllerMutex);
+#endif
+
+    ContinuousController *controller = nullptr;
+    for (uint8_t i = 0; i < numContinuousControllers; i++) {
+        ContinuousController &c = continuousControllers[i];
+        if ((c.isNRPN == isNRPN) && (c.page == page) && (c.parameter == parameter)) {
+            controller = &c;
+            break;
+        }
+    }
+
+    if (controller == nullptr) {
+        if (numContinuousControllers == maxContinuousControllers) {
+            // should never happen with the pedals and stomps existing, but never lose a value
+#ifndef SIMPLE_MIDI_ARDUINO
+            lk.unlock();
+#endif
+            if (isNRPN)
+                sendNRPN (page, (NRPNParameter)parameter, true, value);
+            else
+                transmitControlChange (ParameterPriority, parameter, value);
+            return;
+        }
+
+        controller = continuousControllers + numContinuousControllers++;
+        *controller = {isNRPN, page, parameter, continuousControllerValueUnknown, 0, false, 0};
+    }
 
-    // wait for a response
-    auto ec = parameterResponseManager.waitingForResponseOrTimeout (response, 4);
+    if (value == controller->lastValueSent) {
+        // the amp is already at that value, an older pending value must not be sent anymore
+        if (controller->pending) {
+            controller->pending = false;
+            numContinuousControllersPending--;
+        }
+        return;
+    }
 
-    // check if the response is matching
-    if ((response[0] == pageOrMSB) && (response[1] == parameterOrLSB)) {
-        // put together lsb and msb
-        return (response[2] << 7) | response[3];
+    if (!controller->pending) {
+        controller->pending = true;
+        controller->pendingSince = continuousControllerSequenceNumber++;
+        numContinuousControllersPending++;
     }
+    controller->pendingValue = value;
 
-    // error handling
-    if (ec == ResponseMessageManager<int8_t>::ErrorCode::timeout) {
-        return -1;
+    if ((numContinuousControllersPending == 1) && continuousControllerMaySendNow()) {
+        sendContinuousController (*controller);
+        return;
     }
 
-    // if there was no timeout, something went wrong - parameter not matching!!
-    midiCommunicationError (MIDICommunicationErrorCode::responseNotMatchingToRequest);
-    return -1;
+#ifndef SIMPLE_MIDI_ARDUINO
+    lk.unlock();
+
+    // locking the transmit mutex makes sure the transmit thread is either waiting or will see the pending value
+    {
+        std::lock_guard<std::mutex> transmitLock (transmitMutex);
+        if (!transmitThread.joinable())
+            transmitThread = std::thread (&ProfilingAmp::transmitThreadLoop, this);
+    }
+    transmitQueued.notify_one();
+#endif
 }
 
-ProfilingAmp::returnStringType ProfilingAmp::getStringParameter (int8_t MSB, int8_t LSB) {
-    // Use a temporary char buffer on the stack for all platforms that return a std::string
-    KPAPI_TEMP_STRING_BUFFER_IF_NEEDED
+void ProfilingAmp::drainContinuousControllerQueue() {
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::lock_guard<std::mutex> lk (continuousControllerMutex);
+#endif
 
-    // construct and send the request. It's static, so only the two differing bytes need to be replaced with each call
-    static char stringRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
-                            KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
-                            KemperSysEx::DeviceID, FunctionCode::StringParamReq,
-                            KemperSysEx::Instance, 'M', 'L', SysExEnd};
-    stringRequest[8] = (char)MSB;
-    stringRequest[9] = (char)LSB;
+    if ((numContinuousControllersPending == 0) || !continuousControllerMaySendNow())
+        return;
 
-    sendSysEx (stringRequest, sizeof (stringRequest));
-    // wait for a response
-    stringResponseManager.waitingForResponseOrTimeout (stringBuffer, stringBufferLength);
+    // send the value that waits the longest, so that one fast moving pedal can't starve the others
+    ContinuousController *oldest = nullptr;
+    for (uint8_t i = 0; i < numContinuousControllers; i++) {
+        ContinuousController &c = continuousControllers[i];
+        if (c.pending && ((oldest == nullptr) || ((int16_t)(c.pendingSince - oldest->pendingSince) < 0)))
+            oldest = &c;
+    }
 
-    // just return the buffer. If something went wrong, it will be empty
-    return stringBuffer;
+    sendContinuousController (*oldest);
 }
 
-ProfilingAmp::returnStringType ProfilingAmp::getExtendedStringParameter (uint32_t extendedControllerNumber) {
-    // Use a temporary char buffer on the stack for all platforms that return a std::string
-    KPAPI_TEMP_STRING_BUFFER_IF_NEEDED
+void ProfilingAmp::sendContinuousController (ContinuousController &controller) {
+    if (controller.isNRPN)
+        sendNRPN (controller.page, (NRPNParameter)controller.parameter, true, controller.pendingValue);
+    else
+        transmitControlChange (ParameterPriority, controller.parameter, controller.pendingValue);
+
+    controller.lastValueSent = controller.pendingValue;
+    controller.pending = false;
+    numContinuousControllersPending--;
+}
+
+bool ProfilingAmp::continuousControllerMaySendNow() {
+#ifdef SIMPLE_MIDI_ARDUINO
+    return linkIsFree();
+#else
+    std::lock_guard<std::mutex> lk (transmitMutex);
+    return maySendNow (ParameterPriority, maxNumBytesContinuousController);
+#endif
+}
 
-    // construct the request. It's static, so only the five differing bytes need to be replaced with each call
-    static char extendedStringRequest[] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
-                                           KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
-                                           KemperSysEx::DeviceID, FunctionCode::ExtendedStringParamReq,
-                                           KemperSysEx::Instance, 'M', '1', '2', '3', 'L', SysExEnd};
-    // replace values 8 - 12
-    for (int8_t i = 12; i > 7; i--) {
-        uint8_t maskedContNumbByte = extendedControllerNumber & 0x0000007F;
-        extendedStringRequest[i] = (char)maskedContNumbByte;
-        extendedControllerNumber >>= 7;
+void ProfilingAmp::forgetContinuousControllerValues() {
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::lock_guard<std::mutex> lk (continuousControllerMutex);
+#endif
+    for (uint8_t i = 0; i < numContinuousControllers; i++) {
+        if (continuousControllers[i].isNRPN)
+            continuousControllers[i].lastValueSent = continuousControllerValueUnknown;
     }
+}
+
+// ------------------- Transmit scheduling ------------------
 
-    sendSysEx (extendedStringRequest, sizeof (extendedStringRequest));
+void ProfilingAmp::setLinkByteRate (uint32_t bytesPerSecond) {
+#ifndef SIMPLE_MIDI_ARDUINO
+    {
+        std::lock_guard<std::mutex> lk (transmitMutex);
+#endif
+        microsecondsPerByte = (bytesPerSecond == 0) ? 0 : 1000000 / bytesPerSecond;
+#ifndef SIMPLE_MIDI_ARDUINO
+    }
+    // queued messages might be sendable right away now
+    transmitQueued.notify_one();
+#endif
+}
 
-    // wait for a response
-    stringResponseManager.waitingForResponseOrTimeout (stringBuffer, stringBufferLength);
+void ProfilingAmp::transmitControlChange (TransmitPriority priority, uint8_t control, uint8_t value) {
+    const char controlValuePair[2] = {(char)control, (char)value};
+    transmit (priority, ControlChanges, controlValuePair, 2);
+}
 
-    // just return the buffer. If something went wrong, it will be empty
-    return stringBuffer;
+void ProfilingAmp::transmitControlChanges (TransmitPriority priority, const char *controlValuePairs, uint8_t numControlChanges) {
+    transmit (priority, ControlChanges, controlValuePairs, numControlChanges * 2);
 }
 
-void ProfilingAmp::setNewNRPNParameter (NRPNPage newPage, NRPNParameter newParameter) {
-    sendControlChange (99, newPage);
-    sendControlChange (98, newParameter);
-    lastNRPNPage = newPage;
-    lastNRPNParameter = newParameter;
+void ProfilingAmp::transmitSysEx (TransmitPriority priority, const char *sysEx, uint16_t length) {
+    transmit (priority, SysEx, sysEx, length);
 }
 
-void ProfilingAmp::updateLowResNRPN (NRPNPage page, NRPNParameter parameter, uint8_t value) {
-    if ((page != lastNRPNPage) || (parameter != lastNRPNParameter)) {
-        setNewNRPNParameter (page, parameter);
+uint16_t ProfilingAmp::wireSize (OutgoingMessageType type, uint16_t length) {
+    switch (type) {
+        case ControlChanges: return (length / 2) * numBytesControlChange;
+        case SysEx:          return length;
+        default:             return 1;
     }
-    sendControlChange (NRPNValLowResolution, value);
 }
 
-void ProfilingAmp::updateHighResNRPN (NRPNPage page, NRPNParameter parameter, int16_t value) {
-    if ((page != lastNRPNPage) || (parameter != lastNRPNParameter)) {
-        setNewNRPNParameter (page, parameter);
+void ProfilingAmp::dispatch (OutgoingMessageType type, const char *bytes, uint16_t length) {
+    switch (type) {
+        case ControlChanges:
+            for (uint16_t i = 0; i < length; i += 2) {
+                sendControlChange (bytes[i], bytes[i + 1]);
+#ifdef SIMPLE_MIDI_MULTITHREADED
+                if (bytes[i] == 99)
+                    wireNRPNPage = (NRPNPage)bytes[i + 1];
+                else if (bytes[i] == 98)
+                    wireNRPNParameter = (NRPNParameter)bytes[i + 1];
+#endif
+            }
+            break;
+
+        case SysEx:
+            sendSysEx (bytes, length);
+            break;
+
+        case ClockTick:
+            sendMIDIClockTick();
+            break;
     }
-    sendControlChange (NRPNValMSB, value >> 7);
-    sendControlChange (NRPNValLSB, value & 0x7F);
+
+    reserveLink (wireSize (type, length));
 }
 
-ProfilingAmp::StompBase* ProfilingAmp::getGenericStompInstance (StompType genericStompType, StompSlot stompSlot) {
-    // check if the list is still up to date and get an update otherwise
-    if (needStompListUpdate) {
-        scanStompSlots ();
+#ifdef SIMPLE_MIDI_ARDUINO
+
+// There is only a single thread on Arduino, so messages are sent in call order. Only the wire time is tracked, to
+// throttle the continuous controllers
+void ProfilingAmp::transmit (TransmitPriority priority, OutgoingMessageType type, const char *bytes, uint16_t length) {
+    dispatch (type, bytes, length);
+}
+
+void ProfilingAmp::transmitClockTick() {
+    dispatch (ClockTick, nullptr, 0);
+}
+
+bool ProfilingAmp::linkIsFree() {
+    return (microsecondsPerByte == 0) || ((long)(micros() - linkFreeAtMicros) >= 0);
+}
+
+void ProfilingAmp::reserveLink (uint16_t numBytes) {
+    unsigned long now = micros();
+    if ((long)(now - linkFreeAtMicros) > 0)
+        linkFreeAtMicros = now;
+
+    linkFreeAtMicros += numBytes * microsecondsPerByte;
+}
+
+#else
+
+void ProfilingAmp::transmit (TransmitPriority priority, OutgoingMessageType type, const char *bytes, uint16_t length) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    if (CapturedCommands *capture = captureOfThisThread()) {
+        appendMIDIBytes (capture->midiBytes, type, bytes, length);
+        return;
+    }
+#endif
+
+    std::unique_lock<std::mutex> lk (transmitMutex);
+
+    // messages are handed to the driver with the lock held, so the wire order is the order of the decisions made here
+    if (maySendNow (priority, wireSize (type, length))) {
+        dispatch (type, bytes, length);
+        return;
+    }
+
+    transmitQueues[priority].push_back ({type, std::vector<char> (bytes, bytes + length)});
+
+    if (!transmitThread.joinable())
+        transmitThread = std::thread (&ProfilingAmp::transmitThreadLoop, this);
+
+    lk.unlock();
+    transmitQueued.notify_one();
+}
+
+void ProfilingAmp::transmitClockTick() {
+    {
+        std::lock_guard<std::mutex> lk (transmitMutex);
+        dispatch (ClockTick, nullptr, 0);
+        lastRealtimeMessageSentAt = std::chrono::steady_clock::now();
+    }
+    // messages held back for this tick can go now
+    transmitQueued.notify_one();
+}
+
+void ProfilingAmp::announceRealtimeMessage (TimePoint dueTime) {
+    std::lock_guard<std::mutex> lk (transmitMutex);
+    nextRealtimeMessageAt = dueTime;
+}
+
+bool ProfilingAmp::linkIsFree() {
+    return (microsecondsPerByte == 0) || (std::chrono::steady_clock::now() >= linkFreeAt);
+}
+
+void ProfilingAmp::reserveLink (uint16_t numBytes) {
+    // if the link was idle, the bytes start going out now
+    linkFreeAt = std::max (linkFreeAt, std::chrono::steady_clock::now());
+    linkFreeAt += std::chrono::microseconds (numBytes * microsecondsPerByte);
+}
+
+bool ProfilingAmp::fitsBeforeNextRealtimeMessage (uint16_t numBytes, TimePoint now) {
+    if ((microsecondsPerByte == 0) || (nextRealtimeMessageAt <= now))
+        return true;
+
+    const auto wireTime = std::chrono::microseconds (numBytes * microsecondsPerByte);
+    if (now + wireTime <= nextRealtimeMessageAt)
+        return true;
+
+    // a message that can never fit into the gap goes out right after a realtime message, delaying only the next one
+    const auto gap = nextRealtimeMessageAt - lastRealtimeMessageSentAt;
+    return (wireTime > gap) && (now - lastRealtimeMessageSentAt < std::chrono::milliseconds (1));
+}
+
+bool ProfilingAmp::maySendNow (TransmitPriority priority, uint16_t numBytes) {
+    if (!linkIsFree())
+        return false;
+
+    // never overtake a queued message of the same or a higher priority
+    for (uint8_t p = 0; p <= priority; p++) {
+        if (!transmitQueues[p].empty())
+            return false;
+    }
+
+    // pending pedal values rank between the parameter queue and bulk requests
+    if ((priority == BulkPriority) && (numContinuousControllersPending > 0))
+        return false;
+
+    return fitsBeforeNextRealtimeMessage (numBytes, std::chrono::steady_clock::now());
+}
+
+void ProfilingAmp::transmitThreadLoop() {
+    std::unique_lock<std::mutex> lk (transmitMutex);
+
+    while (!transmitThreadShouldExit) {
+        const auto now = std::chrono::steady_clock::now();
+
+        if (!linkIsFree()) {
+            transmitQueued.wait_until (lk, linkFreeAt);
+            continue;
+        }
+
+        // find the highest priority with something to send. Pending pedal values rank after queued parameter changes
+        int8_t priority = -1;
+        bool sendContinuousController = false;
+        for (uint8_t p = 0; p < numTransmitPriorities; p++) {
+            if (!transmitQueues[p].empty()) {
+                priority = p;
+                break;
+            }
+
+            if ((p == ParameterPriority) && (numContinuousControllersPending > 0)) {
+                sendContinuousController = true;
+                break;
+            }
+        }
+
+        if (sendContinuousController) {
+            // drainContinuousControllerQueue would not send it now, so wait instead of asking it again right away
+            if (!fitsBeforeNextRealtimeMessage (maxNumBytesContinuousController, now)) {
+                transmitQueued.wait_until (lk, nextRealtimeMessageAt);
+                continue;
+            }
+
+            // this transmits the value through the usual path, which needs the lock
+            lk.unlock();
+            drainContinuousControllerQueue();
+            lk.lock();
+            continue;
+        }
+
+        if (priority < 0) {
+            transmitQueued.wait (lk);
+            continue;
+        }
+
+        OutgoingMessage &message = transmitQueues[priority].front();
+
+        if (!fitsBeforeNextRealtimeMessage (wireSize (message.type, (uint16_t)message.bytes.size()), now)) {
+            // wait for the realtime message to be sent
+            transmitQueued.wait_until (lk, nextRealtimeMessageAt);
+            continue;
+        }
+
+        dispatch (message.type, message.bytes.data(), (uint16_t)message.bytes.size());
+        transmitQueues[priority].pop_front();
+    }
+}
+
+void ProfilingAmp::stopTransmitThread() {
+    {
+        std::lock_guard<std::mutex> lk (transmitMutex);
+        transmitThreadShouldExit = true;
+    }
+    transmitQueued.notify_one();
+
+    if (transmitThread.joinable())
+        transmitThread.join();
+}
+#endif
+
+void ProfilingAmp::parameterValueChanged (int8_t page, int8_t parameter, int16_t value) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // the value is only valid once the captured messages are sent
+    if (CapturedCommands *capture = captureOfThisThread()) {
+        capture->parameterWrites.push_back ({page, parameter, value});
+        return;
+    }
+#endif
+
+#ifdef KPAPI_PARAMETER_MIRROR
+    writeParameterMirrorLocally (page, parameter, value);
+#endif
+#ifndef SIMPLE_MIDI_ARDUINO
+    updatePrefetchedParameter (page, parameter, value);
+#endif
+}
+
+void ProfilingAmp::parameterValueReceived (int8_t page, int8_t parameter, int16_t value, bool isResponse) {
+#ifdef KPAPI_PARAMETER_MIRROR
+    // a change the amp sent by itself is always its current state
+    if (!isResponse)
+        writeParameterMirror (page, parameter, value);
+#endif
+#ifndef SIMPLE_MIDI_ARDUINO
+    updatePrefetchedParameter (page, parameter, value);
+#endif
+}
+
+// ------------------- Parameter mirror ------------------
+
+#ifdef KPAPI_PARAMETER_MIRROR
+void ProfilingAmp::enableParameterMirror (bool shouldBeEnabled) {
+    // start with an empty mirror, values written while disabled are not tracked
+    if (shouldBeEnabled)
+        invalidateParameterMirror();
+
+    parameterMirrorEnabled = shouldBeEnabled;
+}
+
+void ProfilingAmp::invalidateParameterMirror() {
+    for (auto &page : parameterMirror) {
+        for (auto &value : page) {
+            value = mirrorValueUnknown;
+        }
+    }
+
+    // responses to requests sent before might carry values of the previous rig
+    const MirrorSequenceNumber writeSequence = ++parameterMirrorWriteSequence;
+    for (auto &lastWrite : parameterMirrorLastWrite) {
+        lastWrite = writeSequence;
+    }
+}
+
+int8_t ProfilingAmp::mirrorPageIndex (int8_t page) {
+    switch (page) {
+        case NRPNPage::Rig:   return 0;
+        case NRPNPage::Input: return 1;
+        case NRPNPage::Amp:   return 2;
+        case NRPNPage::Eq:    return 3;
+        case NRPNPage::Cab:   return 4;
+        default:
+            for (int8_t i = 0; i < numStomps; i++) {
+                if (fxSlotNRPNPageMapping[i] == page)
+                    return 5 + i;
+            }
+            return -1;
+    }
+}
+
+int16_t ProfilingAmp::readParameterMirror (int8_t page, int8_t parameter) {
+    const int8_t pageIndex = mirrorPageIndex (page);
+
+    if (!parameterMirrorEnabled || (pageIndex < 0) || (parameter < 0))
+        return mirrorValueUnknown;
+
+    return parameterMirror[pageIndex][parameter];
+}
+
+void ProfilingAmp::writeParameterMirror (int8_t page, int8_t parameter, int16_t value) {
+    const int8_t pageIndex = mirrorPageIndex (page);
+
+    if (!parameterMirrorEnabled || (pageIndex < 0) || (parameter < 0))
+        return;
+
+    parameterMirror[pageIndex][parameter] = value;
+}
+
+void ProfilingAmp::writeParameterMirrorLocally (int8_t page, int8_t parameter, int16_t value) {
+    const int8_t pageIndex = mirrorPageIndex (page);
+
+    if (!parameterMirrorEnabled || (pageIndex < 0) || (parameter < 0))
+        return;
+
+    parameterMirrorLastWrite[pageIndex] = ++parameterMirrorWriteSequence;
+    parameterMirror[pageIndex][parameter] = value;
+}
+
+void ProfilingAmp::writeParameterMirrorResponse (int8_t page, int8_t parameter, int16_t value, MirrorSequenceNumber requestSentAt) {
+    const int8_t pageIndex = mirrorPageIndex (page);
+
+    if (!parameterMirrorEnabled || (pageIndex < 0) || (parameter < 0))
+        return;
+
+    if ((MirrorSequenceDifference)(parameterMirrorLastWrite[pageIndex] - requestSentAt) > 0)
+        return;
+
+    parameterMirror[pageIndex][parameter] = value;
+}
+#endif
+
+// ------------------- Parameter change batches ------------------
+
+void ProfilingAmp::beginParameterChangeBatch() {
+    numParameterChangesInBatch = 0;
+    parameterChangeBatchStatistics = {0, 0, 0};
+    batchSimulatedNRPNPage = lastNRPNPage;
+    batchSimulatedNRPNParameter = lastNRPNParameter;
+    collectingParameterChanges = true;
+}
+
+ProfilingAmp::ParameterChangeBatchStatistics ProfilingAmp::sendParameterChangeBatch() {
+    flushParameterChangeBatch();
+    collectingParameterChanges = false;
+    return parameterChangeBatchStatistics;
+}
+
+uint8_t ProfilingAmp::numBytesAsNRPN (const ParameterChange &change, NRPNPage selectedPage, NRPNParameter selectedParameter) {
+    uint8_t numControlChanges = change.highResolution ? 2 : 1;
+
+    if ((change.page != selectedPage) || (change.parameter != selectedParameter))
+        numControlChanges += 2;
+
+    return numControlChanges * numBytesControlChange;
+}
+
+void ProfilingAmp::addToParameterChangeBatch (NRPNPage page, NRPNParameter parameter, bool highResolution, int16_t value) {
+    ParameterChange change = {page, parameter, highResolution, value};
+
+    // keep track of the bytes this would have taken without batching
+    parameterChangeBatchStatistics.numBytesAsNRPN += numBytesAsNRPN (change, batchSimulatedNRPNPage, batchSimulatedNRPNParameter);
+    batchSimulatedNRPNPage = page;
+    batchSimulatedNRPNParameter = parameter;
+
+    // only the last value set for a parameter needs to be sent
+    for (uint8_t i = 0; i < numParameterChangesInBatch; i++) {
+        ParameterChange &existing = parameterChangeBatch[i];
+        if ((existing.page == page) && (existing.parameter == parameter)) {
+            existing = change;
+            return;
+        }
+    }
+
+    if (numParameterChangesInBatch == maxParameterChangesPerBatch)
+        flushParameterChangeBatch();
+
+    // insertion sort by page and parameter, so that runs of consecutive parameters are found easily when sending
+    uint8_t i = numParameterChangesInBatch;
+    while ((i > 0) && ((parameterChangeBatch[i - 1].page > page) ||
+                       ((parameterChangeBatch[i - 1].page == page) && (parameterChangeBatch[i - 1].parameter > parameter)))) {
+        parameterChangeBatch[i] = parameterChangeBatch[i - 1];
+        i--;
+    }
+    parameterChangeBatch[i] = change;
+    numParameterChangesInBatch++;
+}
+
+void ProfilingAmp::flushParameterChangeBatch() {
+    // the setters must send directly while flushing
+    const bool wasCollecting = collectingParameterChanges;
+    collectingParameterChanges = false;
+
+    uint8_t runStart = 0;
+    while (runStart < numParameterChangesInBatch) {
+        // find the end of this run of consecutive parameters on the same page
+        uint8_t runLength = 1;
+        while ((runStart + runLength < numParameterChangesInBatch) &&
+               (parameterChangeBatch[runStart + runLength].page == parameterChangeBatch[runStart].page) &&
+               (parameterChangeBatch[runStart + runLength].parameter == parameterChangeBatch[runStart].parameter + runLength)) {
+            runLength++;
+        }
+
+        parameterChangeBatchStatistics.numBytesSent += sendParameterChangeRun (parameterChangeBatch + runStart, runLength);
+        parameterChangeBatchStatistics.numParameterChanges += runLength;
+        runStart += runLength;
+    }
+
+    numParameterChangesInBatch = 0;
+    collectingParameterChanges = wasCollecting;
+}
+
+uint32_t ProfilingAmp::sendParameterChangeRun (const ParameterChange *firstChange, uint8_t runLength) {
+    // compute what the run would cost as NRPN, based on the NRPN parameter currently selected
+    uint32_t numBytesNRPN = 0;
+    NRPNPage selectedPage = lastNRPNPage;
+    NRPNParameter selectedParameter = lastNRPNParameter;
+    for (uint8_t i = 0; i < runLength; i++) {
+        numBytesNRPN += numBytesAsNRPN (firstChange[i], selectedPage, selectedParameter);
+        selectedPage = firstChange[i].page;
+        selectedParameter = firstChange[i].parameter;
+    }
+
+    const uint32_t numBytesSysEx = (runLength == 1) ? numBytesSingleParamChange : numBytesMultiParamChangeHeader + 2 * runLength;
+
+    if (numBytesNRPN <= numBytesSysEx) {
+        for (uint8_t i = 0; i < runLength; i++) {
+            const ParameterChange &change = firstChange[i];
+            if (change.highResolution)
+                updateHighResNRPN (change.page, change.parameter, change.value);
+            else
+                updateLowResNRPN (change.page, change.parameter, (uint8_t)change.value);
+        }
+        return numBytesNRPN;
+    }
+
+    // Low resolution values are sent as 14 Bit values as well, with the value in the LSB
+    char paramChange[numBytesMultiParamChangeHeader + 2 * maxParameterChangesPerBatch] = {SysExBegin, KemperSysEx::ManCode0, KemperSysEx::ManCode1,
+                                                                                           KemperSysEx::ManCode2, KemperSysEx::PtProfiler,
+                                                                                           KemperSysEx::DeviceID, FunctionCode::MultiParamChange,
+                                                                                           KemperSysEx::Instance, (char)firstChange->page,
+                                                                                           (char)firstChange->parameter};
+    if (runLength == 1)
+        paramChange[6] = FunctionCode::SingleParamChange;
+
+    uint16_t length = 10;
+    for (uint8_t i = 0; i < runLength; i++) {
+        paramChange[length++] = (char)((firstChange[i].value >> 7) & 0x7F);
+        paramChange[length++] = (char)(firstChange[i].value & 0x7F);
+    }
+    paramChange[length++] = SysExEnd;
+
+    transmitSysEx (ParameterPriority, paramChange, length);
+    return length;
+}
+
+// ------------------- Rig state snapshots ------------------
+
+#ifndef SIMPLE_MIDI_ARDUINO
+const ProfilingAmp::RigStateRange ProfilingAmp::rigStateRanges[numRigStateRanges] = {
+    {NRPNPage::Amp,         NRPNParameter::AmpOnOff,    AmpDirectMix - AmpOnOff + 1},
+    {NRPNPage::Eq,          NRPNParameter::EqOnOff,     EqPresenceGain - EqOnOff + 1},
+    {NRPNPage::Cab,         NRPNParameter::CabOnOff,    CabPureCabinet - CabOnOff + 1},
+    {NRPNPage::StompA,      NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompB,      NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompC,      NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompD,      NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompX,      NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompMod,    NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompDly,    NRPNParameter::StompTypeID, numValuesPerStompSlot},
+    {NRPNPage::StompReverb, NRPNParameter::StompTypeID, numValuesPerStompSlot}
+};
+
+ProfilingAmp::RigState ProfilingAmp::captureRigState() {
+    RigState rigState;
+    MultiParameterRequest requests[numRigStateRanges];
+
+    int16_t *values = rigState.values;
+    for (int i = 0; i < numRigStateRanges; i++) {
+        const RigStateRange &range = rigStateRanges[i];
+        requests[i] = {range.page, range.firstParameter, range.numValues, values};
+        values += range.numValues;
+    }
+
+    getMultiParameters (requests, numRigStateRanges);
+    return rigState;
+}
+
+ProfilingAmp::ParameterChangeBatchStatistics ProfilingAmp::restoreRigState (const RigState &rigState) {
+    const RigState currentState = captureRigState();
+
+    // the changes become part of a batch the caller is collecting anyway
+    const bool batchStartedByCaller = collectingParameterChanges;
+    if (!batchStartedByCaller)
+        beginParameterChangeBatch();
+
+    uint8_t slotsWithNewStompType = 0;
+    const int16_t *targetValues = rigState.values;
+    const int16_t *currentValues = currentState.values;
+
+    for (int i = 0; i < numRigStateRanges; i++) {
+        const RigStateRange &range = rigStateRanges[i];
+
+        // a new stomp type resets the other parameters of the slot, so all of them need to be sent
+        const bool isStompSlot = range.firstParameter == NRPNParameter::StompTypeID;
+        const bool stompTypeChanged = isStompSlot && (targetValues[0] >= 0) && (targetValues[0] != currentValues[0]);
+        if (stompTypeChanged)
+            slotsWithNewStompType |= 1 << (i - (numRigStateRanges - numStomps));
+
+        for (int v = 0; v < range.numValues; v++) {
+            if ((targetValues[v] >= 0) && (stompTypeChanged || (targetValues[v] != currentValues[v])))
+                updateHighResNRPN (range.page, (NRPNParameter)(range.firstParameter + v), targetValues[v]);
+        }
+
+        targetValues += range.numValues;
+        currentValues += range.numValues;
+    }
+
+    ParameterChangeBatchStatistics statistics = {0, 0, 0};
+    if (!batchStartedByCaller)
+        statistics = sendParameterChangeBatch();
+
+    if (slotsWithNewStompType != 0) {
+        {
+            std::lock_guard<std::mutex> lk (stompListMutex);
+            // the slots get objects of other classes, so stomp handles must not call into them anymore. Scans still
+            // running are dropped by the new generation, their slots are scanned again on the next access
+            rigGeneration++;
+            stompSlotsNeedingUpdate |= slotsWithNewStompType | stompSlotsBeingScanned;
+            stompSlotsBeingScanned = 0;
+        }
+        stompScanFinished.notify_all();
+    }
+
+    return statistics;
+}
+
+std::vector<uint8_t> ProfilingAmp::RigState::serialize() const {
+    std::vector<uint8_t> data = {'K', 'P', 'R', 'S', rigStateFormatVersion, (uint8_t)numRigStateRanges};
+    data.reserve (data.size() + numRigStateRanges * 3 + numRigStateValues * 2);
+
+    // each range is stored with its address, followed by the values as two 7 bit bytes. Unknown values are 0xFF 0xFF
+    const int16_t *rangeValues = values;
+    for (auto &range : rigStateRanges) {
+        data.push_back ((uint8_t)range.page);
+        data.push_back ((uint8_t)range.firstParameter);
+        data.push_back ((uint8_t)range.numValues);
+
+        for (int v = 0; v < range.numValues; v++) {
+            const int16_t value = rangeValues[v];
+            data.push_back ((value < 0) ? 0xFF : (uint8_t)((value >> 7) & 0x7F));
+            data.push_back ((value < 0) ? 0xFF : (uint8_t)(value & 0x7F));
+        }
+        rangeValues += range.numValues;
+    }
+
+    return data;
+}
+
+bool ProfilingAmp::RigState::deserialize (const uint8_t *data, size_t numBytes) {
+    for (auto &value : values) {
+        value = -1;
+    }
+
+    if ((numBytes < 6) || (memcmp (data, "KPRS", 4) != 0) || (data[4] != rigStateFormatVersion))
+        return false;
+
+    const uint8_t numRangesStored = data[5];
+    size_t pos = 6;
+
+    for (uint8_t r = 0; r < numRangesStored; r++) {
+        if (pos + 3 > numBytes)
+            return false;
+
+        const int8_t page = (int8_t)data[pos];
+        const int8_t firstParameter = (int8_t)data[pos + 1];
+        const int numValuesStored = data[pos + 2];
+        pos += 3;
+
+        if (pos + 2 * numValuesStored > numBytes)
+            return false;
+
+        // find the range holding these parameters in this version, parameters unknown to it are skipped
+        int firstValueIdx = 0;
+        for (auto &range : rigStateRanges) {
+            if (range.page == page) {
+                for (int v = 0; v < numValuesStored; v++) {
+                    const int offset = firstParameter + v - range.firstParameter;
+                    if ((offset >= 0) && (offset < range.numValues) && (data[pos + 2 * v] != 0xFF))
+                        values[firstValueIdx + offset] = (int16_t)((data[pos + 2 * v] << 7) | data[pos + 2 * v + 1]);
+                }
+                break;
+            }
+            firstValueIdx += range.numValues;
+        }
+
+        pos += 2 * numValuesStored;
     }
 
+    return true;
+}
+#endif
+
+ProfilingAmp::StompBase* ProfilingAmp::getStomp (StompType genericStompType, StompSlot stompSlot) {
+    return getGenericStompInstance (genericStompType, stompSlot);
+}
+
+ProfilingAmp::StompHandle<ProfilingAmp::StompBase> ProfilingAmp::getStompHandle (StompType genericStompType, StompSlot stompSlot) {
+    return StompHandle<StompBase> (*this, genericStompType, stompSlot);
+}
+
+ProfilingAmp::StompBase* ProfilingAmp::getStompInstance (StompType stompType, StompSlot stompSlot) {
+    if (stompType > StompType::SpecificMask)
+        return getGenericStompInstance (stompType, stompSlot);
+
+    return getSpecificStompInstance (stompType, stompSlot);
+}
+
+ProfilingAmp::StompBase* ProfilingAmp::getGenericStompInstance (StompType genericStompType, StompSlot stompSlot) {
+    // searching for the first match only updates the slots up to the match
     if (stompSlot == StompSlot::First) {
         stompSlot = getSlotOfFirstGenericStompType (genericStompType);
     }
 
     // check if the slot Index is inside the valid range
     if ((stompSlot >= StompSlot::A) && (stompSlot <= StompSlot::Rev)) {
-        if ((stompsInCurrentRig[stompSlot]->getStompType() & StompType::GenericMask) == genericStompType) {
+        // an explicit slot only needs this slot to be up to date
+        updateStompSlotIfNeeded (stompSlot);
+
+        if ((stompTypeInSlot (stompSlot) & StompType::GenericMask) == genericStompType) {
             return stompsInCurrentRig[stompSlot];
         }
     }
@@ -488,18 +2971,17 @@ ProfilingAmp::StompBase* ProfilingAmp::getGenericStompInstance (StompType generi
 }
 
 ProfilingAmp::StompBase* ProfilingAmp::getSpecificStompInstance (StompType specificStompType, StompSlot stompSlot) {
-    // check if the list is still up to date and get an update otherwise
-    if (needStompListUpdate) {
-        scanStompSlots ();
-    }
-
+    // searching for the first match only updates the slots up to the match
     if (stompSlot == StompSlot::First) {
         stompSlot = getSlotOfFirstSpecificStompType (specificStompType);
     }
 
     // check if the slot Index is inside the valid range
     if ((stompSlot >= StompSlot::A) && (stompSlot <= StompSlot::Rev)) {
-        if ((stompsInCurrentRig[stompSlot]->getStompType() & StompType::SpecificMask) == specificStompType) {
+        // an explicit slot only needs this slot to be up to date
+        updateStompSlotIfNeeded (stompSlot);
+
+        if ((stompTypeInSlot (stompSlot) & StompType::SpecificMask) == specificStompType) {
             return stompsInCurrentRig[stompSlot];
         }
     }
@@ -508,7 +2990,8 @@ ProfilingAmp::StompBase* ProfilingAmp::getSpecificStompInstance (StompType speci
 }
 
 void ProfilingAmp::receivedProgramChange (uint8_t programm) {
-    // empty
+    // the amp sends a program change when a rig or performance was selected on the amp itself
+    rigChangeReceived();
 }
 
 void ProfilingAmp::receivedControlChange (uint8_t control, uint8_t value) {
@@ -529,22 +3012,49 @@ void ProfilingAmp::receivedSysEx (const char *sysExBuffer, const uint16_t length
         switch (sysExBuffer[6]) {
             case FunctionCode::StringParam: {
                 int stringLength = length - 11;
+                uint32_t address = ((uint8_t)sysExBuffer[8] << 8) | (uint8_t)sysExBuffer[9];
 
-                stringResponseManager.receivedResponse (sysExBuffer + 10, stringLength);
+                // without a request waiting for it, a new active rig name means the rig was changed on the amp, unless
+                // it's the late response to a request that timed out
+                const uint32_t key = responseKey (FunctionCode::StringParam, address);
+                if (!stringResponseManager.receivedResponse (key, sysExBuffer + 10, stringLength) &&
+                        (address == ActiveRigNameLSB) && !stringResponseManager.consumeLateResponse (key))
+                    rigChangeReceived();
 
             }
                 break;
 
             case FunctionCode::ExtendedStringParam: {
                 int stringLength = length - 14;
+                uint32_t extendedControllerNumber = 0;
+                for (int8_t i = 8; i < 13; i++) {
+                    extendedControllerNumber = (extendedControllerNumber << 7) | (sysExBuffer[i] & 0x7F);
+                }
+
+                stringResponseManager.receivedResponse (responseKey (FunctionCode::ExtendedStringParam, extendedControllerNumber), sysExBuffer + 13, stringLength);
+
+            }
+                break;
+
+            case FunctionCode::MultiParamChange: {
+                uint32_t address = ((uint8_t)sysExBuffer[8] << 8) | (uint8_t)sysExBuffer[9];
+                int numValueBytes = length - 11;
 
-                stringResponseManager.receivedResponse (sysExBuffer + 13, stringLength);
+                const bool isResponse = parameterResponseManager.receivedResponse (responseKey (FunctionCode::MultiParamChange, address), (int8_t*)sysExBuffer + 10, numValueBytes);
 
+                for (int i = 0; i < numValueBytes / 2; i++) {
+                    parameterValueReceived (sysExBuffer[8], sysExBuffer[9] + i, (sysExBuffer[10 + 2 * i] << 7) | sysExBuffer[11 + 2 * i], isResponse);
+                }
             }
                 break;
 
             case FunctionCode::SingleParamChange: {
-                parameterResponseManager.receivedResponse ((int8_t*)sysExBuffer + 8, 4);
+                uint32_t address = ((uint8_t)sysExBuffer[8] << 8) | (uint8_t)sysExBuffer[9];
+
+                // this is either a response to a request or a parameter change the amp sent by itself
+                const bool isResponse = parameterResponseManager.receivedResponse (responseKey (FunctionCode::SingleParamChange, address), (int8_t*)sysExBuffer + 8, 4);
+
+                parameterValueReceived (sysExBuffer[8], sysExBuffer[9], (sysExBuffer[10] << 7) | sysExBuffer[11], isResponse);
             }
         }
     }
@@ -552,4 +3062,8 @@ void ProfilingAmp::receivedSysEx (const char *sysExBuffer, const uint16_t length
 
 
 constexpr uint8_t ProfilingAmp::stompToggleCC[];
-constexpr ProfilingAmp::NRPNPage ProfilingAmp::fxSlotNRPNPageMapping[];
\ No newline at end of file
+constexpr ProfilingAmp::NRPNPage ProfilingAmp::fxSlotNRPNPageMapping[];
+constexpr ProfilingAmp::ParameterDescriptor ProfilingAmp::parameterDescriptors[];
+constexpr ProfilingAmp::StompTypeIDRange ProfilingAmp::stompTypeIDRanges[];
+constexpr uint32_t ProfilingAmp::activePerformanceNameControllerNumber;
+constexpr uint32_t ProfilingAmp::rigNameControllerNumberOffset;
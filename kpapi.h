@@ -14,6 +14,43 @@
 #ifndef SIMPLE_MIDI_ARDUINO
 #include <thread>
 #include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <map>
+#include <cstdio>
+#include <cmath>
+
+/**
+ * If compiled as C++20 with coroutine support, co_await-able versions of the getters are available.
+ * @see ProfilingAmp::Task
+ */
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#define KPAPI_COROUTINES
+#endif
+
+/**
+ * If the standard library supports waiting on atomics (C++20), threads waiting for a response sleep on the atomic
+ * state of their request until the MIDI thread wakes them up. Otherwise they sleep on a condition variable, so
+ * delivering a response is not lock-free then, the MIDI thread briefly locks the mutex of that condition variable.
+ */
+#ifdef __cpp_lib_atomic_wait
+#define KPAPI_ATOMIC_WAIT
+#endif
+#endif
+
+/**
+ * The parameter mirror needs about 3.5 kB of RAM, so on Arduino it's only available if KPAPI_PARAMETER_MIRROR
+ * is defined before including this header.
+ * @see ProfilingAmp::enableParameterMirror
+ */
+#if !defined (SIMPLE_MIDI_ARDUINO) && !defined (KPAPI_PARAMETER_MIRROR)
+#define KPAPI_PARAMETER_MIRROR
 #endif
 
 /**
@@ -31,6 +68,8 @@ class ProfilingAmp : private SimpleMIDI::PlatformSpecificImplementation
     friend class ReverbStomp;
     friend class WahStomp;
     friend class PhaserVibeStomp;
+    // drives the ResponseMessageManager in examples/responseWakeupBenchmark
+    friend struct ResponseMessageManagerBenchmark;
     
 public:
 
@@ -128,6 +167,7 @@ public:
         GenericPhaser = 10 << 8,
         GenericPitchShifter = 11 << 8,
         GenericEffectsLoop = 12 << 8,
+        GenericReverb = 13 << 8,
 
         // Specific types
         SpecificMask = 0x00FF,
@@ -150,6 +190,152 @@ public:
         // to be continued...
     };
 
+    /**
+     * Identifies a parameter of the active rig for the templated accessors like setParameter. Each ID is bound to
+     * its page, its NRPN parameter number and its resolution by a table known at compile time, so the
+     * accessors cost exactly as much as the hand-written setters and getters.
+     * @see ProfilingAmp::setParameter, ProfilingAmp::setStompParameter
+     */
+    enum class ParameterID : uint8_t {
+        // Page: Rig
+        RigTempo,
+        RigVolume,
+        RigTempoEnable,
+
+        // Page: Input
+        NoiseGateIntensity,
+        InputCleanSense,
+        InputDistortionSense,
+
+        // Page: Amp
+        AmpOnOff,
+        AmpGain,
+        AmpDefinition,
+        AmpClarity,
+        AmpPowerSagging,
+        AmpPick,
+        AmpCompressor,
+        AmpTubeShape,
+        AmpTubeBias,
+        AmpDirectMix,
+
+        // Page: EQ
+        EqOnOff,
+        EqBassGain,
+        EqMiddleGain,
+        EqTrebleGain,
+        EqPresenceGain,
+
+        // Page: Cab
+        CabOnOff,
+        CabVolume,
+        CabHighShift,
+        CabLowShift,
+        CabCharacter,
+        CabPureCabinet,
+
+        // All stomp pages
+        StompTypeID,
+        OnOff,
+        WahManual,
+        WahPeak,
+        WahRange,
+        WahPeakRAnge,
+        WahPedalMode,
+        WahTouchAttack,
+        WahTouchRelease,
+        WahTouchBoost,
+        DisShaperDrive,
+        DisBoosterTone,
+        CompGateIntensity,
+        CompAttack,
+        CompSquash,
+        ModRate,
+        ModDepth,
+        ModFeedback,
+        ModCrossover,
+        ModHyperChorusAmount,
+        ModManual,
+        ModPhaserPeakSpread,
+        ModPhaserStages,
+        RotarySpeedSlowFast,
+        RotayDistance,
+        RotaryBalance,
+        GEQBand1,
+        GEQBand2,
+        GEQBand3,
+        GEQBand4,
+        GEQBand5,
+        GEQBand6,
+        GEQBand7,
+        GEQBand8,
+        PEQLowGain,
+        PEQLowFreq,
+        PEQHighGain,
+        PEQHighFreq,
+        PEQPeak1Gain,
+        PEQPeak1Freq,
+        PEQPeak1Q,
+        PEQPeak2Gain,
+        PEQPeak2Freq,
+        PEQPeak2Q,
+        Ducking,
+        VoiceMix,
+        Detune,
+        SmoothChords,
+        PureTuning,
+        Key,
+        FreezeFormants,
+        FormantOffset,
+        LowCut,
+        HighCut,
+        DlyMix,
+        DlyMixPrePost,
+        DlyTime1,
+        DlyTime2,
+        DlyRatio2,
+        DlyRatio3,
+        DlyRatio4,
+        DlyNoteValue1,
+        DlyNoteValue2,
+        DlyNoteValue3,
+        DlyNoteValue4,
+        DlyToTempo,
+        DlyVolume1,
+        DlyVolume2,
+        DlyVolume3,
+        DlyVolume4,
+        DlyPan1,
+        DlyPan2,
+        DlyPan3,
+        DlyPan4,
+        DlyVoice1Pitch,
+        DlyVoice2Pitch,
+        DlyVoice3Pitch,
+        DlyVoice4Pitch,
+        DlyVoice3Interval,
+        DlyVoice4Interval,
+        DlyFeedbak,
+        DlyInfinityFeedback,
+        DlyInfinity,
+        DlyFeedback2,
+        DlyFeedbackSyncSwitch,
+        DlyLowCut,
+        DlyHighCut,
+        DlyFilterIntensity,
+        DlyModulation,
+        DlyChorus,
+        DlyFlutterIntensity,
+        DlyFlutterShape,
+        DlyGrit,
+        DlyReverseMix,
+        DlySwell,
+        DlySmear,
+        DlyDucking,
+
+        NumParameterIDs
+    };
+
     /** One of these will be passed to the MIDICommunicationErrorCallback handler function */
     enum MIDICommunicationErrorCode {
         missingActiveSense,
@@ -159,6 +345,13 @@ public:
 
     typedef void (*MidiCommErrorCallbackFn)(MIDICommunicationErrorCode);
 
+#ifndef SIMPLE_MIDI_ARDUINO
+    /** Completion handlers passed to the asynchronous getters. @see getAmpGainAsync */
+    typedef std::function<void (int16_t)> ParameterCallbackFn;
+    typedef std::function<void (bool)> ToggleStateCallbackFn;
+    typedef std::function<void (returnStringType)> StringCallbackFn;
+#endif
+
 #ifdef SIMPLE_MIDI_ARDUINO
     /** Arduino only. Creates a ProfilingAmp based on an Arduino HardwareSerial MIDI Connection. */
     ProfilingAmp (HardwareSerial &serial) : SimpleMIDI::PlatformSpecificImplementation (serial),
@@ -187,9 +380,13 @@ public:
         begin();
     }
 
-    /* Call this in the loop to react to MIDI Messages comming from the amp.*/
+    /*
+     * Call this in the loop to react to MIDI Messages comming from the amp. This also sends out pedal positions
+     * that were held back as the link was busy.
+     */
     void receiveMIDI() {
         receive();
+        drainContinuousControllerQueue();
     }
 #else
 
@@ -204,15 +401,35 @@ public:
                                                                            parameterResponseManager (*this) {
         timePointLastTap = std::chrono::system_clock::now();
         initializeStompsInCurrentRig();
+        initializePrefetchTable();
+        rigChangeThread = std::thread (&ProfilingAmp::rigChangeThreadLoop, this);
     };
     
 #endif
 
 #ifdef SIMPLE_MIDI_MULTITHREADED
-    /** On multithreaded platforms a midiClockGenerator migth still be running on its own thread */
+    /** On multithreaded platforms the clock engine migth still be running on its own thread */
     ~ProfilingAmp() {
-        if (midiClockGenerator != nullptr)
-            delete midiClockGenerator;
+#ifndef SIMPLE_MIDI_ARDUINO
+        // the rig change thread updates the catalog
+        stopRigChangeThread();
+#endif
+
+        if (catalog != nullptr)
+            delete catalog;
+
+        if (setlist != nullptr)
+            delete setlist;
+
+        if (clockFollower != nullptr)
+            delete clockFollower;
+
+        if (clockEngine != nullptr)
+            delete clockEngine;
+
+#ifndef SIMPLE_MIDI_ARDUINO
+        stopTransmitThread();
+#endif
     };
 #endif
 
@@ -222,11 +439,320 @@ public:
     // ---------------- Tempo ---------------------------------------------------
 #ifdef SIMPLE_MIDI_MULTITHREADED
     /**
-     * Starts a new thread that constantly sends out a midi clock signal to keep the amp in sync.
+     * Sends out MIDI clock ticks on its own thread. Tick times are computed as absolute deadlines on the steady clock,
+     * so that neither a late wake up nor adjustments of the system clock make the clock drift. The thread sleeps until
+     * shortly before each deadline and spins for the rest of the time to keep the jitter low. Each tick is announced
+     * to the transmit scheduler, so that no other message is on the wire when it's due.
+     *
+     * Get the instance via ProfilingAmp::getClockEngine.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    class ClockEngine {
+        friend class ProfilingAmp;
+        friend class ClockFollower;
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        /** MIDI clock ticks per quarter note */
+        static const int ticksPerQuarterNote = 24;
+
+        /** Returned by getTickIndexOfNextBeat for an invalid bar length */
+        static const uint64_t invalidTickIndex = ~(uint64_t)0;
+
+        /**
+         * Statistics of the intervals between the ticks actually sent. The histogram holds the deviation of each
+         * interval from the interval scheduled, centered around a deviation of 0. The first and last bin also count
+         * all deviations beyond them.
+         */
+        struct JitterReport {
+            static const int numHistogramBins = 41;
+            static const int histogramBinWidthMicroseconds = 50;
+
+            uint32_t intervalDeviationHistogram[numHistogramBins];
+            uint32_t numIntervals;
+            double meanAbsoluteDeviationMicroseconds;
+            int32_t maxAbsoluteDeviationMicroseconds;
+            // how late a tick was sent compared to its deadline at worst
+            int32_t maxLatenessMicroseconds;
+            // the number of times the clock was so late that it restarted the schedule instead of catching up
+            uint32_t numResyncs;
+
+            /** Returns the deviation in microseconds the center of a histogram bin stands for */
+            static int32_t binCenterMicroseconds (int bin) {
+                return (bin - numHistogramBins / 2) * histogramBinWidthMicroseconds;
+            }
+        };
+
+        ~ClockEngine();
+
+        /**
+         * Starts sending ticks at the tempo passed. The first tick is sent immediately.
+         * @return false if the tempo is not a positive number. The clock is left as it is then
+         */
+        bool start (double beatsPerMinute);
+
+        /** Stops sending ticks. The thread is kept alive, so that the clock restarts without delay */
+        void stop();
+
+        bool isRunning();
+
+        /** Changes the tempo, starting with the next tick. Returns false if the tempo is not a positive number */
+        bool setTempo (double beatsPerMinute);
+
+        /**
+         * Changes the tempo linearly to the target tempo over the number of quarter notes passed, the tempo is
+         * updated with each tick. A running ramp is replaced, starting from the current tempo.
+         * @return false if the target tempo is not a positive number
+         */
+        bool rampTempo (double targetBeatsPerMinute, double rampLengthInQuarterNotes);
+
+        /** Returns the tempo of the current tick interval, which might be somewhere in a ramp */
+        double getTempo();
+
+        /** Returns the index of the next tick to be sent. The first tick after starting the clock has the index 0 */
+        uint64_t getNextTickIndex();
+
+        /**
+         * Returns the index of the first tick of the next beat or bar that has not been sent yet. Bars are counted
+         * from the start of the clock.
+         * @param beatsPerBar   Pass 1 for the next quarter note, 4 for the next bar in 4/4 and so on. Values below 1
+         *                      are rejected by returning invalidTickIndex
+         * @see ProfilingAmp::scheduleCommands
+         */
+        uint64_t getTickIndexOfNextBeat (int beatsPerBar = 1);
+
+        /**
+         * Sets how long before a deadline the clock thread stops sleeping and starts spinning. Longer times lower
+         * the jitter on loaded systems but burn more CPU time. Defaults to 500 microseconds.
+         */
+        void setSpinTime (std::chrono::microseconds spinTime);
+
+        /** Returns the statistics collected since the clock was started or the report was reset */
+        JitterReport getJitterReport();
+
+        void resetJitterReport();
+
+    private:
+        ClockEngine (ProfilingAmp &amp);
+
+        void run();
+
+        /** Returns the interval to the next tick according to the tempo and advances a running ramp */
+        double nextIntervalNanoseconds();
+
+        /** Rejects zero, negative and infinite tempos, they can't be turned into a tick interval */
+        static bool isValidTempo (double beatsPerMinute) {
+            return std::isfinite (beatsPerMinute) && (beatsPerMinute > 0.0);
+        }
+
+        void recordTick (TimePoint sentAt, TimePoint deadline, double scheduledIntervalNanoseconds);
+
+        /**
+         * Lets the tick with the index passed be sent at the due time and continues with the interval passed.
+         * Starts the engine if it's not running. Ticks already sent beyond that index are taken into account,
+         * so following an external clock never skips or doubles a tick. Intervals that are not positive are ignored.
+         */
+        void synchronize (uint64_t tickIndex, TimePoint dueTime, double intervalNanoseconds);
+
+        /**
+         * Called if the external clock restarts counting its ticks, e.g. on a MIDI start. The next synchronize takes
+         * over the tick index passed even if the engine is ahead of it, until then the engine keeps running.
+         */
+        void restartTickIndex();
+
+        ProfilingAmp &amp;
+
+        std::thread thread;
+        std::mutex clockMutex;
+        std::condition_variable stateChanged;
+        bool running = false;
+        bool shouldExit = false;
+
+        double tempo = 120.0;
+        double rampStartTempo = 120.0;
+        double rampTargetTempo = 120.0;
+        uint32_t rampLengthInTicks = 0;
+        uint32_t rampTicksDone = 0;
+
+        std::chrono::microseconds spinTime {500};
+
+        // deadline of the next tick = scheduleAnchor + nanosecondsSinceAnchor, accumulated in double precision so
+        // that the rounding of single intervals never adds up
+        TimePoint scheduleAnchor;
+        double nanosecondsSinceAnchor = 0.0;
+        // incremented with each start, so that a tick sent while the clock was restarted doesn't advance the new schedule
+        uint32_t scheduleGeneration = 0;
+        // index of the next tick to send
+        uint64_t tickIndex = 0;
+        bool tickIndexRestarted = false;
+        static const int maxTicksToCatchUp = 2;
+
+        JitterReport jitterReport;
+        double sumAbsoluteDeviationMicroseconds = 0.0;
+        TimePoint lastTickSentAt;
+        double lastScheduledIntervalNanoseconds = 0.0;
+    };
+
+    /**
+     * Returns the clock engine, which is created on the first call.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    ClockEngine &getClockEngine();
+
+    /**
+     * Locks the clock engine to an external MIDI clock, e.g. from a DAW or a drum machine. The incoming ticks are
+     * smoothed by a delay locked loop, a second order PLL-style filter, so that timestamp jitter of the input is not
+     * passed on to the amp. The engine sends its ticks at the times the filter predicts for the incoming ticks, so
+     * the amp stays in phase with the source.
+     *
+     * A tempo change detector compares the average interval of the last few ticks to the filtered one. If they
+     * differ by more than a threshold for a few ticks in a row, the filter relocks to the new tempo right away
+     * instead of slowly gliding there. This reacts within half a beat.
+     *
+     * Feed the clock ticks as well as the start and stop messages from the MIDI input handler of the port the clock
+     * source is connected to, e.g. the realtime message callbacks of a second SimpleMIDI instance. Forwarding start
+     * and stop matters, a source that restarts would otherwise only be followed once its ticks are far enough ahead.
+     * If the input stops, the engine keeps running at the last tempo.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    class ClockFollower {
+        friend class ProfilingAmp;
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        /** Call this for each incoming MIDI clock tick, best with the timestamp the MIDI driver supplied */
+        void receivedClockTick (TimePoint timestamp);
+
+        /** Call this for each incoming MIDI clock tick if no timestamp is available */
+        void receivedClockTick();
+
+        /** Call this on an incoming MIDI start message. The engine starts as soon as the follower is locked */
+        void receivedStart();
+
+        /** Call this on an incoming MIDI stop message. Stops the engine */
+        void receivedStop();
+
+        /** Returns true if ticks are received regularly and the filter has settled to a tempo */
+        bool isLocked();
+
+        /** Returns the filtered tempo of the input */
+        double getTempo();
+
+        /** Returns how often the tempo change detector relocked the filter */
+        uint32_t getNumTempoChangesDetected();
+
+        /**
+         * Sets the bandwidth of the filter. Lower values smooth out more jitter but follow slow tempo drifts more
+         * sluggishly. Defaults to 1 Hz.
+         */
+        void setLoopBandwidth (double bandwidthInHz);
+
+        /** Sets the relative tempo deviation that is treated as a tempo change. Defaults to 0.03 */
+        void setTempoChangeThreshold (double relativeDeviation);
+
+    private:
+        ClockFollower (ClockEngine &engine) : engine (engine) {};
+
+        /** Restarts the filter based on the interval passed */
+        void relock (TimePoint timestamp, double intervalNanoseconds);
+
+        ClockEngine &engine;
+        std::mutex followerMutex;
+
+        double loopBandwidth = 1.0;
+        double tempoChangeThreshold = 0.03;
+
+        // filter state. The filtered interval and the prediction of the next incoming tick
+        double filteredIntervalNanoseconds = 0.0;
+        TimePoint predictedNextTick;
+        double b = 0.0;
+        double c = 0.0;
+
+        // number of ticks received since the last start, the engine uses the same indices
+        uint64_t numTicksReceived = 0;
+        bool filterInitialized = false;
+
+        // raw timestamps of the last ticks for the tempo change detector
+        static const int tempoChangeWindow = 6;
+        TimePoint recentTicks[tempoChangeWindow + 1];
+        uint8_t numTicksOutsideThreshold = 0;
+        uint32_t numTempoChangesDetected = 0;
+    };
+
+    /**
+     * Returns the clock follower, which is created on the first call.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    ClockFollower &getClockFollower();
+
+    typedef uint32_t ScheduledCommandsID;
+
+    /** Returned by scheduleCommands if the commands were not scheduled */
+    static const ScheduledCommandsID invalidScheduledCommandsID = 0;
+
+    /** Describes when scheduled commands were actually sent */
+    struct ScheduledCommandsReport {
+        ScheduledCommandsID id;
+        // the tick the commands were sent with. This is the tick scheduled, unless it had already passed
+        uint64_t tickIndex;
+        // time between the deadline of that tick and the commands being handed to the MIDI driver
+        int32_t latenessMicroseconds;
+    };
+
+    typedef std::function<void (const ScheduledCommandsReport&)> ScheduledCommandsCallbackFn;
+
+    /**
+     * Schedules commands to be sent with a tick of the clock engine, e.g. to change a rig exactly on the next
+     * downbeat. The function passed is called right away, but instead of sending anything, all messages are encoded
+     * and stored. The clock engine thread sends them right after the tick, so they go out with minimal latency. Side
+     * effects, like the invalidation of the stomp list after a rig change, are applied after sending.
+     *
+     * Only call setters like selectRig, toggleStompInSlot or setAmpGain in the function, getters would wait for the
+     * response to a request that is never sent. The callback is called on the clock engine thread, so keep it short.
+     * !! Not available on single threaded environments like Arduino !!
+     *
+     * @return An ID to cancel the commands or invalidScheduledCommandsID if tickIndex is ClockEngine::invalidTickIndex
+     * @see ClockEngine::getTickIndexOfNextBeat
+     */
+    ScheduledCommandsID scheduleCommands (uint64_t tickIndex, std::function<void()> commands, ScheduledCommandsCallbackFn sentCallback = nullptr);
+
+    /** Removes scheduled commands. Returns false if they were already sent */
+    bool cancelScheduledCommands (ScheduledCommandsID id);
+
+    /**
+     * A sequence of operations, encoded once into a single buffer of MIDI bytes, to be sent with minimal latency
+     * e.g. on a footswitch press. Create it with ProfilingAmp::compileMacro.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    class Macro;
+
+    /** @see ProfilingAmp::getSetlist */
+    class Setlist;
+
+    /** @see ProfilingAmp::getCatalog */
+    class Catalog;
+
+    /**
+     * Records the operations called by the function passed into a macro. Like with scheduleCommands, the function is
+     * called right away but nothing is sent. Only call setters in there, getters would wait for the response to a
+     * request that is never sent.
+     *
+     * The messages recorded are optimized: NRPN values overwritten later on are dropped, the remaining ones are sorted
+     * by page and parameter, and page and parameter selections are only sent where they change. NRPN values are never
+     * moved across other messages like rig changes, so a value set after a rig change still applies to the new rig.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    Macro compileMacro (std::function<void()> operations);
+
+    /**
+     * Starts sending out a midi clock signal to keep the amp in sync via the clock engine.
      * May be much more stable than setTapTempo but will consume more ressources.
      * !! Not available on single threaded environments like Arduino !!
+     *
+     * @return false if the interval passed is 0
+     * @see ClockEngine
      */
-    void startExternalMIDIClocking (uint64_t quarterNoteIntervalInMilliseconds);
+    bool startExternalMIDIClocking (uint64_t quarterNoteIntervalInMilliseconds);
 
     /**
      * Stops the MIDI clock and optionally deletes the thread. If the thread is kept alive the clock will
@@ -240,9 +766,10 @@ public:
 
     /**
      * Sends out two midi clock ticks according to the interval in milliseconds passed. Might not be as stable as
-     * the external midi clock generator functions but much more lightweight.
+     * the external midi clock generator functions but much more lightweight. If the clock engine is running, this
+     * just changes its tempo. Returns false if the interval passed is 0.
      */
-    void setTempo (uint64_t quarterNoteIntervalInMilliseconds);
+    bool setTempo (uint64_t quarterNoteIntervalInMilliseconds);
 
     /**
      * Sends a Tap Down event. If no tapUp was sent after 3 seconds, the amp will activate the beat scanner.
@@ -370,30 +897,50 @@ public:
      */
     void setMorphPedal (uint8_t morphPedalPosition);
 
+    /**
+     * Sets the byte rate of the MIDI link, which is used to estimate how long each message occupies the wire.
+     * Messages are only handed to the MIDI driver once the previous one has passed the wire, so that clock ticks
+     * and footswitch actions can overtake queued requests.
+     *
+     * Pedal positions and the wah manual are meant to be updated continuously, possibly far more often than the
+     * link can carry. Therefore they are sent through a queue that only holds the latest value per controller, drops
+     * values that equal the last one sent and sends the latest position as soon as the link is free.
+     *
+     * The default is 3125 bytes per second, the rate of a standard 31250 baud MIDI connection. Pass 0 for links
+     * without a relevant bandwidth limit like USB, messages will then always be sent immediately. On Arduino,
+     * messages are always sent in call order and receiveMIDI needs to be called regularly to send out pedal
+     * positions that were held back.
+     */
+    void setLinkByteRate (uint32_t bytesPerSecond);
+
     // ---------------- Nested classes for the stomps ---------------------------
 
     /**
      * The base class for all Stomps. Contains some functionality that all stomp types share, like
      * an on/off switch. Note: Stomp instances can only be created by the ProfilingAmp class internally
      * and cannot (and don't need to) be created by the user. Call functions like getWahWahStomp
-     * to get a pointer to an instance of a specific effects type if existent.
+     * to get a pointer to an instance of a specific effects type if existent, or getStomp for any other
+     * effects type. All parameters of a stomp are reachable through setParameter and getParameter.
+     * The stomp classes have no virtual functions and don't add any members, each slot holds the class
+     * matching the stomp type loaded into it.
      */
     class StompBase {
         friend class ProfilingAmp;
     public:
         /**
-         * Returns the stomp type. Especially useful for if you have a generic stomp instance pointer and want to
-         * know which specific stomp type it is. Note: If you figured out, which specific type a generic stomp
-         * instance represents, applying a dynamic_cast to cast the generic stomp type pointer to a specific stomp
-         * type pointer will work.
+         * Returns the stomp type, a combination of the generic and the specific type. Especially useful for if
+         * you have a generic stomp instance pointer and want to know which specific stomp type it is. Call the
+         * getter for that specific type, e.g. getWahWahStomp, to get the matching pointer.
          */
         StompType getStompType();
 
         /**
-         * Should be overriden by derived class to determine if the assumed stomp is still present in that slot.
-         * An instance of the base class can never be valid, so this always returns false for StompBase instances;
+         * Returns true if there still is any stomp in this slot. The classes derived from this one check for
+         * their own stomp type instead. As there is no virtual dispatch, the check depends on the pointer type
+         * it is called on. Note that a stomp of the same type in the next rig is treated as still valid, use a
+         * StompHandle to detect rig changes.
          */
-        virtual bool isStillValid() {return false; };
+        bool isStillValid();
 
         /** Activates or deactivates a Stomp. Pass true for switching it on, false otherwise */
         void setToggleState (bool onOff);
@@ -401,26 +948,55 @@ public:
         /** Returns true if the stomp is currently activated, false otherwise */
         bool getToggleState();
 
+        /**
+         * Sets a parameter of this stomp. Only stomp parameters are accepted, nothing is sent if the parameter
+         * belongs to another stomp type. @see ProfilingAmp::setStompParameter
+         */
+        template <ParameterID id>
+        void setParameter (int16_t value) {
+            if (parameterBelongsToStomp (parameterDescriptors[(int)id], stompType))
+                _amp.writeStompParameter<id> (_slotPage, value);
+        }
+
+        /**
+         * Returns a parameter of this stomp or -1 in case of any error or if the parameter belongs to another stomp
+         * type. Only stomp parameters are accepted.
+         */
+        template <ParameterID id>
+        int16_t getParameter() {
+            if (!parameterBelongsToStomp (parameterDescriptors[(int)id], stompType))
+                return -1;
+
+            return _amp.readStompParameter<id> (_slotPage);
+        }
+
+#ifndef SIMPLE_MIDI_ARDUINO
+        /** Non-blocking version of getToggleState. @see ProfilingAmp::getAmpGainAsync */
+        std::future<bool> getToggleStateAsync();
+
+        /** Non-blocking version of getToggleState. @see ProfilingAmp::getAmpGainAsync */
+        void getToggleStateAsync (ToggleStateCallbackFn completionHandler);
+#endif
+
     protected:
-        StompBase (NRPNPage slotPage, ProfilingAmp &amp) : _slotPage (slotPage), _amp(amp) {};
-        StompType stompType = StompType::Empty;
+        StompBase (NRPNPage slotPage, ProfilingAmp &amp, StompType type) : stompType (type), _slotPage (slotPage), _amp(amp) {};
+        StompType stompType;
         const NRPNPage _slotPage;
         ProfilingAmp &_amp;
     };
 
     /** A class describing functions that all Wah Wah types share */
     class GenericWahStomp : public StompBase {
+        friend class ProfilingAmp;
     public:
         /** Checks if there still is any kind of Wah stomp in this slot */
-        bool isStillValid() override;
+        bool isStillValid();
 
         /** Sets the Wah manual parameter. The value should be in the range 0 - 16383 */
         void setManual (uint16_t manual);
 
     protected:
-        GenericWahStomp (NRPNPage slotPage, ProfilingAmp &amp) : StompBase (slotPage, amp) {
-            stompType = (StompType)(stompType | StompType::GenericWah);
-        };
+        GenericWahStomp (NRPNPage slotPage, ProfilingAmp &amp, StompType type) : StompBase (slotPage, amp, type) {};
     };
 
     /**
@@ -435,12 +1011,10 @@ public:
         friend class ProfilingAmp;
     public:
         /** Checks if there still is a WahWah stomp in this slot */
-        bool isStillValid() override ;
+        bool isStillValid();
 
     private:
-        WahWahStomp (NRPNPage slotPage, ProfilingAmp &amp) : GenericWahStomp (slotPage, amp) {
-            stompType = (StompType)(stompType|StompType::WahWah);
-        };
+        WahWahStomp (NRPNPage slotPage, ProfilingAmp &amp) : GenericWahStomp (slotPage, amp, (StompType)(StompType::GenericWah | StompType::WahWah)) {};
     };
 
     /**
@@ -450,14 +1024,116 @@ public:
      */
     WahWahStomp *getWahWahStomp (StompSlot stompSlot = StompSlot::First);
 
+    /**
+     * Returns a pointer to the stomp of a generic type like StompType::GenericDelay in that slot or a nullpointer
+     * if none is found in that slot. If no specific slot is passed, a pointer to the first instance of this kind
+     * will be returned or a nullpointer if there is no such stomp in the current rig. This works for all effects
+     * types, even if there is no dedicated class for them, e.g.
+     * getStomp (StompType::GenericDelay)->setParameter<ParameterID::DlyMix> (8000)
+     */
+    StompBase *getStomp (StompType genericStompType, StompSlot stompSlot = StompSlot::First);
+
+    /**
+     * A stomp pointer that remembers the rig it was obtained for. The pointers returned by getters like
+     * getWahWahStomp point into a slot that is reused after rig changes, so they might silently refer to a
+     * stomp of the next rig. A handle instead knows if the rig changed or restoreRigState loaded other stomp
+     * types since it was created, which is checked without any MIDI communication. Optionally, it looks up the same stomp type again in the new rig.
+     * Get one by calling getWahWahStompHandle, getGenericWahStompHandle or getStompHandle.
+     */
+    template <class StompClass>
+    class StompHandle {
+        friend class ProfilingAmp;
+    public:
+        /** Creates a handle to no stomp at all */
+        StompHandle() {};
+
+        /** Returns true if the handle points to a stomp and neither the rig nor its stomp types changed since then */
+        bool isStillValid() const {
+            return (stomp != nullptr) && (generation == amp->rigGeneration);
+        }
+
+        /**
+         * If enabled, a handle that is outdated by a rig change searches for the same stomp type in the new rig
+         * on the next access. The search needs a round trip for each slot that wasn't scanned yet. Disabled
+         * by default.
+         */
+        void setRetargetOnRigChange (bool shouldRetarget) {
+            retargetOnRigChange = shouldRetarget;
+        }
+
+        /**
+         * Returns the stomp or a nullpointer if the rig has changed since the handle was created. If retargeting
+         * is enabled, the stomp of the same type in the new rig is returned instead, or a nullpointer if there
+         * is none.
+         */
+        StompClass *get() {
+            if (isStillValid())
+                return stomp;
+
+            if (!retargetOnRigChange || (amp == nullptr))
+                return nullptr;
+
+            // read the generation first, so that a rig change during the search outdates the result again
+            generation = amp->rigGeneration;
+            stomp = static_cast<StompClass*> (amp->getStompInstance (stompType, requestedSlot));
+            return stomp;
+        }
+
+        /** Same as get */
+        StompClass *operator->() { return get(); }
+
+        /** Returns true if get would return a stomp */
+        explicit operator bool() { return get() != nullptr; }
+
+    private:
+        StompHandle (ProfilingAmp &owningAmp, StompType type, StompSlot slot)
+            : amp (&owningAmp), stompType (type), requestedSlot (slot) {
+            generation = amp->rigGeneration;
+            stomp = static_cast<StompClass*> (amp->getStompInstance (stompType, requestedSlot));
+        }
+
+        ProfilingAmp *amp = nullptr;
+        StompClass *stomp = nullptr;
+        uint32_t generation = 0;
+        StompType stompType = StompType::Empty;
+        StompSlot requestedSlot = StompSlot::First;
+        bool retargetOnRigChange = false;
+    };
+
+    /** Same as getGenericWahStomp, but returns a handle that detects rig changes. @see StompHandle */
+    StompHandle<GenericWahStomp> getGenericWahStompHandle (StompSlot stompSlot = StompSlot::First);
+
+    /** Same as getWahWahStomp, but returns a handle that detects rig changes. @see StompHandle */
+    StompHandle<WahWahStomp> getWahWahStompHandle (StompSlot stompSlot = StompSlot::First);
+
+    /** Same as getStomp, but returns a handle that detects rig changes. @see StompHandle */
+    StompHandle<StompBase> getStompHandle (StompType genericStompType, StompSlot stompSlot = StompSlot::First);
+
     /**
      * This will update the internal list of stomps which will get cleared after each rig or performance change.
      * It will be called internally as soon as any stomp will be controlled, so you don't need to call this, but
      * you might implement a call to this after each rig change to speed up the access of effect parameters
-     * right after a the rig change.
+     * right after a the rig change. The requests for all slots are sent out at once, so a scan takes about one
+     * round trip.
      */
     void scanStompSlots();
 
+#ifndef SIMPLE_MIDI_ARDUINO
+    /**
+     * Starts scanning all stomp slots in the background and returns immediately. Each slot is rebuilt as soon as
+     * its response arrives. Stomp getters called while the scan is still running will wait for it to finish
+     * instead of starting another scan.
+     */
+    void scanStompSlotsAsync();
+
+    /**
+     * If enabled, a background scan of all stomp slots is started after each rig or performance change sent through
+     * this class, so that the stomp instances are ready before they are accessed the first time. Disabled by default.
+     * @see scanStompSlotsAsync
+     */
+    void setAutomaticStompScan (bool shouldScanAfterRigChange);
+#endif
+
     /**
      * Helps searching for stomp types in the effects chain. Searches for a generic Stomp type, e.g.
      * if you pass GenericDistortion it will return the first slot any kind of distortion was found
@@ -474,49 +1150,205 @@ public:
      */
     StompSlot getSlotOfFirstSpecificStompType (StompType stompTypeToSearchFor);
 
-    // ------------- Getting and setting amp parameters for the active rig ------
+#ifdef KPAPI_PARAMETER_MIRROR
+    // ---------------- Local parameter mirror ----------------------------------
 
-    /** Sets the gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
-    void setAmpGain (int16_t gain);
+    /**
+     * Enables or disables the local parameter mirror. If enabled, all parameter values of the active rig are kept
+     * in a table in memory as soon as they were read once, so that reading them again won't need any MIDI
+     * communication. The table is kept up to date by all setters and by the parameter changes the amp sends by
+     * itself, so a getter will always return the last value set. All values are cleared after each rig or
+     * performance change. Disabled by default.
+     */
+    void enableParameterMirror (bool shouldBeEnabled);
 
-    /** Returns the gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
-    int16_t getAmpGain();
+    /** Clears all values held by the parameter mirror, so that they will be read from the amp on the next access */
+    void invalidateParameterMirror();
+#endif
 
-    /** Sets the EQ's bass gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
-    void setAmpEQBassGain (int16_t bassGain);
+    // ---------------- Batching parameter changes ------------------------------
 
-    /** Returns the EQ's bass gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
-    int16_t getAmpEQBassGain();
+    /**
+     * Returned by sendParameterChangeBatch. Compares the number of bytes that were actually sent with the number
+     * of bytes that sending each change as plain NRPN control changes would have taken.
+     */
+    struct ParameterChangeBatchStatistics {
+        uint32_t numParameterChanges;
+        uint32_t numBytesSent;
+        uint32_t numBytesAsNRPN;
+    };
 
-    /** Sets the EQ's mid gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
-    void setAmpEQMidGain (int16_t midGain);
+    /**
+     * Starts collecting parameter changes. All parameter setters called after this, including the setters of
+     * stomp instances, won't send anything but add their change to a batch until sendParameterChangeBatch is
+     * called. If a parameter is set multiple times, only the last value will be sent. If the batch is full,
+     * the changes collected so far will be sent out and collecting continues. Must be called from the same
+     * thread as the setters and sendParameterChangeBatch.
+     */
+    void beginParameterChangeBatch();
 
-    /** Returns the EQ's mid gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
-    int16_t getAmpEQMidGain();
+    /**
+     * Sends all parameter changes collected since beginParameterChangeBatch, grouped by page. For each run of
+     * consecutive parameters on a page, the cheapest encoding on the wire is chosen - either NRPN control
+     * changes, a SingleParamChange or a MultiParamChange SysEx. Setters will send immediately again afterwards.
+     */
+    ParameterChangeBatchStatistics sendParameterChangeBatch();
 
-    /** Sets the EQ's high gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
-    void setAmpEQTrebleGain (int16_t highGain);
+#ifndef SIMPLE_MIDI_ARDUINO
+    // ---------------- Rig state snapshots -------------------------------------
 
-    /** Returns the EQ's high gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
-    int16_t getAmpEQTrebleGain();
+    /**
+     * All parameters of the amp, EQ and cab page and of all eight stomp slots, as defined by NRPNParameter.
+     * @see ProfilingAmp::captureRigState
+     */
+    struct RigState;
 
-    /** Sets the EQ's presence gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
-    void setAmpEQPresenceGain (int16_t presenceGain);
+    /**
+     * Reads all parameters of the active rig that are part of a RigState. The values are requested page by page
+     * with multi parameter requests sent back to back, values known by the parameter mirror or the rig change
+     * prefetch are not requested at all. Values that couldn't be received are -1.
+     */
+    RigState captureRigState();
 
-    /** Returns the EQ's presence gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
-    int16_t getAmpEQPresenceGain();
+    /**
+     * Brings the active rig back to the state passed. Only the parameters that differ from the current state are
+     * sent, grouped by page as a parameter change batch, so each run of consecutive parameters costs one message. The
+     * current state is read like captureRigState does, so with the parameter mirror enabled, finding the differences
+     * needs no communication at all. If the stomp type of a slot differs, all parameters of that slot are sent and
+     * all stomp handles become invalid, like after a rig change.
+     * Values of -1 in the state passed are left untouched. If called while a batch is collected, the changes are
+     * added to it and the statistics returned are empty.
+     */
+    ParameterChangeBatchStatistics restoreRigState (const RigState &rigState);
+#endif
 
-    // ---------------- Getting string parameters for the active rig ------------
-    
-    /** Returns the name of the currently active rig */
-    returnStringType getActiveRigName ();
-    
-    /** Returns the name of the currently active amp */
-    returnStringType getActiveAmpName ();
-    
-    /** Returns the name of the currently active amp's manufacturer */
-    returnStringType getActiveAmpManufacturerName ();
-    
+    // ---------------- Parameters by ID ----------------------------------------
+
+    /**
+     * Sets any rig, input, amp, EQ or cab parameter of the active rig, e.g. setParameter<ParameterID::AmpClarity>.
+     * Values are clamped to the range that can be transferred, 0 - 16383 or 0 - 1 for switches, not to the range
+     * the amp accepts for the parameter. Passing a stomp parameter won't compile, use setStompParameter for those.
+     */
+    template <ParameterID id>
+    void setParameter (int16_t value) {
+        static_assert (parameterDescriptors[(int)id].page != PageUninitialized, "Stomp parameters are set with setStompParameter");
+        writeParameter (parameterDescriptors[(int)id], parameterDescriptors[(int)id].page, value);
+    }
+
+    /** Returns any rig, input, amp, EQ or cab parameter of the active rig or -1 in case of any error */
+    template <ParameterID id>
+    int16_t getParameter() {
+        static_assert (parameterDescriptors[(int)id].page != PageUninitialized, "Stomp parameters are read with getStompParameter");
+        return getSingleParameter (parameterDescriptors[(int)id].page, parameterDescriptors[(int)id].parameter);
+    }
+
+    /**
+     * Sets a parameter of the stomp in a slot, e.g. setStompParameter<ParameterID::DlyMix> (StompSlot::Dly, 8000).
+     * Only stomp parameters are accepted. Nothing is sent if the slot is invalid or if the parameter doesn't belong
+     * to the type of the stomp loaded into the slot.
+     */
+    template <ParameterID id>
+    void setStompParameter (StompSlot stompSlot, int16_t value) {
+        if ((stompSlot < StompSlot::A) || (stompSlot > StompSlot::Rev))
+            return;
+
+        updateStompSlotIfNeeded (stompSlot);
+
+        if (parameterBelongsToStomp (parameterDescriptors[(int)id], stompTypeInSlot (stompSlot)))
+            writeStompParameter<id> (fxSlotNRPNPageMapping[stompSlot], value);
+    }
+
+    /**
+     * Returns a parameter of the stomp in a slot or -1 in case of any error or if the parameter doesn't belong to the
+     * type of the stomp loaded into the slot. Only stomp parameters are accepted.
+     */
+    template <ParameterID id>
+    int16_t getStompParameter (StompSlot stompSlot) {
+        if ((stompSlot < StompSlot::A) || (stompSlot > StompSlot::Rev))
+            return -1;
+
+        updateStompSlotIfNeeded (stompSlot);
+
+        if (!parameterBelongsToStomp (parameterDescriptors[(int)id], stompTypeInSlot (stompSlot)))
+            return -1;
+
+        return readStompParameter<id> (fxSlotNRPNPageMapping[stompSlot]);
+    }
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    /** Non-blocking version of getParameter, the handler is called on the MIDI thread. */
+    template <ParameterID id>
+    void getParameterAsync (ParameterCallbackFn completionHandler) {
+        static_assert (parameterDescriptors[(int)id].page != PageUninitialized, "Stomp parameters are read with getStompParameter");
+        getSingleParameterAsync (parameterDescriptors[(int)id].page, parameterDescriptors[(int)id].parameter, completionHandler);
+    }
+
+    /** Non-blocking version of getParameter. */
+    template <ParameterID id>
+    std::future<int16_t> getParameterAsync() {
+        return makeFuture<int16_t> ([this] (ParameterCallbackFn handler) { getParameterAsync<id> (handler); });
+    }
+#endif
+
+    // ------------- Getting and setting amp parameters for the active rig ------
+
+    /** Sets the gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
+    void setAmpGain (int16_t gain);
+
+    /** Returns the gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
+    int16_t getAmpGain();
+
+    /** Sets the EQ's bass gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
+    void setAmpEQBassGain (int16_t bassGain);
+
+    /** Returns the EQ's bass gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
+    int16_t getAmpEQBassGain();
+
+    /** Sets the EQ's mid gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
+    void setAmpEQMidGain (int16_t midGain);
+
+    /** Returns the EQ's mid gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
+    int16_t getAmpEQMidGain();
+
+    /** Sets the EQ's high gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
+    void setAmpEQTrebleGain (int16_t highGain);
+
+    /** Returns the EQ's high gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
+    int16_t getAmpEQTrebleGain();
+
+    /** Sets the EQ's presence gain of the Amp in the active Rig. The value should be in the range 0 - 16383. */
+    void setAmpEQPresenceGain (int16_t presenceGain);
+
+    /** Returns the EQ's presence gain of the Amp in the active Rig. The value returned will be in the range 0 - 16383. */
+    int16_t getAmpEQPresenceGain();
+
+    /** The amp and EQ settings of the active rig, returned by getAmpSettings. All values are in the range 0 - 16383. */
+    struct AmpSettings {
+        int16_t gain;
+        int16_t eqBassGain;
+        int16_t eqMidGain;
+        int16_t eqTrebleGain;
+        int16_t eqPresenceGain;
+    };
+
+    /**
+     * Returns the amp gain and all EQ gains of the active rig with a single message exchange instead of
+     * calling getAmpGain and all getAmpEQ... functions one after another. Values that couldn't be
+     * received will be -1.
+     */
+    AmpSettings getAmpSettings();
+
+    // ---------------- Getting string parameters for the active rig ------------
+    
+    /** Returns the name of the currently active rig */
+    returnStringType getActiveRigName ();
+    
+    /** Returns the name of the currently active amp */
+    returnStringType getActiveAmpName ();
+    
+    /** Returns the name of the currently active amp's manufacturer */
+    returnStringType getActiveAmpManufacturerName ();
+    
     /** Returns the name of the currently active amp model */
     returnStringType getActiveAmpModelName ();
     
@@ -534,13 +1366,347 @@ public:
     
     /** Returns the name of a selectable rig in the currently active performance */
     returnStringType getRigName (RigNr rig);
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    /** All names describing the currently active rig, returned by getActiveRigNames */
+    struct ActiveRigNames {
+        returnStringType rigName;
+        returnStringType ampName;
+        returnStringType ampManufacturerName;
+        returnStringType ampModelName;
+        returnStringType cabName;
+        returnStringType cabManufacturerName;
+        returnStringType cabModelName;
+        returnStringType performanceName;
+    };
+
+    /**
+     * Returns all names of the currently active rig at once. All requests are sent out back to back, so this
+     * costs roughly the time of a single getActive...Name call. Names that couldn't be received will be empty.
+     */
+    ActiveRigNames getActiveRigNames();
+
+    // ---------------- Rig change prefetch -------------------------------------
+
+    /** Everything the rig change prefetch requests for a rig */
+    struct RigSnapshot {
+        ActiveRigNames names;
+        AmpSettings ampSettings;
+        // on/off state of the stomp slots A - D, X, Mod, Dly and Rev, -1 if unknown
+        int16_t stompToggleStates[8];
+    };
+
+    typedef std::function<void (const RigSnapshot&)> RigSnapshotReadyCallbackFn;
+
+    /** Counts the getter calls the rig change prefetch could serve and the ones it couldn't */
+    struct PrefetchStatistics {
+        uint32_t numHits;
+        uint32_t numMisses;
+    };
+
+    /**
+     * Enables or disables the rig change prefetch. If enabled, all names of the active rig, the amp settings and the
+     * on/off states of all stomps are requested in the background as soon as a rig or performance change is sent or
+     * the amp reports a new active rig name by itself. The stomp slots are scanned as well. All requests are sent back
+     * to back, and the getters for those values return the prefetched values instead of asking the amp again. If a
+     * getter is called while the value is still on its way, it waits for the prefetch instead of sending another
+     * request. Setters update the prefetched values. Disabled by default.
+     */
+    void enableRigChangePrefetch (bool shouldBeEnabled);
+
+    /**
+     * The callback is called as soon as all values of the prefetch for the active rig were received, on the MIDI
+     * receive thread or the timeout thread, so keep it short and don't call any blocking getter in there.
+     */
+    void setRigSnapshotReadyCallback (RigSnapshotReadyCallbackFn rigSnapshotReadyCallback);
+
+    /** Returns true if the prefetch for the active rig completed */
+    bool isRigSnapshotReady();
+
+    /**
+     * Returns the prefetched values for the active rig, waiting for the prefetch to complete if needed. Values that
+     * couldn't be received are empty or -1. Only values the prefetch already got are returned without any
+     * communication, so this should be called with the prefetch enabled.
+     */
+    RigSnapshot getRigSnapshot();
+
+    PrefetchStatistics getPrefetchStatistics();
+
+    void resetPrefetchStatistics();
+
+    // ---------------- State cache ---------------------------------------------
+
+    /**
+     * Writes everything known about the active rig to a file, so that the next start can begin with it: the stomp
+     * types found by the last stomp scan, the names, amp settings and stomp states held by the rig change prefetch and
+     * the values of the parameter mirror if it is enabled. Call it before shutting down. Returns false if the file
+     * couldn't be written.
+     */
+    bool saveStateCache (const char *stateCacheFilePath);
+
+    /**
+     * Loads a file written by saveStateCache and enables the rig change prefetch. To find out if the cache is still
+     * valid, only the names of the active rig and performance are requested. If they match the cached ones, all cached
+     * values are used right away and only the values missing in the cache are requested in the background. Otherwise
+     * the cache is discarded and the whole rig is requested like after a rig change. Returns true if the cache was
+     * valid. Note that changes made to the rig on the amp without storing it under a new name can't be detected.
+     */
+    bool loadStateCache (const char *stateCacheFilePath);
+
+    // ---------------- Asynchronous getters ------------------------------------
+    /*
+     * Non-blocking versions of the getters above. Each getter comes in two flavours: One returns a std::future
+     * holding the value, the other one takes a completion handler. Both send out the request and return
+     * immediately, so any number of queries might be in flight at the same time. The completion handlers
+     * are invoked on the MIDI receive thread as soon as the response arrives or on an internal timeout thread
+     * with the same error value the blocking getter would return (-1 or an empty string) if no response arrived
+     * in time. Therefore they should return quickly and must never call a blocking getter.
+     */
+
+    /** Non-blocking version of getAmpGain. */
+    std::future<int16_t> getAmpGainAsync();
+
+    /** Non-blocking version of getAmpGain, the handler is called on the MIDI thread. */
+    void getAmpGainAsync (ParameterCallbackFn completionHandler);
+
+    /** Non-blocking version of getAmpEQBassGain. */
+    std::future<int16_t> getAmpEQBassGainAsync();
+
+    /** Non-blocking version of getAmpEQBassGain, the handler is called on the MIDI thread. */
+    void getAmpEQBassGainAsync (ParameterCallbackFn completionHandler);
+
+    /** Non-blocking version of getAmpEQMidGain. */
+    std::future<int16_t> getAmpEQMidGainAsync();
+
+    /** Non-blocking version of getAmpEQMidGain, the handler is called on the MIDI thread. */
+    void getAmpEQMidGainAsync (ParameterCallbackFn completionHandler);
+
+    /** Non-blocking version of getAmpEQTrebleGain. */
+    std::future<int16_t> getAmpEQTrebleGainAsync();
+
+    /** Non-blocking version of getAmpEQTrebleGain, the handler is called on the MIDI thread. */
+    void getAmpEQTrebleGainAsync (ParameterCallbackFn completionHandler);
+
+    /** Non-blocking version of getAmpEQPresenceGain. */
+    std::future<int16_t> getAmpEQPresenceGainAsync();
+
+    /** Non-blocking version of getAmpEQPresenceGain, the handler is called on the MIDI thread. */
+    void getAmpEQPresenceGainAsync (ParameterCallbackFn completionHandler);
+
+    /** Non-blocking version of getStompToggleState. */
+    std::future<bool> getStompToggleStateAsync (StompSlot stompSlot);
+
+    /** Non-blocking version of getStompToggleState, the handler is called on the MIDI thread. */
+    void getStompToggleStateAsync (StompSlot stompSlot, ToggleStateCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveRigName. */
+    std::future<returnStringType> getActiveRigNameAsync();
+
+    /** Non-blocking version of getActiveRigName, the handler is called on the MIDI thread. */
+    void getActiveRigNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveAmpName. */
+    std::future<returnStringType> getActiveAmpNameAsync();
+
+    /** Non-blocking version of getActiveAmpName, the handler is called on the MIDI thread. */
+    void getActiveAmpNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveAmpManufacturerName. */
+    std::future<returnStringType> getActiveAmpManufacturerNameAsync();
+
+    /** Non-blocking version of getActiveAmpManufacturerName, the handler is called on the MIDI thread. */
+    void getActiveAmpManufacturerNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveAmpModelName. */
+    std::future<returnStringType> getActiveAmpModelNameAsync();
+
+    /** Non-blocking version of getActiveAmpModelName, the handler is called on the MIDI thread. */
+    void getActiveAmpModelNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveCabName. */
+    std::future<returnStringType> getActiveCabNameAsync();
+
+    /** Non-blocking version of getActiveCabName, the handler is called on the MIDI thread. */
+    void getActiveCabNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveCabManufacturerName. */
+    std::future<returnStringType> getActiveCabManufacturerNameAsync();
+
+    /** Non-blocking version of getActiveCabManufacturerName, the handler is called on the MIDI thread. */
+    void getActiveCabManufacturerNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActiveCabModelName. */
+    std::future<returnStringType> getActiveCabModelNameAsync();
+
+    /** Non-blocking version of getActiveCabModelName, the handler is called on the MIDI thread. */
+    void getActiveCabModelNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getActivePerformanceName. */
+    std::future<returnStringType> getActivePerformanceNameAsync();
+
+    /** Non-blocking version of getActivePerformanceName, the handler is called on the MIDI thread. */
+    void getActivePerformanceNameAsync (StringCallbackFn completionHandler);
+
+    /** Non-blocking version of getRigName. */
+    std::future<returnStringType> getRigNameAsync (RigNr rig);
+
+    /** Non-blocking version of getRigName, the handler is called on the MIDI thread. */
+    void getRigNameAsync (RigNr rig, StringCallbackFn completionHandler);
+#endif
+
+#ifdef KPAPI_COROUTINES
+    // ---------------- Coroutines (C++20 only) --------------------------------
+
+    /**
+     * The return type for coroutines that interact with the amp. A task is created suspended and starts running
+     * as soon as it is passed to ProfilingAmp::spawn. All tasks spawned on the same amp are resumed one at a time
+     * by a small single threaded executor that is driven by the MIDI receive callbacks, so any number of tasks can
+     * run interleaved without needing a thread each. As a task resumes on the MIDI thread, it must not call the
+     * blocking getters but use their co_await-able versions, e.g.
+     *
+     * ProfilingAmp::Task checkGain (ProfilingAmp &amp) {
+     *     if (co_await amp.getAmpGainAwaitable() > 8000)
+     *         amp.setAmpEQTrebleGain (co_await amp.getAmpEQTrebleGainAwaitable() / 2);
+     * }
+     *
+     * amp.spawn (checkGain (amp));
+     */
+    class Task {
+        friend class ProfilingAmp;
+    public:
+        struct promise_type {
+            Task get_return_object() { return Task (std::coroutine_handle<promise_type>::from_promise (*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        Task (Task &&other) noexcept : handle (other.handle) { other.handle = nullptr; }
+
+        Task (const Task &other) = delete;
+
+        /** A task that was never spawned is simply destroyed */
+        ~Task() {
+            if (handle)
+                handle.destroy();
+        }
+
+    private:
+        explicit Task (std::coroutine_handle<promise_type> coroutineHandle) : handle (coroutineHandle) {};
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    /**
+     * Returned by all ...Awaitable getters. Awaiting it sends out the request and suspends the task until the
+     * response arrived, the result is the same value the blocking getter would return.
+     */
+    template <typename ValueType>
+    class Awaitable {
+    public:
+        typedef std::function<void (std::function<void (ValueType)>)> AsyncGetter;
+
+        Awaitable (ProfilingAmp &amp, AsyncGetter asyncGetter) : _amp (amp), _asyncGetter (std::move (asyncGetter)) {};
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend (std::coroutine_handle<> awaitingCoroutine) {
+            _asyncGetter ([this, awaitingCoroutine] (ValueType value) {
+                result = std::move (value);
+                _amp.coroutineExecutor.post (awaitingCoroutine);
+                _amp.coroutineExecutor.runPending();
+            });
+        }
+
+        ValueType await_resume() { return std::move (result); }
+
+    private:
+        ProfilingAmp &_amp;
+        AsyncGetter _asyncGetter;
+        ValueType result = ValueType();
+    };
+
+    /**
+     * Starts running a task. Unless the executor is busy on another thread, the first part of the task until its
+     * first co_await runs on the calling thread.
+     */
+    void spawn (Task task);
+
+    /** co_await-able version of getAmpGain */
+    Awaitable<int16_t> getAmpGainAwaitable();
+
+    /** co_await-able version of getAmpEQBassGain */
+    Awaitable<int16_t> getAmpEQBassGainAwaitable();
+
+    /** co_await-able version of getAmpEQMidGain */
+    Awaitable<int16_t> getAmpEQMidGainAwaitable();
+
+    /** co_await-able version of getAmpEQTrebleGain */
+    Awaitable<int16_t> getAmpEQTrebleGainAwaitable();
+
+    /** co_await-able version of getAmpEQPresenceGain */
+    Awaitable<int16_t> getAmpEQPresenceGainAwaitable();
+
+    /** co_await-able version of getStompToggleState */
+    Awaitable<bool> getStompToggleStateAwaitable (StompSlot stompSlot);
+
+    /** co_await-able version of getActiveRigName */
+    Awaitable<returnStringType> getActiveRigNameAwaitable();
+
+    /** co_await-able version of getActiveAmpName */
+    Awaitable<returnStringType> getActiveAmpNameAwaitable();
+
+    /** co_await-able version of getActiveAmpManufacturerName */
+    Awaitable<returnStringType> getActiveAmpManufacturerNameAwaitable();
+
+    /** co_await-able version of getActiveAmpModelName */
+    Awaitable<returnStringType> getActiveAmpModelNameAwaitable();
+
+    /** co_await-able version of getActiveCabName */
+    Awaitable<returnStringType> getActiveCabNameAwaitable();
+
+    /** co_await-able version of getActiveCabManufacturerName */
+    Awaitable<returnStringType> getActiveCabManufacturerNameAwaitable();
+
+    /** co_await-able version of getActiveCabModelName */
+    Awaitable<returnStringType> getActiveCabModelNameAwaitable();
+
+    /** co_await-able version of getActivePerformanceName */
+    Awaitable<returnStringType> getActivePerformanceNameAwaitable();
+
+    /** co_await-able version of getRigName */
+    Awaitable<returnStringType> getRigNameAwaitable (RigNr rig);
+#endif
     
 private:
 
     // ======== Managing bidirectional communication=================
+    /**
+     * Requests of user threads are admitted to the response managers before requests sent in the background,
+     * like the prefetch after rig changes or the catalog crawl.
+     */
+    enum RequestPriority : uint8_t {
+        ForegroundRequest = 0,
+        BackgroundRequest,
+
+        numRequestPriorities
+    };
+
     /**
      * A class managing to redirect to content (SysEx-) messages received to the getter function
-     * that sent out a request for a parameter.
+     * that sent out a request for a parameter. Multiple requests might be pending at the same time,
+     * each response is matched to its request by a key built from the function code and the address
+     * (page & parameter or controller number) of the response. This allows sending out a bunch of
+     * requests back to back and collecting all responses afterwards, which costs roughly one round trip
+     * instead of one round trip per request.
+     * Any number of threads may send requests at the same time. If all slots are in use, requests are
+     * queued in FIFO order per RequestPriority and get the next slot freed, so no caller fails just because
+     * another thread is waiting for a response.
+     * On multithreaded platforms, each slot carries its state in an atomic. The MIDI thread claims the slot
+     * matching a response with a single compare-exchange and wakes up the waiting thread through the atomic,
+     * so it never blocks on a mutex held by a user thread. This is only lock-free with C++20 atomic waits. Without
+     * them, waiting threads sleep on a condition variable and the MIDI thread locks its mutex to wake them up,
+     * though waiters only hold it while going to sleep. Timeouts are detected by an internal timeout thread.
      * @tparam T Type of data expected, eg. char strings, integer values...
      */
     template<typename T>
@@ -551,180 +1717,728 @@ private:
             timeout = 1,
             stillWaitingForPrevious = 2
         };
-#ifdef SIMPLE_MIDI_ARDUINO
-        ResponseMessageManager (ProfilingAmp &outerClass) : _outerClass (outerClass) {}
 
-        /**
-         * This is called by the function that wants to receive a response after having sent out some kind of request.
-         * It blocks until the response message was received and stored in the buffer provided by the caller.
-         * If a timeout appears, all response buffer fields will be filled with zeros - so in case it's a C string char
-         * array, this will be interpreted as an empty string while in case of integer or float values, this will be the
-         * numerical value 0.
-         * @param responseBuffer Pointer to an array that's filled with the response data.
-         * @param responseBufferSize Size of the array to fill (number of array elements, NOT size in Bytes!).
-         * @param timeoutInMilliseconds Time to wait for a response.
-         *
-         * @return errorCode::success if successful, errorCode::timeout if a timeout occured
-         *         or errorCode::stillWaitingForPrevious if it's still waiting for a previous message.
-         */
-        ErrorCode waitingForResponseOrTimeout (T *responseTargetBuffer, int responseTargetBufferSize, int timeoutInMilliseconds = 500) {
-            // will this ever happen???
-            if (waitingForResponse)
-                return stillWaitingForPrevious;
+        /** Refers to a request registered by registerRequest. Negative values are invalid handles. */
+        typedef int8_t RequestHandle;
 
-            unsigned long timeoutTimepoint = timeoutInMilliseconds + millis();
+        static const RequestHandle invalidRequestHandle = -1;
 
-            this->responseTargetBuffer = responseTargetBuffer;
-            this->responseTargetBufferSize = responseTargetBufferSize;
+        /** The maximum number of requests that might be waiting for a response at the same time */
+#ifdef SIMPLE_MIDI_ARDUINO
+        static const int8_t maxPendingRequests = 8;
+#else
+        static const int8_t maxPendingRequests = 32;
+#endif
 
-            hasReceivedResponse = false;
-            waitingForResponse = true;
+        ResponseMessageManager (ProfilingAmp &outerClass) : _outerClass (outerClass) {}
 
-            while (millis() < timeoutTimepoint) {
-                _outerClass.receive();
-                if (hasReceivedResponse) {
-                    waitingForResponse = false;
-                    return success;
-                }
+#ifndef SIMPLE_MIDI_ARDUINO
+        ~ResponseMessageManager() {
+            {
+                std::lock_guard<std::mutex> lk (timeoutThreadMutex);
+                stopTimeoutThread = true;
             }
+            timeoutThreadCv.notify_one();
 
-            waitingForResponse = false;
-            return timeout;
+            if (timeoutThread.joinable())
+                timeoutThread.join();
         }
 
         /**
-         * This is called by the corresponding MIDI handler when a speficic kind of message was received. If no
-         * request was sent out before, it returns false and does nothing, otherwise it copies the elements from
-         * the source buffer to the target buffer provided by the caller of waitingForResponseOrTimeout.
-         * @param responseBuffer The buffer provided by the MIDI handler.
-         * @param responseBufferSize The number of elemets to copy to the target buffer (number of array elements, NOT size in Bytes!).
-         * @return false if no thread was waiting for a response, true if the response could have been delivered.
+         * Handler called with the result of an asynchronous request. The response data pointer is only valid
+         * during the call and will be a nullpointer in case of a timeout.
          */
-        bool receivedResponse (const T *responseSourceBuffer, int responseSourceBufferSize) {
-
-            if (waitingForResponse) {
-
-                if (responseSourceBufferSize > responseTargetBufferSize)
-                    responseSourceBufferSize = responseTargetBufferSize;
-                memcpy (responseTargetBuffer, responseSourceBuffer, responseSourceBufferSize * sizeof (T));
-                hasReceivedResponse = true;
-                return true;
-            }
-            return false;
-        }
+        typedef std::function<void (ErrorCode errorCode, const T *responseData, int numElementsReceived)> CompletionHandler;
 
         /**
-         * Returns true if waitingForResponseOrTimeout was called before and no response data
-         * was processed until now.
+         * Reserves a slot for an asynchronous request and sends it out by calling sendRequest. Instead of blocking
+         * the caller until the response arrives, the completion handler will be called from the MIDI thread that
+         * delivers the response or from an internal timeout thread if no response arrived before the timeout
+         * expired. If all slots are in use, the request is queued and sent as soon as it gets a slot, sendRequest
+         * is then called from the thread that freed the slot. The completion handler is always called.
          */
-        bool isWaitingForResponse() {
-            return waitingForResponse;
-        }
-
-    private:
-        ProfilingAmp &_outerClass;
-        bool waitingForResponse = false;
-        bool hasReceivedResponse = false;
-        T *responseTargetBuffer = nullptr;
-        int responseTargetBufferSize = 0;
+        void submitAsyncRequest (uint32_t requestKey, CompletionHandler completionHandler, std::function<void()> sendRequest,
+                                 RequestPriority priority = ForegroundRequest, int timeoutInMilliseconds = 500) {
+            std::unique_lock<std::mutex> lk (pendingRequestsMutex);
+            startTimeoutThreadIfNeeded();
+
+            QueuedRequest queuedRequest;
+            queuedRequest.key = requestKey;
+            queuedRequest.completionHandler = std::move (completionHandler);
+            queuedRequest.timeoutInMilliseconds = timeoutInMilliseconds;
+
+            if (hasQueuedRequests (priority) || (occupyFreeSlot (queuedRequest) == invalidRequestHandle)) {
+                queuedRequest.sendRequest = std::move (sendRequest);
+                queuedRequests[priority].push_back (std::move (queuedRequest));
+                numQueuedRequests++;
+                unlockAndGrantFreeSlots (lk);
+                return;
+            }
 
-#else
-        ResponseMessageManager (ProfilingAmp &outerClass) : _outerClass (outerClass), waitingForResponse (false) {}
+            unlockAndGrantFreeSlots (lk);
+            deadlineAdded();
+            sendRequest();
+        }
+#endif
 
         /**
-         * This is called by the thread that wants to receive a response after having sent out some kind of request.
-         * It blocks until the response message was received and stored in the buffer provided by the caller.
-         * If a timeout appears, all response buffer fields will be filled with zeros - so in case it's a C string char
-         * array, this will be interpreted as an empty string while in case of integer or float values, this will be the
-         * numerical value 0.
+         * Reserves a slot for a request that is about to be sent out. This has to be called before sending out the
+         * request, otherwise a fast response might get lost. The response matching the key passed will be copied
+         * into the buffer provided by the caller.
+         * @param requestKey The key identifying the expected response, built by ProfilingAmp::responseKey.
          * @param responseTargetBuffer Pointer to an array that's filled with the response data.
          * @param responseTargetBufferSize Size of the array to fill (number of array elements, NOT size in Bytes!).
-         * @param timeoutInMilliseconds Time to wait for a response.
+         * @param priority The queue to wait in if all slots are in use.
+         * @param mayWait If true, the caller is queued until a slot is free or the timeout expired if all slots are
+         *                in use. Only pass true if the caller holds no slot that waits to be released, otherwise
+         *                the threads holding all slots might wait for each other. Ignored on Arduino.
+         * @param timeoutInMilliseconds Time to wait for the response, counted from the moment the slot was
+         *                              reserved. If the caller has to wait for a slot, this is also the maximum
+         *                              time to wait for it.
          *
-         * @return errorCode::success if successful, errorCode::timeout if a timeout occured
-         *         or errorCode::stillWaitingForPrevious if it's still waiting for a previous message.
+         * @return A handle to pass to waitForResponseOrTimeout or invalidRequestHandle if no slot could be reserved.
          */
-        ErrorCode waitingForResponseOrTimeout (T *responseTargetBuffer, int responseTargetBufferSize, int timeoutInMilliseconds = 500) {
-
-            // check if a previous caller still waits for a response
-            if (waitingForResponse.load())
-                return stillWaitingForPrevious;
-
-            // set the flag that we are waiting for a response
-            waitingForResponse.store (true);
+        RequestHandle registerRequest (uint32_t requestKey, T *responseTargetBuffer, int responseTargetBufferSize,
+                                       RequestPriority priority = ForegroundRequest, bool mayWait = false, int timeoutInMilliseconds = 500) {
+#ifdef SIMPLE_MIDI_ARDUINO
+            for (RequestHandle h = 0; h < maxPendingRequests; h++) {
+                PendingRequest &request = pendingRequests[h];
+                if (request.state == slotFree) {
+                    request.key = requestKey;
+                    request.sequenceNumber = nextSequenceNumber++;
+                    request.responseTargetBuffer = responseTargetBuffer;
+                    request.responseTargetBufferSize = responseTargetBufferSize;
+                    request.deadline = millis() + timeoutInMilliseconds;
+                    request.timeoutInMilliseconds = timeoutInMilliseconds;
+                    request.state = slotWaiting;
+                    return h;
+                }
+            }
 
-            // aquire the lock as fast as possible to set the target buffer
-            std::unique_lock<std::mutex> lk (responseTargetBufferMutex);
+            return invalidRequestHandle;
+#else
+            std::unique_lock<std::mutex> lk (pendingRequestsMutex);
+            startTimeoutThreadIfNeeded();
+
+            QueuedRequest queuedRequest;
+            queuedRequest.key = requestKey;
+            queuedRequest.responseTargetBuffer = responseTargetBuffer;
+            queuedRequest.responseTargetBufferSize = responseTargetBufferSize;
+            queuedRequest.timeoutInMilliseconds = timeoutInMilliseconds;
+
+            // never overtake a request queued before
+            RequestHandle h = invalidRequestHandle;
+            if (!hasQueuedRequests (priority))
+                h = occupyFreeSlot (queuedRequest);
+
+            if ((h != invalidRequestHandle) || !mayWait) {
+                unlockAndGrantFreeSlots (lk);
+                if (h != invalidRequestHandle)
+                    deadlineAdded();
+                return h;
+            }
 
-            this->responseTargetBuffer = responseTargetBuffer;
-            this->responseTargetBufferSize = responseTargetBufferSize;
+            // wait until a thread freeing a slot hands it to this request or the timeout thread gives up
+            std::atomic<RequestHandle> grantedHandle {slotNotGrantedYet};
+            queuedRequest.grantedHandle = &grantedHandle;
+            queuedRequest.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds (timeoutInMilliseconds);
+            queuedRequests[priority].push_back (std::move (queuedRequest));
+            numQueuedRequests++;
+            unlockAndGrantFreeSlots (lk);
+            deadlineAdded();
+
+            while ((h = grantedHandle.load (std::memory_order_acquire)) == slotNotGrantedYet)
+                waitWhileEqual (grantedHandle, slotNotGrantedYet);
+
+            // the handle is set with the mutex held, so this makes sure the other thread is done notifying
+            lk.lock();
+            unlockAndGrantFreeSlots (lk);
+            return h;
+#endif
+        }
 
-            // calculate the timepoint at which a timeout will be thrown
-            auto timeoutTimepoint = std::chrono::system_clock::now() + std::chrono::milliseconds (timeoutInMilliseconds);
+        /**
+         * Blocks until the response to a single request registered before was received or a timeout appeared.
+         * @see waitForResponsesOrTimeout
+         */
+        ErrorCode waitForResponseOrTimeout (RequestHandle requestHandle) {
+            ErrorCode errorCode;
+            return waitForResponsesOrTimeout (&requestHandle, &errorCode, 1);
+        }
 
-            // wait for the condition variable
-            while (!responseTargetBufferFilled) {
-                auto status = cv.wait_until (lk, timeoutTimepoint);
-                if (status == std::cv_status::timeout) {
-                    waitingForResponse.store (false);
-                    // clear the buffer completely in this case
-                    std::fill (responseTargetBuffer, responseTargetBuffer + responseTargetBufferSize, 0);
-                    _outerClass.midiCommunicationError (noResponseBeforeTimeout);
-                    return timeout;
-                }
+        /**
+         * This is called by the function that wants to receive the responses after having sent out a bunch of
+         * requests registered before. It blocks until all responses were received and stored in the buffers provided
+         * to registerRequest or until the timeout passed to registerRequest expired. If a timeout appears, all buffer
+         * fields of the requests that got no response will be filled with zeros - so in case it's a C string char
+         * array, this will be interpreted as an empty string while in case of integer or float values, this will be
+         * the numerical value 0. After returning, all slots passed are free again.
+         * @param requestHandles Array of handles returned by registerRequest. Invalid handles, i.e. requests that got
+         *                       no slot, will be reported with errorCode::stillWaitingForPrevious.
+         * @param errorCodes Array of the same size that will be filled with the individual result of each request.
+         * @param numRequests Number of elements in both arrays.
+         * @param numElementsReceived Optional array of the same size that will be filled with the number of elements
+         *                            copied to the buffer of each request.
+         *
+         * @return errorCode::success if all requests were successful, the error code of the first failed request otherwise.
+         */
+        ErrorCode waitForResponsesOrTimeout (const RequestHandle *requestHandles, ErrorCode *errorCodes, int numRequests,
+                                             int *numElementsReceived = nullptr) {
+#ifdef SIMPLE_MIDI_ARDUINO
+            while (!allResponsesReceivedOrTimedOut (requestHandles, numRequests))
+                _outerClass.receive();
+#else
+            for (int i = 0; i < numRequests; i++) {
+                if (requestHandles[i] < 0)
+                    continue;
+
+                // sleep until the MIDI thread or the timeout thread changed the state of the slot
+                std::atomic<uint32_t> &status = pendingRequests[requestHandles[i]].status;
+                uint32_t currentStatus;
+                while (isWaitingForResponse (currentStatus = status.load (std::memory_order_acquire)))
+                    waitWhileEqual (status, currentStatus);
             }
+#endif
+            ErrorCode overallResult = releaseRequests (requestHandles, errorCodes, numRequests, numElementsReceived);
+#ifndef SIMPLE_MIDI_ARDUINO
+            handOverFreedSlots (true);
+#endif
 
-            // if we came here, the response buffers should have been filled by the MIDI thread. Just reset the two
-            // bool flags and leave...
-            waitingForResponse.store (false);
-            responseTargetBufferFilled = false;
+            if (overallResult == timeout)
+                _outerClass.midiCommunicationError (noResponseBeforeTimeout);
 
-            return success;
+            return overallResult;
         }
 
         /**
          * This is called by the corresponding MIDI handler when a speficic kind of message was received. If no
-         * request was sent out before, it returns false and does nothing, otherwise it aquires the mutex to the
-         * response target buffer and copies the elements from the source buffer.
+         * request matching the key was registered before, it returns false and does nothing, otherwise it copies
+         * the elements from the source buffer to the target buffer of the oldest matching request.
+         * @param responseKey The key identifying the response, built by ProfilingAmp::responseKey.
          * @param responseSourceBuffer The buffer provided by the MIDI handler.
          * @param responseSourceBufferSize The number of elemets to copy to the target buffer (number of array elements, NOT size in Bytes!).
-         * @return false if no thread was waiting for a response, true if the response could have been delivered.
+         * @return false if no request was waiting for this response, true if the response could have been delivered.
+         *         A late response to a request that timed out is delivered to a retry waiting for the same key, as it
+         *         carries the current value as well. @see consumeLateResponse
          */
-        bool receivedResponse (const T *responseSourceBuffer, int responseSourceBufferSize) {
-            if (waitingForResponse.load()) {
+        bool receivedResponse (uint32_t responseKey, const T *responseSourceBuffer, int responseSourceBufferSize) {
+#ifdef SIMPLE_MIDI_ARDUINO
+            // if the same request is pending multiple times, the oldest one gets the response
+            PendingRequest *oldestMatch = nullptr;
+            for (auto &request : pendingRequests) {
+                if ((request.state == slotWaiting) && (request.key == responseKey)) {
+                    if ((oldestMatch == nullptr) || ((int16_t)(request.sequenceNumber - oldestMatch->sequenceNumber) < 0))
+                        oldestMatch = &request;
+                }
+            }
 
-                {
-                    std::lock_guard<std::mutex> lk(responseTargetBufferMutex);
-                    size_t numElementsToCpy = std::min (responseSourceBufferSize, responseTargetBufferSize);
-                    memcpy (responseTargetBuffer, responseSourceBuffer, numElementsToCpy * sizeof(T));
-                    responseTargetBufferFilled = true;
+            if (oldestMatch == nullptr)
+                return false;
+
+            deliverResponse (*oldestMatch, responseSourceBuffer, responseSourceBufferSize);
+            oldestMatch->state = slotFilled;
+            return true;
+#else
+            while (true) {
+                // if the same request is pending multiple times, the oldest one gets the response
+                PendingRequest *oldestMatch = nullptr;
+                uint32_t oldestMatchStatus = 0;
+                for (auto &request : pendingRequests) {
+                    const uint32_t status = request.status.load (std::memory_order_acquire);
+                    if ((stateOf (status) != slotWaiting) || (request.key.load (std::memory_order_relaxed) != responseKey))
+                        continue;
+
+                    if ((oldestMatch == nullptr) || ((int16_t)(sequenceNumberOf (status) - sequenceNumberOf (oldestMatchStatus)) < 0)) {
+                        oldestMatch = &request;
+                        oldestMatchStatus = status;
+                    }
                 }
 
-                cv.notify_one();
+                if (oldestMatch == nullptr)
+                    return false;
+
+                // fails if the request timed out or the slot was reused in the meantime, the search starts over then
+                if (!oldestMatch->status.compare_exchange_strong (oldestMatchStatus, withState (oldestMatchStatus, slotDelivering),
+                                                                  std::memory_order_acq_rel))
+                    continue;
+
+                // asynchronous requests are completed by calling their handler, the slot is free again before
+                if (oldestMatch->completionHandler) {
+                    CompletionHandler completionHandler = std::move (oldestMatch->completionHandler);
+                    oldestMatch->completionHandler = nullptr;
+                    oldestMatch->status.store (withState (oldestMatchStatus, slotFree), std::memory_order_release);
 
+                    completionHandler (success, responseSourceBuffer, responseSourceBufferSize);
+                    handOverFreedSlots (false);
+                    return true;
+                }
+
+                deliverResponse (*oldestMatch, responseSourceBuffer, responseSourceBufferSize);
+                oldestMatch->status.store (withState (oldestMatchStatus, slotFilled), std::memory_order_release);
+                notifyAll (oldestMatch->status);
                 return true;
             }
-
-            return false;
+#endif
         }
 
         /**
-         * Returns true if waitingForResponseOrTimeout was called before and no response data
-         * was processed until now.
+         * Call this for a message that receivedResponse couldn't deliver, to find out if it might be the late response
+         * to a request that timed out shortly before rather than a message the amp sent by itself. If so, the oldest
+         * of these timed out requests is forgotten and true is returned.
          */
-        bool isWaitingForResponse() {
-            return waitingForResponse.load();
-        }
-
-    private:
+        bool consumeLateResponse (uint32_t responseKey) {
+#ifdef SIMPLE_MIDI_ARDUINO
+            PendingRequest *oldestLateMatch = nullptr;
+            const unsigned long now = millis();
+            for (auto &request : pendingRequests) {
+                if (request.lateResponseExpected && (request.lateResponseKey == responseKey) && ((long)(request.lateResponseExpiresAt - now) > 0)) {
+                    if ((oldestLateMatch == nullptr) || ((int16_t)(request.lateResponseSequenceNumber - oldestLateMatch->lateResponseSequenceNumber) < 0))
+                        oldestLateMatch = &request;
+                }
+            }
+
+            if (oldestLateMatch == nullptr)
+                return false;
+
+            oldestLateMatch->lateResponseExpected = false;
+            return true;
+#else
+            while (true) {
+                PendingRequest *oldestLateMatch = nullptr;
+                uint32_t oldestLateResponse = noLateResponse;
+                const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+                for (auto &request : pendingRequests) {
+                    const uint32_t lateResponse = request.lateResponse.load (std::memory_order_acquire);
+                    if ((lateResponse == noLateResponse) ||
+                            (request.lateResponseKey.load (std::memory_order_relaxed) != responseKey) ||
+                            (request.lateResponseExpiresAt.load (std::memory_order_relaxed) < now))
+                        continue;
+
+                    if ((oldestLateMatch == nullptr) || ((int16_t)(sequenceNumberOf (lateResponse) - sequenceNumberOf (oldestLateResponse)) < 0)) {
+                        oldestLateMatch = &request;
+                        oldestLateResponse = lateResponse;
+                    }
+                }
+
+                if (oldestLateMatch == nullptr)
+                    return false;
+
+                // fails if the timeout thread replaced the entry in the meantime
+                if (oldestLateMatch->lateResponse.compare_exchange_strong (oldestLateResponse, noLateResponse, std::memory_order_acq_rel))
+                    return true;
+            }
+#endif
+        }
+
+        /**
+         * Returns true if any request was registered and its response was not processed until now.
+         */
+        bool hasPendingRequests() {
+            for (auto &request : pendingRequests) {
+#ifdef SIMPLE_MIDI_ARDUINO
+                if (request.state != slotFree)
+#else
+                if (stateOf (request.status.load (std::memory_order_acquire)) != slotFree)
+#endif
+                    return true;
+            }
+            return false;
+        }
+
+    private:
+        enum SlotState : uint8_t {
+            slotFree,
+            slotWaiting,
+            // the MIDI thread is copying the response
+            slotDelivering,
+            slotFilled,
+            slotTimedOut
+        };
+
+#ifndef SIMPLE_MIDI_ARDUINO
+        static const uint32_t noLateResponse = 0;
+#endif
+
+        struct PendingRequest {
+#ifdef SIMPLE_MIDI_ARDUINO
+            uint32_t key = 0;
+            uint16_t sequenceNumber = 0;
+            SlotState state = slotFree;
+            unsigned long deadline = 0;
+            unsigned long timeoutInMilliseconds = 0;
+
+            // the last request in this slot that timed out, so that its late response isn't taken for a message the amp
+            // sent by itself
+            bool lateResponseExpected = false;
+            uint32_t lateResponseKey = 0;
+            uint16_t lateResponseSequenceNumber = 0;
+            unsigned long lateResponseExpiresAt = 0;
+#else
+            std::atomic<uint32_t> key {0};
+            // the sequence number of the request in the upper bits and the SlotState in the lowest 8 bits, so that a
+            // slot that was reused in the meantime can't be claimed by mistake
+            std::atomic<uint32_t> status {slotFree};
+            std::chrono::steady_clock::time_point deadline;
+            std::chrono::steady_clock::duration timeout;
+            CompletionHandler completionHandler;
+
+            // the last request in this slot that timed out, so that its late response isn't taken for a message the amp
+            // sent by itself. Holds the sequence number like the status or noLateResponse, and is only written by the
+            // timeout thread
+            std::atomic<uint32_t> lateResponse {noLateResponse};
+            std::atomic<uint32_t> lateResponseKey {0};
+            std::atomic<std::chrono::steady_clock::rep> lateResponseExpiresAt {0};
+#endif
+            T *responseTargetBuffer = nullptr;
+            int responseTargetBufferSize = 0;
+            int numElementsReceived = 0;
+        };
+
         ProfilingAmp &_outerClass;
-        std::mutex responseTargetBufferMutex;
-        std::condition_variable cv;
-        std::atomic<bool> waitingForResponse;
-        bool responseTargetBufferFilled = false;
-        T *responseTargetBuffer = nullptr;
-        int responseTargetBufferSize = 0;
+        PendingRequest pendingRequests[maxPendingRequests];
+        uint16_t nextSequenceNumber = 0;
+
+        // Copies the response to the buffer of a sync request
+        static void deliverResponse (PendingRequest &request, const T *responseSourceBuffer, int responseSourceBufferSize) {
+            if (responseSourceBufferSize > request.responseTargetBufferSize)
+                responseSourceBufferSize = request.responseTargetBufferSize;
+            memcpy (request.responseTargetBuffer, responseSourceBuffer, responseSourceBufferSize * sizeof (T));
+            request.numElementsReceived = responseSourceBufferSize;
+        }
+
+#ifdef SIMPLE_MIDI_ARDUINO
+        bool allResponsesReceivedOrTimedOut (const RequestHandle *requestHandles, int numRequests) {
+            const unsigned long now = millis();
+            for (int i = 0; i < numRequests; i++) {
+                if (requestHandles[i] < 0)
+                    continue;
+
+                PendingRequest &request = pendingRequests[requestHandles[i]];
+                if ((request.state == slotWaiting) && ((long)(request.deadline - now) > 0))
+                    return false;
+            }
+            return true;
+        }
+#else
+        static const RequestHandle slotNotGrantedYet = -2;
+
+        // Guards occupying slots and the queues. The MIDI thread never blocks on it, it only tries to lock it
+        std::mutex pendingRequestsMutex;
+
+        static SlotState stateOf (uint32_t status) { return (SlotState)(status & 0xFF); }
+        static uint16_t sequenceNumberOf (uint32_t status) { return (uint16_t)(status >> 8); }
+        static uint32_t withState (uint32_t status, SlotState state) { return (status & ~0xFFu) | state; }
+        static bool isWaitingForResponse (uint32_t status) { return (stateOf (status) == slotWaiting) || (stateOf (status) == slotDelivering); }
+
+#ifndef KPAPI_ATOMIC_WAIT
+        // Without C++20 atomic waits, waiters sleep on this condition variable. The mutex is only held while checking
+        // an atomic and going to sleep, so notifying never waits for a user thread doing anything else
+        std::mutex wakeUpMutex;
+        std::condition_variable wakeUp;
+#endif
+
+        /** Blocks while the atomic holds the value passed. Might return spuriously */
+        template <typename AtomicValue>
+        void waitWhileEqual (std::atomic<AtomicValue> &atomic, AtomicValue value) {
+#ifdef KPAPI_ATOMIC_WAIT
+            atomic.wait (value, std::memory_order_acquire);
+#else
+            std::unique_lock<std::mutex> lk (wakeUpMutex);
+            wakeUp.wait (lk, [&]() { return atomic.load (std::memory_order_acquire) != value; });
+#endif
+        }
+
+        /** Wakes up all threads waiting for a change of the atomic. Call after changing it */
+        template <typename AtomicValue>
+        void notifyAll (std::atomic<AtomicValue> &atomic) {
+#ifdef KPAPI_ATOMIC_WAIT
+            atomic.notify_all();
+#else
+            (void) atomic;
+            // a waiter that checked the atomic before the change is asleep once the mutex is free
+            { std::lock_guard<std::mutex> lk (wakeUpMutex); }
+            wakeUp.notify_all();
+#endif
+        }
+
+        /** A request waiting for a slot. Blocking requests are woken up by setting their granted handle */
+        struct QueuedRequest {
+            uint32_t key = 0;
+            int timeoutInMilliseconds = 0;
+            // blocking requests
+            T *responseTargetBuffer = nullptr;
+            int responseTargetBufferSize = 0;
+            std::atomic<RequestHandle> *grantedHandle = nullptr;
+            std::chrono::steady_clock::time_point deadline;
+            // asynchronous requests
+            CompletionHandler completionHandler;
+            std::function<void()> sendRequest;
+        };
+
+        std::deque<QueuedRequest> queuedRequests[numRequestPriorities];
+        std::atomic<int> numQueuedRequests {0};
+        // Set by a thread that freed a slot but couldn't get the mutex to hand it to a queued request
+        std::atomic<bool> slotsFreed {false};
+
+        std::thread timeoutThread;
+        std::mutex timeoutThreadMutex;
+        std::condition_variable timeoutThreadCv;
+        bool newDeadline = false;
+        bool stopTimeoutThread = false;
+
+        // Must be called with the pendingRequestsMutex held
+        void startTimeoutThreadIfNeeded() {
+            if (!timeoutThread.joinable())
+                timeoutThread = std::thread (&ResponseMessageManager::expireTimedOutRequests, this);
+        }
+
+        // Lets the timeout thread know about a new deadline. Must be called without the pendingRequestsMutex held
+        void deadlineAdded() {
+            {
+                std::lock_guard<std::mutex> lk (timeoutThreadMutex);
+                newDeadline = true;
+            }
+            timeoutThreadCv.notify_one();
+        }
+
+        // Must be called with the pendingRequestsMutex held. Returns true if a request of this or a higher priority is queued
+        bool hasQueuedRequests (RequestPriority priority) {
+            for (int p = 0; p <= priority; p++) {
+                if (!queuedRequests[p].empty())
+                    return true;
+            }
+            return false;
+        }
+
+        // Must be called with the pendingRequestsMutex held. Registers the request in a free slot, if there is one
+        RequestHandle occupyFreeSlot (QueuedRequest &queuedRequest) {
+            for (RequestHandle h = 0; h < maxPendingRequests; h++) {
+                PendingRequest &request = pendingRequests[h];
+
+                // slots only leave the free state with the mutex held, so no other thread can take it
+                if (stateOf (request.status.load (std::memory_order_acquire)) != slotFree)
+                    continue;
+
+                request.key.store (queuedRequest.key, std::memory_order_relaxed);
+                request.responseTargetBuffer = queuedRequest.responseTargetBuffer;
+                request.responseTargetBufferSize = queuedRequest.responseTargetBufferSize;
+                request.numElementsReceived = 0;
+                request.completionHandler = std::move (queuedRequest.completionHandler);
+                request.timeout = std::chrono::milliseconds (queuedRequest.timeoutInMilliseconds);
+                request.deadline = std::chrono::steady_clock::now() + request.timeout;
+                request.status.store (((uint32_t)nextSequenceNumber++ << 8) | slotWaiting, std::memory_order_release);
+                return h;
+            }
+
+            return invalidRequestHandle;
+        }
+
+        /**
+         * Must be called with the pendingRequestsMutex held. Hands the free slots to the queued requests in priority
+         * and FIFO order. Returns the number of asynchronous requests that need to be sent after releasing the
+         * mutex, they are moved to the array passed.
+         */
+        int grantFreeSlots (std::function<void()> *requestsToSend, bool &grantedAnySlot) {
+            int numRequestsToSend = 0;
+
+            if (numQueuedRequests.load() == 0)
+                return 0;
+
+            for (auto &queue : queuedRequests) {
+                while (!queue.empty()) {
+                    QueuedRequest &queuedRequest = queue.front();
+                    const RequestHandle h = occupyFreeSlot (queuedRequest);
+                    if (h == invalidRequestHandle)
+                        return numRequestsToSend;
+
+                    if (queuedRequest.grantedHandle != nullptr) {
+                        queuedRequest.grantedHandle->store (h, std::memory_order_release);
+                        notifyAll (*queuedRequest.grantedHandle);
+                    }
+                    else {
+                        requestsToSend[numRequestsToSend++] = std::move (queuedRequest.sendRequest);
+                    }
+                    queue.pop_front();
+                    numQueuedRequests--;
+                    grantedAnySlot = true;
+                }
+            }
+
+            return numRequestsToSend;
+        }
+
+        /**
+         * Every thread holding the pendingRequestsMutex releases it through this function. It hands free slots to
+         * queued requests and checks if another thread freed a slot but failed to get the mutex in the meantime.
+         */
+        void unlockAndGrantFreeSlots (std::unique_lock<std::mutex> &lk) {
+            std::function<void()> requestsToSend[maxPendingRequests];
+            bool grantedAnySlot = false;
+
+            while (true) {
+                slotsFreed.store (false);
+                const int numRequestsToSend = grantFreeSlots (requestsToSend, grantedAnySlot);
+                lk.unlock();
+
+                for (int i = 0; i < numRequestsToSend; i++)
+                    requestsToSend[i]();
+
+                if (!slotsFreed.load() || !lk.try_lock())
+                    break;
+            }
+
+            if (grantedAnySlot)
+                deadlineAdded();
+        }
+
+        /**
+         * Called without the pendingRequestsMutex held after slots were freed. If requests are queued, the slots are
+         * handed to them. If mayBlock is false, this only happens if the mutex is free, otherwise the thread holding
+         * it will do that.
+         */
+        void handOverFreedSlots (bool mayBlock) {
+            if (numQueuedRequests.load() == 0)
+                return;
+
+            slotsFreed.store (true);
+
+            std::unique_lock<std::mutex> lk (pendingRequestsMutex, std::defer_lock);
+            if (mayBlock)
+                lk.lock();
+            else if (!lk.try_lock())
+                return;
+
+            unlockAndGrantFreeSlots (lk);
+        }
+
+        // Runs on the timeout thread. Completes all requests whose deadline passed with a timeout
+        void expireTimedOutRequests() {
+            while (true) {
+                auto now = std::chrono::steady_clock::now();
+                auto nextDeadline = now + std::chrono::seconds (1);
+
+                CompletionHandler expiredHandlers[maxPendingRequests];
+                int numExpired = 0;
+                {
+                    std::unique_lock<std::mutex> lk (pendingRequestsMutex);
+
+                    for (auto &request : pendingRequests) {
+                        uint32_t status = request.status.load (std::memory_order_acquire);
+                        if (stateOf (status) != slotWaiting)
+                            continue;
+
+                        if (request.deadline > now) {
+                            nextDeadline = std::min (nextDeadline, request.deadline);
+                            continue;
+                        }
+
+                        // fails if the response arrived just now
+                        if (!request.status.compare_exchange_strong (status, withState (status, slotTimedOut), std::memory_order_acq_rel))
+                            continue;
+
+                        // the response might still arrive, it's dropped then within the timeout of the request
+                        request.lateResponse.store (noLateResponse, std::memory_order_relaxed);
+                        request.lateResponseKey.store (request.key.load (std::memory_order_relaxed), std::memory_order_relaxed);
+                        request.lateResponseExpiresAt.store ((now + request.timeout).time_since_epoch().count(), std::memory_order_relaxed);
+                        request.lateResponse.store (withState (status, slotTimedOut), std::memory_order_release);
+
+                        if (request.completionHandler) {
+                            expiredHandlers[numExpired++] = std::move (request.completionHandler);
+                            request.completionHandler = nullptr;
+                            request.status.store (withState (status, slotFree), std::memory_order_release);
+                        }
+                        else {
+                            notifyAll (request.status);
+                        }
+                    }
+
+                    // blocking requests waiting for a slot give up as well
+                    for (auto &queue : queuedRequests) {
+                        for (auto it = queue.begin(); it != queue.end();) {
+                            if ((it->grantedHandle == nullptr) || (it->deadline > now)) {
+                                if (it->grantedHandle != nullptr)
+                                    nextDeadline = std::min (nextDeadline, it->deadline);
+                                ++it;
+                                continue;
+                            }
+
+                            it->grantedHandle->store (invalidRequestHandle, std::memory_order_release);
+                            notifyAll (*it->grantedHandle);
+                            it = queue.erase (it);
+                            numQueuedRequests--;
+                        }
+                    }
+
+                    unlockAndGrantFreeSlots (lk);
+                }
+
+                // never call any handler with the lock held
+                for (int i = 0; i < numExpired; i++) {
+                    expiredHandlers[i] (timeout, nullptr, 0);
+                }
+                if (numExpired > 0)
+                    _outerClass.midiCommunicationError (noResponseBeforeTimeout);
+
+                std::unique_lock<std::mutex> lk (timeoutThreadMutex);
+                timeoutThreadCv.wait_until (lk, nextDeadline, [this]() { return newDeadline || stopTimeoutThread; });
+                if (stopTimeoutThread)
+                    return;
+                newDeadline = false;
+            }
+        }
+#endif
+
+        // Frees the slots and clears the buffers of all requests without a response. The responses of all requests
+        // passed must have arrived or timed out
+        ErrorCode releaseRequests (const RequestHandle *requestHandles, ErrorCode *errorCodes, int numRequests, int *numElementsReceived) {
+            ErrorCode overallResult = success;
+
+            for (int i = 0; i < numRequests; i++) {
+                int numElements = 0;
+
+                if (requestHandles[i] < 0) {
+                    errorCodes[i] = stillWaitingForPrevious;
+                }
+                else {
+                    PendingRequest &request = pendingRequests[requestHandles[i]];
+#ifdef SIMPLE_MIDI_ARDUINO
+                    const bool filled = request.state == slotFilled;
+#else
+                    const uint32_t status = request.status.load (std::memory_order_acquire);
+                    const bool filled = stateOf (status) == slotFilled;
+#endif
+                    if (filled) {
+                        errorCodes[i] = success;
+                        numElements = request.numElementsReceived;
+                    }
+                    else {
+                        // clear the buffer completely in this case
+                        memset (request.responseTargetBuffer, 0, request.responseTargetBufferSize * sizeof (T));
+                        errorCodes[i] = timeout;
+#ifdef SIMPLE_MIDI_ARDUINO
+                        // the response might still arrive, it's dropped then within the timeout of the request
+                        request.lateResponseExpected = true;
+                        request.lateResponseKey = request.key;
+                        request.lateResponseSequenceNumber = request.sequenceNumber;
+                        request.lateResponseExpiresAt = millis() + request.timeoutInMilliseconds;
 #endif
+                    }
+#ifdef SIMPLE_MIDI_ARDUINO
+                    request.state = slotFree;
+#else
+                    request.status.store (withState (status, slotFree), std::memory_order_release);
+#endif
+                }
+
+                if (numElementsReceived != nullptr)
+                    numElementsReceived[i] = numElements;
+
+                if ((overallResult == success) && (errorCodes[i] != success))
+                    overallResult = errorCodes[i];
+            }
+
+            return overallResult;
+        }
     };
 
 
@@ -745,7 +2459,95 @@ private:
 
     // ================ Tempo =======================================
 #ifdef SIMPLE_MIDI_MULTITHREADED
-    MIDIClockGenerator *midiClockGenerator = nullptr;
+    ClockEngine *clockEngine = nullptr;
+    ClockFollower *clockFollower = nullptr;
+#endif
+
+    // ================ Setlist =====================================
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    Setlist *setlist = nullptr;
+#endif
+
+    // ================ Catalog =====================================
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    Catalog *catalog = nullptr;
+
+    /** Lets the catalog know that a rig or performance change is about to be sent */
+    void catalogRigChangeFollows (int newActivePerformanceIdx);
+#endif
+
+    // ================ Rig change prefetch =========================
+#ifndef SIMPLE_MIDI_ARDUINO
+    enum PrefetchState : uint8_t {
+        // not requested for the active rig or the request failed
+        PrefetchEmpty,
+        PrefetchPending,
+        PrefetchFilled
+    };
+
+    struct PrefetchedString {
+        bool extended;
+        uint32_t address;
+        PrefetchState state;
+        char value[stringBufferLength];
+    };
+
+    struct PrefetchedParameter {
+        int8_t page;
+        int8_t parameter;
+        PrefetchState state;
+        int16_t value;
+    };
+
+    // all names of ActiveRigNames as well as the amp gain, the EQ gains and the on/off state of each stomp slot
+    static const int numPrefetchedStrings = 8;
+    static const int numPrefetchedParameters = 5 + 8;
+    PrefetchedString prefetchedStrings[numPrefetchedStrings];
+    PrefetchedParameter prefetchedParameters[numPrefetchedParameters];
+
+    std::atomic<bool> rigChangePrefetch {false};
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchUpdated;
+    // incremented on each rig change, responses to requests for a previous rig are dropped
+    uint32_t prefetchGeneration = 0;
+    int numPrefetchesPending = 0;
+    RigSnapshotReadyCallbackFn rigSnapshotReadyCallback;
+    PrefetchStatistics prefetchStatistics = {0, 0};
+
+    /** Sets up the table of prefetched values, called by the constructors */
+    void initializePrefetchTable();
+
+    /** Clears the prefetched values after a rig change and requests them again if the prefetch is enabled */
+    void restartRigChangePrefetch();
+
+    /** Sends the requests for all values that are marked as pending */
+    void requestPendingPrefetches (uint32_t generation);
+
+    void storePrefetchedString (uint32_t generation, int idx, const char *value);
+
+    void storePrefetchedParameter (uint32_t generation, int idx, int16_t value);
+
+    /** Call with the prefetch mutex held, after a prefetched value arrived or failed */
+    void prefetchedValueCompleted (std::unique_lock<std::mutex> &lk);
+
+    /** Call with the prefetch mutex held */
+    RigSnapshot buildRigSnapshot();
+
+    /**
+     * Copies a prefetched string to the buffer passed and counts a hit if the string is prefetched for the active rig.
+     * If a request for it is still pending and the caller may block, this waits for the response. Returns false and
+     * counts a miss if the string has to be requested.
+     */
+    bool readPrefetchedString (bool extended, uint32_t address, char *stringBuffer, bool mayBlock);
+
+    /** Same as readPrefetchedString, for a range of consecutive parameters on a page */
+    bool readPrefetchedParameters (int8_t page, int8_t firstParameter, int numValues, int16_t *values, bool mayBlock);
+
+    /** Updates a prefetched parameter if it was already received */
+    void updatePrefetchedParameter (int8_t page, int8_t parameter, int16_t value);
+
+    /** Returns true if the stomp slots are scanned after each rig change anyway. Call with the stomp list mutex held */
+    bool stompSlotsAreScannedOnRigChange() { return automaticStompScan || rigChangePrefetch; }
 #endif
 
 
@@ -941,6 +2743,209 @@ private:
         // to be continued...
     };
 
+    /** Binds a ParameterID to everything needed to send and request the parameter */
+    struct ParameterDescriptor {
+        ParameterID id;
+        // PageUninitialized for stomp parameters, they are found on the page of the slot the stomp is loaded into
+        NRPNPage page;
+        NRPNParameter parameter;
+        // false for switches, which are sent as a single 7 Bit NRPN value
+        bool highResolution;
+        // The range values are clamped to before they are sent. Only switches have a narrower range than a 14 Bit
+        // NRPN value can transfer. The amp's own parameter ranges are unknown here
+        int16_t minValue;
+        int16_t maxValue;
+        // the generic stomp type the parameter belongs to, Empty if it's no stomp parameter or common to all stomps.
+        // Checked by parameterBelongsToStomp before a stomp parameter is sent or requested
+        StompType owningStompType;
+    };
+
+    /**
+     * Returns true if the stomp type passed has the parameter described. Pitch shifter delays share the parameters of
+     * delays and pitch shifters, phasers share the modulation parameters of the chorus types.
+     */
+    static bool parameterBelongsToStomp (const ParameterDescriptor &descriptor, StompType stompType) {
+        if (stompType == StompType::Empty)
+            return false;
+
+        if (descriptor.owningStompType == StompType::Empty)
+            return true;
+
+        StompType genericType = (StompType)(stompType & StompType::GenericMask);
+
+        if (genericType == descriptor.owningStompType)
+            return true;
+
+        if (genericType == StompType::GenericPitchShifterDelay)
+            return (descriptor.owningStompType == StompType::GenericDelay) || (descriptor.owningStompType == StompType::GenericPitchShifter);
+
+        return (genericType == StompType::GenericPhaser) && (descriptor.owningStompType == StompType::GenericChorus);
+    }
+
+    // Indexed by ParameterID. The order is checked at compile time by parameterDescriptorsAreValid
+    static constexpr ParameterDescriptor parameterDescriptors[(int)ParameterID::NumParameterIDs] = {
+        {ParameterID::RigTempo,              Rig,               RigTempo,              true,  0, 16383, Empty},
+        {ParameterID::RigVolume,             Rig,               RigVolume,             true,  0, 16383, Empty},
+        {ParameterID::RigTempoEnable,        Rig,               RigTempoEnable,        false, 0,     1, Empty},
+        {ParameterID::NoiseGateIntensity,    Input,             NoiseGateIntensity,    true,  0, 16383, Empty},
+        {ParameterID::InputCleanSense,       Input,             InputCleanSense,       true,  0, 16383, Empty},
+        {ParameterID::InputDistortionSense,  Input,             InputDistortionSense,  true,  0, 16383, Empty},
+        {ParameterID::AmpOnOff,              Amp,               AmpOnOff,              false, 0,     1, Empty},
+        {ParameterID::AmpGain,               Amp,               AmpGain,               true,  0, 16383, Empty},
+        {ParameterID::AmpDefinition,         Amp,               AmpDefinition,         true,  0, 16383, Empty},
+        {ParameterID::AmpClarity,            Amp,               AmpClarity,            true,  0, 16383, Empty},
+        {ParameterID::AmpPowerSagging,       Amp,               AmpPowerSagging,       true,  0, 16383, Empty},
+        {ParameterID::AmpPick,               Amp,               AmpPick,               true,  0, 16383, Empty},
+        {ParameterID::AmpCompressor,         Amp,               AmpCompressor,         true,  0, 16383, Empty},
+        {ParameterID::AmpTubeShape,          Amp,               AmpTubeShape,          true,  0, 16383, Empty},
+        {ParameterID::AmpTubeBias,           Amp,               AmpTubeBias,           true,  0, 16383, Empty},
+        {ParameterID::AmpDirectMix,          Amp,               AmpDirectMix,          true,  0, 16383, Empty},
+        {ParameterID::EqOnOff,               Eq,                EqOnOff,               false, 0,     1, Empty},
+        {ParameterID::EqBassGain,            Eq,                EqBassGain,            true,  0, 16383, Empty},
+        {ParameterID::EqMiddleGain,          Eq,                EqMiddleGain,          true,  0, 16383, Empty},
+        {ParameterID::EqTrebleGain,          Eq,                EqTrebleGain,          true,  0, 16383, Empty},
+        {ParameterID::EqPresenceGain,        Eq,                EqPresenceGain,        true,  0, 16383, Empty},
+        {ParameterID::CabOnOff,              Cab,               CabOnOff,              false, 0,     1, Empty},
+        {ParameterID::CabVolume,             Cab,               CabVolume,             true,  0, 16383, Empty},
+        {ParameterID::CabHighShift,          Cab,               CabHighShift,          true,  0, 16383, Empty},
+        {ParameterID::CabLowShift,           Cab,               CabLowShift,           true,  0, 16383, Empty},
+        {ParameterID::CabCharacter,          Cab,               CabCharacter,          true,  0, 16383, Empty},
+        {ParameterID::CabPureCabinet,        Cab,               CabPureCabinet,        true,  0, 16383, Empty},
+        {ParameterID::StompTypeID,           PageUninitialized, StompTypeID,           true,  0, 16383, Empty},
+        {ParameterID::OnOff,                 PageUninitialized, OnOff,                 false, 0,     1, Empty},
+        {ParameterID::WahManual,             PageUninitialized, WahManual,             true,  0, 16383, GenericWah},
+        {ParameterID::WahPeak,               PageUninitialized, WahPeak,               true,  0, 16383, GenericWah},
+        {ParameterID::WahRange,              PageUninitialized, WahRange,              true,  0, 16383, GenericWah},
+        {ParameterID::WahPeakRAnge,          PageUninitialized, WahPeakRAnge,          true,  0, 16383, GenericWah},
+        {ParameterID::WahPedalMode,          PageUninitialized, WahPedalMode,          true,  0, 16383, GenericWah},
+        {ParameterID::WahTouchAttack,        PageUninitialized, WahTouchAttack,        true,  0, 16383, GenericWah},
+        {ParameterID::WahTouchRelease,       PageUninitialized, WahTouchRelease,       true,  0, 16383, GenericWah},
+        {ParameterID::WahTouchBoost,         PageUninitialized, WahTouchBoost,         true,  0, 16383, GenericWah},
+        {ParameterID::DisShaperDrive,        PageUninitialized, DisShaperDrive,        true,  0, 16383, GenericDistortion},
+        {ParameterID::DisBoosterTone,        PageUninitialized, DisBoosterTone,        true,  0, 16383, GenericBooster},
+        {ParameterID::CompGateIntensity,     PageUninitialized, CompGateIntensity,     true,  0, 16383, GenericDynamics},
+        {ParameterID::CompAttack,            PageUninitialized, CompAttack,            true,  0, 16383, GenericDynamics},
+        {ParameterID::CompSquash,            PageUninitialized, CompSquash,            true,  0, 16383, GenericDynamics},
+        {ParameterID::ModRate,               PageUninitialized, ModRate,               true,  0, 16383, GenericChorus},
+        {ParameterID::ModDepth,              PageUninitialized, ModDepth,              true,  0, 16383, GenericChorus},
+        {ParameterID::ModFeedback,           PageUninitialized, ModFeedback,           true,  0, 16383, GenericChorus},
+        {ParameterID::ModCrossover,          PageUninitialized, ModCrossover,          true,  0, 16383, GenericChorus},
+        {ParameterID::ModHyperChorusAmount,  PageUninitialized, ModHyperChorusAmount,  true,  0, 16383, GenericChorus},
+        {ParameterID::ModManual,             PageUninitialized, ModManual,             true,  0, 16383, GenericChorus},
+        {ParameterID::ModPhaserPeakSpread,   PageUninitialized, ModPhaserPeakSpread,   true,  0, 16383, GenericPhaser},
+        {ParameterID::ModPhaserStages,       PageUninitialized, ModPhaserStages,       true,  0, 16383, GenericPhaser},
+        {ParameterID::RotarySpeedSlowFast,   PageUninitialized, RotarySpeedSlowFast,   false, 0,     1, GenericChorus},
+        {ParameterID::RotayDistance,         PageUninitialized, RotayDistance,         true,  0, 16383, GenericChorus},
+        {ParameterID::RotaryBalance,         PageUninitialized, RotaryBalance,         true,  0, 16383, GenericChorus},
+        {ParameterID::GEQBand1,              PageUninitialized, GEQBand1,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand2,              PageUninitialized, GEQBand2,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand3,              PageUninitialized, GEQBand3,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand4,              PageUninitialized, GEQBand4,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand5,              PageUninitialized, GEQBand5,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand6,              PageUninitialized, GEQBand6,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand7,              PageUninitialized, GEQBand7,              true,  0, 16383, GenericEq},
+        {ParameterID::GEQBand8,              PageUninitialized, GEQBand8,              true,  0, 16383, GenericEq},
+        {ParameterID::PEQLowGain,            PageUninitialized, PEQLowGain,            true,  0, 16383, GenericEq},
+        {ParameterID::PEQLowFreq,            PageUninitialized, PEQLowFreq,            true,  0, 16383, GenericEq},
+        {ParameterID::PEQHighGain,           PageUninitialized, PEQHighGain,           true,  0, 16383, GenericEq},
+        {ParameterID::PEQHighFreq,           PageUninitialized, PEQHighFreq,           true,  0, 16383, GenericEq},
+        {ParameterID::PEQPeak1Gain,          PageUninitialized, PEQPeak1Gain,          true,  0, 16383, GenericEq},
+        {ParameterID::PEQPeak1Freq,          PageUninitialized, PEQPeak1Freq,          true,  0, 16383, GenericEq},
+        {ParameterID::PEQPeak1Q,             PageUninitialized, PEQPeak1Q,             true,  0, 16383, GenericEq},
+        {ParameterID::PEQPeak2Gain,          PageUninitialized, PEQPeak2Gain,          true,  0, 16383, GenericEq},
+        {ParameterID::PEQPeak2Freq,          PageUninitialized, PEQPeak2Freq,          true,  0, 16383, GenericEq},
+        {ParameterID::PEQPeak2Q,             PageUninitialized, PEQPeak2Q,             true,  0, 16383, GenericEq},
+        {ParameterID::Ducking,               PageUninitialized, Ducking,               true,  0, 16383, Empty},
+        {ParameterID::VoiceMix,              PageUninitialized, VoiceMix,              true,  0, 16383, GenericPitchShifter},
+        {ParameterID::Detune,                PageUninitialized, Detune,                true,  0, 16383, GenericPitchShifter},
+        {ParameterID::SmoothChords,          PageUninitialized, SmoothChords,          false, 0,     1, GenericPitchShifter},
+        {ParameterID::PureTuning,            PageUninitialized, PureTuning,            false, 0,     1, GenericPitchShifter},
+        {ParameterID::Key,                   PageUninitialized, Key,                   true,  0, 16383, GenericPitchShifter},
+        {ParameterID::FreezeFormants,        PageUninitialized, FreezeFormants,        false, 0,     1, GenericPitchShifter},
+        {ParameterID::FormantOffset,         PageUninitialized, FormantOffset,         true,  0, 16383, GenericPitchShifter},
+        {ParameterID::LowCut,                PageUninitialized, LowCut,                true,  0, 16383, Empty},
+        {ParameterID::HighCut,               PageUninitialized, HighCut,               true,  0, 16383, Empty},
+        {ParameterID::DlyMix,                PageUninitialized, DlyMix,                true,  0, 16383, GenericDelay},
+        {ParameterID::DlyMixPrePost,         PageUninitialized, DlyMixPrePost,         false, 0,     1, GenericDelay},
+        {ParameterID::DlyTime1,              PageUninitialized, DlyTime1,              true,  0, 16383, GenericDelay},
+        {ParameterID::DlyTime2,              PageUninitialized, DlyTime2,              true,  0, 16383, GenericDelay},
+        {ParameterID::DlyRatio2,             PageUninitialized, DlyRatio2,             true,  0, 16383, GenericDelay},
+        {ParameterID::DlyRatio3,             PageUninitialized, DlyRatio3,             true,  0, 16383, GenericDelay},
+        {ParameterID::DlyRatio4,             PageUninitialized, DlyRatio4,             true,  0, 16383, GenericDelay},
+        {ParameterID::DlyNoteValue1,         PageUninitialized, DlyNoteValue1,         true,  0, 16383, GenericDelay},
+        {ParameterID::DlyNoteValue2,         PageUninitialized, DlyNoteValue2,         true,  0, 16383, GenericDelay},
+        {ParameterID::DlyNoteValue3,         PageUninitialized, DlyNoteValue3,         true,  0, 16383, GenericDelay},
+        {ParameterID::DlyNoteValue4,         PageUninitialized, DlyNoteValue4,         true,  0, 16383, GenericDelay},
+        {ParameterID::DlyToTempo,            PageUninitialized, DlyToTempo,            false, 0,     1, GenericDelay},
+        {ParameterID::DlyVolume1,            PageUninitialized, DlyVolume1,            true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVolume2,            PageUninitialized, DlyVolume2,            true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVolume3,            PageUninitialized, DlyVolume3,            true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVolume4,            PageUninitialized, DlyVolume4,            true,  0, 16383, GenericDelay},
+        {ParameterID::DlyPan1,               PageUninitialized, DlyPan1,               true,  0, 16383, GenericDelay},
+        {ParameterID::DlyPan2,               PageUninitialized, DlyPan2,               true,  0, 16383, GenericDelay},
+        {ParameterID::DlyPan3,               PageUninitialized, DlyPan3,               true,  0, 16383, GenericDelay},
+        {ParameterID::DlyPan4,               PageUninitialized, DlyPan4,               true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVoice1Pitch,        PageUninitialized, DlyVoice1Pitch,        true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVoice2Pitch,        PageUninitialized, DlyVoice2Pitch,        true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVoice3Pitch,        PageUninitialized, DlyVoice3Pitch,        true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVoice4Pitch,        PageUninitialized, DlyVoice4Pitch,        true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVoice3Interval,     PageUninitialized, DlyVoice3Interval,     true,  0, 16383, GenericDelay},
+        {ParameterID::DlyVoice4Interval,     PageUninitialized, DlyVoice4Interval,     true,  0, 16383, GenericDelay},
+        {ParameterID::DlyFeedbak,            PageUninitialized, DlyFeedbak,            true,  0, 16383, GenericDelay},
+        {ParameterID::DlyInfinityFeedback,   PageUninitialized, DlyInfinityFeedback,   true,  0, 16383, GenericDelay},
+        {ParameterID::DlyInfinity,           PageUninitialized, DlyInfinity,           false, 0,     1, GenericDelay},
+        {ParameterID::DlyFeedback2,          PageUninitialized, DlyFeedback2,          true,  0, 16383, GenericDelay},
+        {ParameterID::DlyFeedbackSyncSwitch, PageUninitialized, DlyFeedbackSyncSwitch, false, 0,     1, GenericDelay},
+        {ParameterID::DlyLowCut,             PageUninitialized, DlyLowCut,             true,  0, 16383, GenericDelay},
+        {ParameterID::DlyHighCut,            PageUninitialized, DlyHighCut,            true,  0, 16383, GenericDelay},
+        {ParameterID::DlyFilterIntensity,    PageUninitialized, DlyFilterIntensity,    true,  0, 16383, GenericDelay},
+        {ParameterID::DlyModulation,         PageUninitialized, DlyModulation,         true,  0, 16383, GenericDelay},
+        {ParameterID::DlyChorus,             PageUninitialized, DlyChorus,             true,  0, 16383, GenericDelay},
+        {ParameterID::DlyFlutterIntensity,   PageUninitialized, DlyFlutterIntensity,   true,  0, 16383, GenericDelay},
+        {ParameterID::DlyFlutterShape,       PageUninitialized, DlyFlutterShape,       true,  0, 16383, GenericDelay},
+        {ParameterID::DlyGrit,               PageUninitialized, DlyGrit,               true,  0, 16383, GenericDelay},
+        {ParameterID::DlyReverseMix,         PageUninitialized, DlyReverseMix,         true,  0, 16383, GenericDelay},
+        {ParameterID::DlySwell,              PageUninitialized, DlySwell,              true,  0, 16383, GenericDelay},
+        {ParameterID::DlySmear,              PageUninitialized, DlySmear,              true,  0, 16383, GenericDelay},
+        {ParameterID::DlyDucking,            PageUninitialized, DlyDucking,            true,  0, 16383, GenericDelay}
+    };
+
+    /**
+     * Checks the descriptor table from the index passed on: Each descriptor must be stored at the index of its ID, have
+     * a valid range and switches must fit into 7 Bits
+     */
+    static constexpr bool parameterDescriptorsAreValid (int idx = 0) {
+        return (idx == (int)ParameterID::NumParameterIDs) ||
+               ((parameterDescriptors[idx].id == (ParameterID)idx) &&
+                (parameterDescriptors[idx].minValue <= parameterDescriptors[idx].maxValue) &&
+                (parameterDescriptors[idx].highResolution || (parameterDescriptors[idx].maxValue <= 127)) &&
+                parameterDescriptorsAreValid (idx + 1));
+    }
+
+    /** Clamps the value to the range of the descriptor, so it can be encoded as NRPN, and sends it to the page passed */
+    void writeParameter (const ParameterDescriptor &descriptor, NRPNPage page, int16_t value) {
+        static_assert (parameterDescriptorsAreValid(), "The parameter descriptor table doesn't match ParameterID");
+
+        value = (value < descriptor.minValue) ? descriptor.minValue : ((value > descriptor.maxValue) ? descriptor.maxValue : value);
+
+        if (descriptor.highResolution)
+            updateHighResNRPN (page, descriptor.parameter, value);
+        else
+            updateLowResNRPN (page, descriptor.parameter, (uint8_t)value);
+    }
+
+    template <ParameterID id>
+    void writeStompParameter (NRPNPage slotPage, int16_t value) {
+        static_assert (parameterDescriptors[(int)id].page == PageUninitialized, "Only stomp parameters can be set on a stomp slot");
+        writeParameter (parameterDescriptors[(int)id], slotPage, value);
+    }
+
+    template <ParameterID id>
+    int16_t readStompParameter (NRPNPage slotPage) {
+        static_assert (parameterDescriptors[(int)id].page == PageUninitialized, "Only stomp parameters can be read from a stomp slot");
+        return getSingleParameter (slotPage, parameterDescriptors[(int)id].parameter);
+    }
+
     enum ControlChange : uint8_t {
         WahPedal = 1,
         PitchPedal = 4,
@@ -991,6 +2996,20 @@ private:
         ExtendedStringParamReq = 0x47
     };
 
+    /** The LSBs of all string parameters describing the active rig. The MSB is always 0 */
+    enum StringParameterLSB : int8_t {
+        ActiveRigNameLSB = 1,
+        ActiveAmpNameLSB = 16,
+        ActiveAmpManufacturerNameLSB = 21,
+        ActiveAmpModelNameLSB = 24,
+        ActiveCabNameLSB = 32,
+        ActiveCabManufacturerNameLSB = 37,
+        ActiveCabModelNameLSB = 42
+    };
+
+    static constexpr uint32_t activePerformanceNameControllerNumber = 0x4000;
+    static constexpr uint32_t rigNameControllerNumberOffset = 0x3FCF;
+
     /**
      * Sends a a single parameter request sysEx and returns the response as a 14 Bit value.
      * In case of any error it will return -1 - and midiCommunicationError will be called to
@@ -1012,67 +3031,1139 @@ private:
      */
     returnStringType getExtendedStringParameter (uint32_t extendedControllerNumber);
 
-    // ========== NRPN handling ===============================
-    NRPNPage lastNRPNPage = PageUninitialized;
-    NRPNParameter lastNRPNParameter = ParameterUninitialized;
+    /**
+     * Builds the key that is used to match a response to its request. The address is the page & parameter
+     * (MSB << 8 | LSB) for single parameters and strings or the controller number for extended strings.
+     */
+    static uint32_t responseKey (FunctionCode responseFunctionCode, uint32_t address) {
+        return ((uint32_t)(uint8_t)responseFunctionCode << 24) | (address & 0x00FFFFFF);
+    }
+
+    /** Constructs and sends a single parameter request SysEx */
+    void sendSingleParameterRequest (int8_t pageOrMSB, int8_t parameterOrLSB);
+
+    /** Describes one parameter to be requested by getSingleParameters */
+    struct ParameterRequest {
+        int8_t pageOrMSB;
+        int8_t parameterOrLSB;
+        // Will be filled with the 14 Bit value received or -1 in case of any error
+        int16_t value;
+    };
 
     /**
-     * Sets a new NRPN page and parameter. Once this is set all following NRPN values sent
-     * the profilier will interpret them as a value for this parameter until a new value
-     * will be set.
+     * Pipelined version of getSingleParameter. Sends out all requests back to back before waiting for the
+     * responses, so reading N parameters costs roughly one round trip instead of N. In case of any error the
+     * value of the affected request will be set to -1 and midiCommunicationError will be called.
      */
-    void setNewNRPNParameter (NRPNPage newPage, NRPNParameter newParameter);
+    void getSingleParameters (ParameterRequest *requests, int numRequests);
+
+    /** Describes a range of consecutive parameters of one page to be requested by getMultiParameters */
+    struct MultiParameterRequest {
+        int8_t page;
+        int8_t firstParameter;
+        int8_t numValues;
+        // Must point to an array of numValues elements. Will be filled with the 14 Bit values received,
+        // values that were not received will be set to -1
+        int16_t *values;
+    };
 
     /**
-     * Checks if the page/parameter pair is the current NRPN value, if not sets it and sends the
-     * value afterwards.
+     * Sends a multi parameter request SysEx for each request passed and decodes the multi parameter responses
+     * into the value arrays of the requests. Like getSingleParameters, all requests are sent out back to back
+     * before waiting for the responses.
+     * @return The total number of values received
      */
-    void updateLowResNRPN (NRPNPage page, NRPNParameter parameter, uint8_t value);
+    int getMultiParameters (MultiParameterRequest *requests, int numRequests);
 
     /**
-     * Checks if the page/parameter pair is the current NRPN value, if not sets it and sends the
-     * value afterwards. Send an MSB and LSB
+     * Reads numValues consecutive parameters of a page starting at firstParameter into the array passed with
+     * a single request/response exchange.
+     * @return The number of values received, values not received will be set to -1.
      */
-    void updateHighResNRPN (NRPNPage page, NRPNParameter parameter, int16_t value);
+    template <size_t numValues>
+    int getParameterRange (NRPNPage page, NRPNParameter firstParameter, int16_t (&values)[numValues]) {
+        static_assert (numValues <= 127, "A page has no more than 127 parameters");
+        MultiParameterRequest request = {page, firstParameter, (int8_t)numValues, values};
+        return getMultiParameters (&request, 1);
+    }
 
-    // ========== Stomp handling ===============================
-    // just in case there will be other kemper amps in future with a differnt stomp slot count, make this one variable
-    static const uint8_t numStomps = 8;
-    // the memory block for the placement-new allocation of stomps
-    char stompMemoryBlock[numStomps * sizeof (WahWahStomp)];
-    StompBase *stompsInCurrentRig[numStomps];
-    bool needStompListUpdate = true;
+    /** Describes one string to be requested by getStringParameters */
+    struct StringRequest {
+        // true for an extended string parameter, false for a (MSB, LSB) string parameter
+        bool extended;
+        // (MSB << 8) | LSB for a string parameter, the extended controller number otherwise
+        uint32_t address;
+        // Must point to a buffer of at least stringBufferLength chars. Will be empty in case of any error
+        char *stringBuffer;
+    };
 
-    /** Simply fills all 8 slots with empty stomps. */
-    void initializeStompsInCurrentRig();
+    /**
+     * Pipelined version of getStringParameter and getExtendedStringParameter. Sends out all requests back
+     * to back before waiting for the responses. Strings prefetched after the last rig change are not requested
+     * again, unless mayUsePrefetchedStrings is false, e.g. because a preselected performance is queried.
+     * Returns the number of strings received. An empty string might be a valid response, so this is the only
+     * way to tell whether all requests were answered.
+     */
+    int getStringParameters (StringRequest *requests, int numRequests, bool mayUsePrefetchedStrings = true,
+                              RequestPriority priority = ForegroundRequest);
 
+    /** Constructs and sends the request SysEx for a string request */
+    void sendStringRequest (const StringRequest &request);
+
+#ifndef SIMPLE_MIDI_ARDUINO
     /**
-     * Searches for a generic stomp instance in a particular stomp slot and returns a pointer to
-     * this instance. If the stompSlot value passed is StompSlot::First, it scans all slots for an
-     * instance of this type and returns a pointer to the first match found. If no instance could be
-     * found in the desired slot or in any slot if searching for StompSlot::First, a nullpointer will
-     * be returned.
-     * This function should only be used if you are searching for a generic stomp type, otherwise
-     * get specificSpecificStompInstance should be used. Generally this will never be used by the user,
-     * because the StompBase pointer won't allow any parameter interaction. The corresponding public
-     * functions that call this function inside will downcast the pointer to the specific class corresponding
-     * to the stomp type so that the user might interact with the stomp.
+     * Asynchronous version of getSingleParameter. Sends the request and returns immediately, the completion handler
+     * will be called with the 14 Bit value received or -1 in case of any error.
      */
-    StompBase *getGenericStompInstance (StompType genericStompType, StompSlot stompSlot);
+    void getSingleParameterAsync (int8_t pageOrMSB, int8_t parameterOrLSB, ParameterCallbackFn completionHandler);
 
     /**
-     * Searches for a specific stomp instance in a particular stomp slot and returns a pointer to
-     * this instance. If the stompSlot value passed is StompSlot::First, it scans all slots for an
-     * instance of this type and returns a pointer to the first match found. If no instance could be
-     * found in the desired slot or in any slot if searching for StompSlot::First, a nullpointer will
-     * be returned.
-     * This function should only be used if you are searching for a specific stomp type, otherwise
-     * getGenericSpecificStompInstance should be used. Generally this will never be used by the user,
-     * because the StompBase pointer won't allow any parameter interaction. The corresponding public
-     * functions that call this function inside will downcast the pointer to the specific class corresponding
-     * to the stomp type so that the user might interact with the stomp.
+     * Asynchronous version of getStringParameter and getExtendedStringParameter. Sends the request and returns
+     * immediately, the completion handler will be called with the string received or an empty string in case of
+     * any error.
      */
-    StompBase *getSpecificStompInstance (StompType specificStompType, StompSlot stompSlot);
+    void getStringParameterAsync (bool extended, uint32_t address, StringCallbackFn completionHandler);
+
+    /** Sends the request of getSingleParameterAsync without looking at the mirror or the prefetched values first */
+    void requestSingleParameterAsync (int8_t pageOrMSB, int8_t parameterOrLSB, ParameterCallbackFn completionHandler,
+                                      RequestPriority priority = ForegroundRequest);
+
+    /**
+     * Sends the request of getStringParameterAsync. The completion handler gets the null terminated string received
+     * or an empty string in case of any error.
+     */
+    void requestStringAsync (bool extended, uint32_t address, std::function<void (const char*)> completionHandler,
+                             RequestPriority priority = ForegroundRequest);
+
+    /**
+     * Calls an asynchronous getter with a completion handler that fulfills a promise and returns the future
+     * belonging to that promise.
+     */
+    template <typename ValueType, typename AsyncGetter>
+    static std::future<ValueType> makeFuture (AsyncGetter asyncGetter) {
+        auto promise = std::make_shared<std::promise<ValueType>>();
+        asyncGetter ([promise] (ValueType value) { promise->set_value (value); });
+        return promise->get_future();
+    }
+#endif
+
+#ifdef KPAPI_COROUTINES
+    /**
+     * Resumes suspended tasks one at a time. Coroutine handles are posted by the completion handlers of the
+     * awaitables, which then try to run the executor on their own thread. If another thread is already running
+     * it, that thread will pick up the handle, so at no time two tasks are running concurrently.
+     */
+    class CoroutineExecutor {
+    public:
+        /** Queues a suspended coroutine to be resumed. Can be called from any thread. */
+        void post (std::coroutine_handle<> coroutine) {
+            std::lock_guard<std::mutex> lk (queueMutex);
+            queue.push_back (coroutine);
+        }
+
+        /**
+         * Resumes all coroutines queued, including those posted while running. Returns immediately if another
+         * thread is already running the executor.
+         */
+        void runPending() {
+            {
+                std::lock_guard<std::mutex> lk (queueMutex);
+                if (running)
+                    return;
+                running = true;
+            }
+
+            while (true) {
+                std::coroutine_handle<> coroutine;
+                {
+                    // the running flag is reset with the lock held, so nothing posted can get lost
+                    std::lock_guard<std::mutex> lk (queueMutex);
+                    if (queue.empty()) {
+                        running = false;
+                        return;
+                    }
+                    coroutine = queue.front();
+                    queue.pop_front();
+                }
+                coroutine.resume();
+            }
+        }
+
+    private:
+        std::mutex queueMutex;
+        std::deque<std::coroutine_handle<>> queue;
+        bool running = false;
+    };
+
+    CoroutineExecutor coroutineExecutor;
+
+    /** co_await-able version of getSingleParameter */
+    Awaitable<int16_t> getSingleParameterAwaitable (int8_t pageOrMSB, int8_t parameterOrLSB);
+
+    /** co_await-able version of getStringParameter */
+    Awaitable<returnStringType> getStringParameterAwaitable (int8_t MSB, int8_t LSB);
+
+    /** co_await-able version of getExtendedStringParameter */
+    Awaitable<returnStringType> getExtendedStringParameterAwaitable (uint32_t extendedControllerNumber);
+#endif
+
+    // ========== Transmit scheduling =========================
+    /**
+     * All outgoing messages pass a scheduler, that only hands a message to the MIDI driver once the previous one has
+     * passed the wire. Messages that have to wait are queued per priority class, so that a footswitch action never
+     * waits behind a burst of requests. All NRPN messages share one class, as the page/parameter elision relies on
+     * them being sent in call order.
+     */
+    enum TransmitPriority : uint8_t {
+        RealtimePriority = 0,   // MIDI clock
+        PerformancePriority,    // tap tempo, rig and performance changes, stomp toggles
+        ParameterPriority,      // NRPN and SysEx parameter changes, pedals
+        BulkPriority,           // requests for parameters and strings
+
+        numTransmitPriorities
+    };
+
+    enum OutgoingMessageType : uint8_t {
+        ControlChanges,         // bytes contain control/value pairs
+        SysEx,
+        ClockTick
+    };
+
+    /** Queues or sends a single control change */
+    void transmitControlChange (TransmitPriority priority, uint8_t control, uint8_t value);
+
+    /** Queues or sends a sequence of control changes that must not be interleaved with other messages */
+    void transmitControlChanges (TransmitPriority priority, const char *controlValuePairs, uint8_t numControlChanges);
+
+    /** Queues or sends a complete SysEx message, including the SysExBegin and SysExEnd bytes */
+    void transmitSysEx (TransmitPriority priority, const char *sysEx, uint16_t length);
+
+    /** Sends a MIDI clock tick right away. As lower priority messages are held back, the link is idle at that time */
+    void transmitClockTick();
+
+    void transmit (TransmitPriority priority, OutgoingMessageType type, const char *bytes, uint16_t length);
+
+    /** Hands the message to the MIDI driver and accounts for its wire time */
+    void dispatch (OutgoingMessageType type, const char *bytes, uint16_t length);
+
+    /** Returns the number of bytes the message will occupy on the wire */
+    static uint16_t wireSize (OutgoingMessageType type, uint16_t length);
+
+    // Wire sizes of the messages used to send parameter changes
+    static const uint8_t numBytesControlChange = 3;
+    static const uint8_t numBytesSingleParamChange = 13;
+    static const uint8_t numBytesMultiParamChangeHeader = 11;
+
+    // time a byte takes on the wire, 0 if the link should not be throttled
+    uint32_t microsecondsPerByte = 320;
+
+    /** Returns true if the messages sent before have passed the wire */
+    bool linkIsFree();
+
+    /** Accounts for the wire time of the bytes just sent */
+    void reserveLink (uint16_t numBytes);
+
+#ifdef SIMPLE_MIDI_ARDUINO
+    unsigned long linkFreeAtMicros = 0;
+#else
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct OutgoingMessage {
+        OutgoingMessageType type;
+        std::vector<char> bytes;
+    };
+
+    std::mutex transmitMutex;
+    std::condition_variable transmitQueued;
+    std::deque<OutgoingMessage> transmitQueues[numTransmitPriorities];
+    std::thread transmitThread;
+    bool transmitThreadShouldExit = false;
+
+    TimePoint linkFreeAt;
+    // the time the next realtime message is expected to be sent, or TimePoint() if none is announced
+    TimePoint nextRealtimeMessageAt;
+    TimePoint lastRealtimeMessageSentAt;
+
+    /**
+     * Lets the scheduler know when the next clock tick is due. Lower priority messages are only started if they
+     * will have passed the wire by then.
+     */
+    void announceRealtimeMessage (TimePoint dueTime);
+
+    /**
+     * Returns true if a message of this size will have passed the wire before the next realtime message is due.
+     * Messages longer than the gap between two realtime messages are started right after one was sent.
+     */
+    bool fitsBeforeNextRealtimeMessage (uint16_t numBytes, TimePoint now);
+
+    /** Returns true if a message of that priority may be sent now. Call with the transmit mutex held */
+    bool maySendNow (TransmitPriority priority, uint16_t numBytes);
+
+    /** Sends queued messages and pending pedal values as soon as the link is free. Runs on its own thread */
+    void transmitThreadLoop();
+
+    void stopTransmitThread();
+#endif
+
+    // ========== NRPN handling ===============================
+    NRPNPage lastNRPNPage = PageUninitialized;
+    NRPNParameter lastNRPNParameter = ParameterUninitialized;
+
+    /**
+     * Checks if the page/parameter pair is the current NRPN value, if not sets it and sends the
+     * value afterwards.
+     */
+    void updateLowResNRPN (NRPNPage page, NRPNParameter parameter, uint8_t value);
+
+    /**
+     * Checks if the page/parameter pair is the current NRPN value, if not sets it and sends the
+     * value afterwards. Send an MSB and LSB
+     */
+    void updateHighResNRPN (NRPNPage page, NRPNParameter parameter, int16_t value);
+
+    /** A complete NRPN write: the parameter selection, if needed, and the value as a single group */
+    struct NRPNTransaction {
+        NRPNPage page;
+        NRPNParameter parameter;
+        bool highResolution;
+        int16_t value;
+    };
+
+    /**
+     * Selects the page/parameter pair if needed and sends the value, without taking batches into account. Safe to
+     * be called from any number of threads, the groups of control changes of two NRPN writes are never interleaved.
+     */
+    void sendNRPN (NRPNPage page, NRPNParameter parameter, bool highResolution, int16_t value);
+
+    /** Encodes the transaction based on the selection passed, which is updated, and transmits it as one message */
+    void transmitNRPN (const NRPNTransaction &transaction, NRPNPage &selectedPage, NRPNParameter &selectedParameter);
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    /**
+     * A bounded lock-free queue of NRPN transactions with any number of producers and a single consumer. Each cell
+     * carries a sequence number telling if it is free to be written or ready to be read, so producers only
+     * compete for the enqueue position.
+     */
+    class NRPNTransactionQueue {
+    public:
+        NRPNTransactionQueue();
+
+        /**
+         * Adds a transaction, can be called from any thread. Returns false if the queue is full. On success, the
+         * ticket is the number of transactions that have to be sent until this one is out.
+         */
+        bool push (const NRPNTransaction &transaction, uint32_t &ticket);
+
+        /** Takes the oldest transaction. Must only be called by one thread at a time */
+        bool pop (NRPNTransaction &transaction);
+
+    private:
+        // must be a power of two
+        static const uint32_t size = 64;
+
+        struct Cell {
+            std::atomic<uint32_t> sequence;
+            NRPNTransaction transaction;
+        };
+
+        Cell cells[size];
+        std::atomic<uint32_t> enqueuePos {0};
+        uint32_t dequeuePos = 0;
+    };
+
+    NRPNTransactionQueue nrpnTransactions;
+
+    // The number of transactions taken from the queue and transmitted, lets producers know when theirs is out
+    std::atomic<uint32_t> nrpnTransactionsSent {0};
+
+    // Held by the single thread currently draining the NRPN queue. The NRPN selection is only changed with it held
+    std::mutex nrpnMutex;
+
+    /**
+     * If no other thread is draining the NRPN queue, transmits all transactions in it, keeping track of the
+     * selected page/parameter pair. Otherwise yields, as the other thread will send them.
+     */
+    void tryDrainNRPNTransactions();
+#endif
+
+    // ========== Continuous controller queue ==================
+    struct ContinuousController {
+        bool isNRPN;
+        NRPNPage page;
+        // the control number for CC targets
+        int8_t parameter;
+        int16_t lastValueSent;
+        int16_t pendingValue;
+        bool pending;
+        // used to send pending values in the order they were first queued
+        uint16_t pendingSince;
+    };
+
+    static const uint8_t maxContinuousControllers = 16;
+    static const int16_t continuousControllerValueUnknown = -1;
+
+    ContinuousController continuousControllers[maxContinuousControllers];
+    uint8_t numContinuousControllers = 0;
+    uint16_t continuousControllerSequenceNumber = 0;
+#ifdef SIMPLE_MIDI_ARDUINO
+    uint8_t numContinuousControllersPending = 0;
+#else
+    // read by the transmit thread without locking the queue
+    std::atomic<uint8_t> numContinuousControllersPending {0};
+    std::mutex continuousControllerMutex;
+#endif
+
+    /**
+     * Sends the value right away if the link is free, otherwise stores it as the pending value for this target,
+     * replacing any older value that was not sent yet.
+     */
+    void queueContinuousController (bool isNRPN, NRPNPage page, int8_t parameter, int16_t value);
+
+    /** Sends the value of the target that waits the longest if the link is free */
+    void drainContinuousControllerQueue();
+
+    /** Sends the pending value of a target */
+    void sendContinuousController (ContinuousController &controller);
+
+    // a high resolution NRPN including the page and parameter selection
+    static const uint8_t maxNumBytesContinuousController = 4 * numBytesControlChange;
+
+    /** Returns true if a pending value would be sent right away instead of being queued by the transmit scheduler */
+    bool continuousControllerMaySendNow();
+
+    /** Forgets the last values sent to NRPN targets, as the stomps they belong to might have changed */
+    void forgetContinuousControllerValues();
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // ========== Captured and scheduled commands ==============
+    struct ParameterWrite {
+        int8_t page;
+        int8_t parameter;
+        int16_t value;
+    };
+
+    /** Messages encoded ahead of time, together with the side effects to apply once they are sent */
+    struct CapturedCommands {
+        ProfilingAmp *owner = nullptr;
+        // the messages as they go over the wire, including the status bytes
+        std::vector<char> midiBytes;
+        std::vector<ParameterWrite> parameterWrites;
+        bool rigChanged = false;
+        // the active performance after the captured rig changes, passed to the catalog before they are sent
+        int catalogPerformanceHint = Catalog::keepActivePerformance;
+        // the NRPN selection within the captured messages, as they can't rely on the selection at the time sent
+        NRPNPage lastNRPNPage = PageUninitialized;
+        NRPNParameter lastNRPNParameter = ParameterUninitialized;
+    };
+
+public:
+    class Macro {
+        friend class ProfilingAmp;
+    public:
+        /**
+         * Sends the whole macro at once, ahead of any messages waiting in the transmit queues. Can also be called
+         * from within commands passed to scheduleCommands, to fire the macro on a beat.
+         */
+        void fire() const;
+
+        /** The number of bytes the macro occupies on the wire */
+        size_t getNumBytes() const { return commands.midiBytes.size(); }
+
+        /** The number of bytes the operations recorded would have sent if they were called one by one */
+        size_t getNumBytesUnoptimized() const { return numBytesUnoptimized; }
+
+    private:
+        Macro (ProfilingAmp &amp) : amp (&amp) {};
+
+        ProfilingAmp *amp;
+        CapturedCommands commands;
+        size_t numBytesUnoptimized = 0;
+    };
+
+    /**
+     * An ordered list of performance/rig pairs to step through during a show. The transition to each entry is encoded
+     * as a macro when the entry is added, so advancing to the next song sends all of its messages at once. The thread
+     * advancing only sends them, the bookkeeping of the rig change like invalidating the parameter mirror and
+     * restarting the stomp scan and the prefetch allocates and happens on a background thread right afterwards. That
+     * thread then checks the names of the active performance and its rigs against the names expected.
+     *
+     * Build the setlist before the show, as adding entries allocates. Get the setlist via ProfilingAmp::getSetlist.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    class Setlist {
+        friend class ProfilingAmp;
+    public:
+        enum EntryStatus {
+            // the performance of this entry has not been active since the entry was added
+            Unverified,
+            Verified,
+            PerformanceNameMismatch,
+            RigNameMismatch
+        };
+
+        typedef std::function<void (size_t entryIdx, EntryStatus status)> MismatchCallbackFn;
+
+        ~Setlist();
+
+        /**
+         * Appends an entry and returns its index. If an expected name is empty, it is not checked.
+         * Must not be called while advancing from another thread.
+         */
+        size_t addEntry (uint8_t performanceIdx, RigNr rig, returnStringType expectedPerformanceName = returnStringType(), returnStringType expectedRigName = returnStringType());
+
+        /** Removes all entries. The setlist is positioned before the first entry afterwards */
+        void clear();
+
+        size_t getNumEntries();
+
+        /** Returns the index of the entry selected last or -1 if no entry was selected yet */
+        int getCurrentEntryIdx();
+
+        /**
+         * Selects the entry passed. Returns false if there is no such entry. Only the messages compiled ahead of time
+         * are sent on the calling thread, and the catalog is told about the new performance if there is one.
+         */
+        bool goToEntry (size_t entryIdx);
+
+        /** Selects the next entry or the first one if none was selected yet. Returns false at the end of the list */
+        bool next();
+
+        /** Selects the previous entry. Returns false at the beginning of the list */
+        bool previous();
+
+        EntryStatus getEntryStatus (size_t entryIdx);
+
+        /** Returns true if all entries were verified and no mismatch was found */
+        bool allEntriesVerified();
+
+        /**
+         * The callback is called on the verification thread each time the names found don't match the names expected
+         * for an entry
+         */
+        void setMismatchCallback (MismatchCallbackFn mismatchCallback);
+
+        /** Sets the time to wait after a rig change before requesting the names, to let the amp load the rig */
+        void setVerificationDelay (std::chrono::milliseconds delay);
+
+        /**
+         * Verifies all entries in the background by selecting the performances of the setlist one after another. As
+         * this changes the sound, only use this before the show, e.g. while sound checking. The entry selected last
+         * is selected again afterwards. Returns immediately, use allEntriesVerified and the mismatch callback to check
+         * the results.
+         */
+        void verifyAllEntries();
+
+    private:
+        Setlist (ProfilingAmp &amp);
+
+        struct Entry {
+            uint8_t performanceIdx;
+            RigNr rig;
+            returnStringType expectedPerformanceName;
+            returnStringType expectedRigName;
+            Macro transition;
+            EntryStatus status;
+        };
+
+        ProfilingAmp &amp;
+        std::thread thread;
+        std::mutex setlistMutex;
+        std::condition_variable stateChanged;
+        bool shouldExit = false;
+
+        std::vector<Entry> entries;
+        int currentEntryIdx = -1;
+        std::chrono::milliseconds verificationDelay {500};
+        MismatchCallbackFn mismatchCallback;
+
+        // incremented on each advance, so the verification thread notices rig changes while it waits or requests
+        uint32_t advanceCount = 0;
+        uint32_t advanceCountHandled = 0;
+        bool fullVerificationRequested = false;
+
+        // the entry whose transition was sent but whose side effects weren't applied yet, or -1
+        int entryIdxWithPendingSideEffects = -1;
+
+        /**
+         * Sends the transition to an entry and wakes up the verification thread, which applies its side effects.
+         * Call with the setlist mutex held
+         */
+        void advanceTo (size_t entryIdx);
+
+        /** Applies the side effects of the transition sent last, if not done yet. Call with the setlist mutex held */
+        void applyPendingSideEffects();
+
+        void run();
+
+        /**
+         * Requests the names of the active performance and compares them to all entries of that performance.
+         * Returns false if another advance happened in the meantime and the results were discarded
+         */
+        bool verifyActivePerformance (std::unique_lock<std::mutex> &lk, size_t entryIdx, uint32_t advance);
+
+        /** Waits the verification delay. Returns false if the setlist is destroyed in the meantime */
+        bool waitForRigToLoad (std::unique_lock<std::mutex> &lk);
+    };
+
+    /**
+     * Returns the setlist, which is created on the first call.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    Setlist &getSetlist();
+
+    /**
+     * An index of the names of all performances and their rigs, crawled from the amp in the background and searchable
+     * without any MIDI communication. The index can be stored in a file that is memory mapped, so the names crawled
+     * are available right away on the next start and updates are written to the file as they come in.
+     *
+     * The amp only answers name requests for the active or preselected performance, so the crawler preselects one
+     * performance after another. A preselection does not change the sound, but a selectRig sent while it is pending
+     * would load the preselected performance. Therefore rig and performance changes sent by the ProfilingAmp pause
+     * the crawler for a while, and if the active performance is known, selectRig preselects it again first. The active
+     * performance is known after a selectPerformanceAndRig or once the crawler found its name.
+     * Get the catalog via ProfilingAmp::getCatalog.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    class Catalog {
+        friend class ProfilingAmp;
+    public:
+        static const int numPerformances = 125;
+        static const int numRigsPerPerformance = 5;
+
+        struct SearchResult {
+            uint8_t performanceIdx;
+            // -1 if the performance name matched, 0 - 4 for the name of a rig of this performance
+            int8_t rigIdx;
+            returnStringType name;
+        };
+
+        typedef std::function<void()> CrawlFinishedCallbackFn;
+
+        ~Catalog();
+
+        /**
+         * Uses the file passed to store the index. If it contains a valid index, all names in there are available right
+         * away, otherwise it is initialized as an empty index. Returns false if the file couldn't be opened, the index
+         * is only kept in memory then.
+         */
+        bool openIndexFile (const char *indexFilePath);
+
+        /** Crawls the names of all performances that were not crawled before in the background */
+        void startCrawl();
+
+        /**
+         * Requests the name of each performance that was crawled before in the background and crawls its rig names
+         * again only if the performance name changed. Performances that were never crawled are crawled as well.
+         */
+        void startRefresh();
+
+        void stopCrawling();
+
+        bool isCrawling();
+
+        /** The callback is called on the crawler thread when a crawl or refresh is done */
+        void setCrawlFinishedCallback (CrawlFinishedCallbackFn crawlFinishedCallback);
+
+        /** Limits the bandwidth used by the crawler. Defaults to 10 requests per second */
+        void setMaxRequestsPerSecond (double maxRequestsPerSecond);
+
+        int getNumPerformancesCrawled();
+
+        /** Returns the name of a performance or an empty string if it was not crawled yet */
+        returnStringType getPerformanceName (uint8_t performanceIdx);
+
+        /** Returns the name of a rig of a performance or an empty string if it was not crawled yet */
+        returnStringType getRigName (uint8_t performanceIdx, RigNr rig);
+
+        /**
+         * Returns the performances and rigs whose names start with the prefix passed, ignoring the case, ordered by
+         * performance.
+         */
+        std::vector<SearchResult> search (const char *prefix, size_t maxNumResults = 50);
+
+    private:
+        Catalog (ProfilingAmp &amp);
+
+        // Layout of the index file. The records are accessed in place, so the layout must never contain pointers
+        struct IndexHeader {
+            char magic[4];
+            uint16_t version;
+            uint16_t numPerformances;
+            uint16_t nameLength;
+            uint16_t reserved;
+        };
+
+        struct IndexRecord {
+            uint8_t crawled;
+            uint8_t reserved[3];
+            char performanceName[stringBufferLength];
+            char rigNames[numRigsPerPerformance][stringBufferLength];
+        };
+
+        static const uint16_t indexFileVersion = 1;
+        static const size_t indexFileSize = sizeof (IndexHeader) + numPerformances * sizeof (IndexRecord);
+
+        enum CrawlMode {
+            Idle,
+            Crawl,
+            Refresh
+        };
+
+        enum CrawlResult {
+            Crawled,
+            // a name request failed or a rig change happened while the names were requested, so they might belong
+            // to another performance. The record is left unchanged
+            Retry,
+            Stopped
+        };
+
+        // a performance that still can't be crawled after that many attempts is skipped until the next crawl
+        static const int maxAttemptsPerPerformance = 3;
+
+        static const int keepActivePerformance = -2;
+        static const int activePerformanceUnknown = -1;
+
+        ProfilingAmp &amp;
+        std::thread thread;
+        std::mutex catalogMutex;
+        std::condition_variable stateChanged;
+        bool shouldExit = false;
+        CrawlMode crawlMode = Idle;
+        CrawlFinishedCallbackFn crawlFinishedCallback;
+
+        // points into the mapped index file or to inMemoryIndex
+        IndexRecord *records;
+        std::vector<IndexRecord> inMemoryIndex;
+        std::FILE *indexFile = nullptr;
+        void *mappedIndexFile = nullptr;
+
+        double maxRequestsPerSecond = 10.0;
+        std::chrono::steady_clock::time_point nextRequestAllowedAt;
+
+        // rig and performance changes pause the crawler until then
+        std::chrono::steady_clock::time_point pausedUntil;
+        static constexpr std::chrono::seconds pauseAfterRigChange {5};
+        // the amp leaves the preselection mode by itself after a few seconds
+        static constexpr std::chrono::seconds preselectionTimeout {5};
+        std::chrono::steady_clock::time_point lastPreselectionSentAt;
+
+        int activePerformanceIdx = activePerformanceUnknown;
+        returnStringType activePerformanceName;
+        uint32_t rigChangeCount = 0;
+
+        void closeIndexFile();
+
+        /** Writes a record back to the index file if it is not memory mapped */
+        void storeRecord (uint8_t performanceIdx);
+
+        void run();
+
+        /** Crawls the names of a single performance */
+        CrawlResult crawlPerformance (std::unique_lock<std::mutex> &lk, uint8_t performanceIdx, bool onlyIfPerformanceNameChanged);
+
+        /** Requests the name of the active performance and looks it up in the index, if no preselection is pending */
+        bool findActivePerformance (std::unique_lock<std::mutex> &lk);
+
+        /**
+         * Waits until the crawler may send the number of requests passed, respecting the bandwidth limit and pauses.
+         * Returns false if the crawl was stopped in the meantime
+         */
+        bool waitForBandwidth (std::unique_lock<std::mutex> &lk, int numRequests);
+
+        /**
+         * Called before a rig or performance change is sent. Pauses the crawler and preselects the active performance
+         * again, if a preselection of the crawler might still be pending
+         */
+        void rigChangeFollows (int newActivePerformanceIdx);
+
+        /** Called after each rig change. Pauses the crawler, the rig might have been changed on the amp itself */
+        void activeRigChanged();
+    };
+
+    /**
+     * Returns the catalog, which is created on the first call.
+     * !! Not available on single threaded environments like Arduino !!
+     */
+    Catalog &getCatalog();
+
+private:
+
+    // while set, transmissions of the owning amp on this thread are captured instead of sent
+    static thread_local CapturedCommands *currentCapture;
+
+    /** Returns the capture active on the calling thread for this amp, if any */
+    CapturedCommands *captureOfThisThread() {
+        return ((currentCapture != nullptr) && (currentCapture->owner == this)) ? currentCapture : nullptr;
+    }
+
+    /** Calls the function passed and stores all messages it would send */
+    void captureCommands (const std::function<void()> &commands, CapturedCommands &capture);
+
+    /** Appends a message in the form passed to transmit as MIDI bytes */
+    static void appendMIDIBytes (std::vector<char> &midiBytes, OutgoingMessageType type, const char *bytes, uint16_t length);
+
+    /** Hands a buffer of complete MIDI messages to the driver. Call with the transmit mutex held */
+    void dispatchMIDIBytes (const char *midiBytes, size_t length);
+
+    /**
+     * Removes NRPN selections and values that are overwritten later on and sorts the NRPN values by page and
+     * parameter, so that only changes of the page or parameter need to be selected. Other messages are kept in
+     * place and NRPN values are never moved across them, as they might be rig changes.
+     */
+    static void optimizeCapturedNRPN (CapturedCommands &capture);
+
+    /** Sends a macro, or adds it to the current capture if called from within scheduled commands */
+    void fireMacro (const Macro &macro);
+
+    /**
+     * Sends a macro outside of any capture, without applying its side effects like a rig change. Only the catalog
+     * learns about a rig change right away, as a pending crawler preselection must be overridden before it is sent
+     */
+    void sendMacro (const Macro &macro);
+
+    /** Applies the side effects of a macro that was sent by sendMacro */
+    void applyMacroSideEffects (const Macro &macro);
+
+    /**
+     * Sends captured messages right away, bypassing the transmit queues. Queued NRPN messages relying on the
+     * NRPN selection of the wire are fixed up afterwards. Returns the time they were handed to the driver.
+     */
+    std::chrono::steady_clock::time_point sendCapturedCommands (const CapturedCommands &capture);
+
+    void applyCapturedSideEffects (const CapturedCommands &capture);
+
+    // the NRPN selection as sent out on the wire, which may lag behind lastNRPNPage if messages are queued
+    NRPNPage wireNRPNPage = PageUninitialized;
+    NRPNParameter wireNRPNParameter = ParameterUninitialized;
+
+    struct ScheduledCommands {
+        ScheduledCommandsID id;
+        CapturedCommands commands;
+        ScheduledCommandsCallbackFn sentCallback;
+        int32_t latenessMicroseconds;
+    };
+
+    std::mutex scheduledCommandsMutex;
+    std::multimap<uint64_t, ScheduledCommands> scheduledCommands;
+    ScheduledCommandsID lastScheduledCommandsID = 0;
+    // only used by the clock engine thread, kept to avoid allocations
+    std::vector<ScheduledCommands> dueScheduledCommands;
+
+    /** Sends all commands scheduled up to the tick passed. Called by the clock engine after sending that tick */
+    void sendScheduledCommands (uint64_t tickIndex, std::chrono::steady_clock::time_point tickDeadline);
+#endif
+
+    // ========== Parameter change batches =====================
+    struct ParameterChange {
+        NRPNPage page;
+        NRPNParameter parameter;
+        bool highResolution;
+        int16_t value;
+    };
+
+#ifdef SIMPLE_MIDI_ARDUINO
+    static const uint8_t maxParameterChangesPerBatch = 16;
+#else
+    static const uint8_t maxParameterChangesPerBatch = 64;
+#endif
+
+    ParameterChange parameterChangeBatch[maxParameterChangesPerBatch];
+    uint8_t numParameterChangesInBatch = 0;
+    bool collectingParameterChanges = false;
+    ParameterChangeBatchStatistics parameterChangeBatchStatistics = {0, 0, 0};
+
+    // The NRPN page and parameter that would be selected if all changes collected had been sent as NRPN
+    NRPNPage batchSimulatedNRPNPage = PageUninitialized;
+    NRPNParameter batchSimulatedNRPNParameter = ParameterUninitialized;
+
+    /** Returns the number of bytes needed to send the change via NRPN, depending on the NRPN parameter currently selected */
+    static uint8_t numBytesAsNRPN (const ParameterChange &change, NRPNPage selectedPage, NRPNParameter selectedParameter);
+
+    /** Adds a change to the batch or replaces the value if the parameter is already part of it */
+    void addToParameterChangeBatch (NRPNPage page, NRPNParameter parameter, bool highResolution, int16_t value);
+
+    /** Sends out all changes currently held in the batch and clears it */
+    void flushParameterChangeBatch();
+
+    /** Sends a run of changes to consecutive parameters of one page with the cheapest encoding and returns the number of bytes sent */
+    uint32_t sendParameterChangeRun (const ParameterChange *firstChange, uint8_t runLength);
+
+    // ========== Stomp handling ===============================
+    // just in case there will be other kemper amps in future with a differnt stomp slot count, make this one variable
+    static const uint8_t numStomps = 8;
+    // Storage for the placement-new allocation of one stomp. As a union, it's large enough for any stomp class
+    union StompStorage {
+        StompStorage() {};
+        StompBase base;
+        GenericWahStomp genericWah;
+        WahWahStomp wahWah;
+    };
+    StompStorage stompStorage[numStomps];
+    StompBase *stompsInCurrentRig[numStomps];
+
+    /** The generic stomp type of a range of stomp type IDs as sent by the amp */
+    struct StompTypeIDRange {
+        uint8_t firstID;
+        uint8_t lastID;
+        StompType genericType;
+    };
+
+    // The amp groups the stomp type IDs by effects type. The effects loops follow the boosters, the pitch shifting
+    // delays (crystal, loop pitch, frequency shifter, melody, chromatic and harmonic delays) are spread among the delays
+    static constexpr StompTypeIDRange stompTypeIDRanges[] = {
+        {1,   15,  GenericWah},
+        {16,  31,  GenericShaper},
+        {32,  47,  GenericDistortion},
+        {48,  63,  GenericDynamics},
+        {64,  79,  GenericChorus},
+        {80,  95,  GenericPhaser},
+        {96,  111, GenericEq},
+        {112, 120, GenericBooster},
+        {121, 127, GenericEffectsLoop},
+        {128, 143, GenericPitchShifter},
+        {144, 149, GenericDelay},
+        {150, 152, GenericPitchShifterDelay},
+        {153, 161, GenericDelay},
+        {162, 163, GenericPitchShifterDelay},
+        {164, 164, GenericDelay},
+        {165, 170, GenericPitchShifterDelay},
+        {171, 175, GenericDelay},
+        {176, 255, GenericReverb}
+    };
+
+    /** Checks the stomp type ID ranges from the index passed on: They must be ascending and must not overlap */
+    static constexpr bool stompTypeIDRangesAreValid (int idx = 0) {
+        return (idx == (int)(sizeof (stompTypeIDRanges) / sizeof (stompTypeIDRanges[0]))) ||
+               ((stompTypeIDRanges[idx].firstID <= stompTypeIDRanges[idx].lastID) &&
+                ((idx == 0) || (stompTypeIDRanges[idx - 1].lastID < stompTypeIDRanges[idx].firstID)) &&
+                stompTypeIDRangesAreValid (idx + 1));
+    }
+
+    /** Combines a stomp type ID as sent by the amp with the generic type it belongs to */
+    static StompType stompTypeFromID (int16_t stompTypeID);
+
+    // One bit per slot, set if the stomp in that slot is unknown or outdated
+    static const uint8_t allStompSlots = 0xFF;
+    static_assert (numStomps <= 8, "The stomp slot bit masks need a wider type");
+    uint8_t stompSlotsNeedingUpdate = allStompSlots;
+
+    // Incremented with each rig change, so that responses to stomp requests for a previous rig are ignored and
+    // stomp handles for the previous rig are detected as outdated
+#ifndef SIMPLE_MIDI_ARDUINO
+    std::atomic<uint32_t> rigGeneration {0};
+#else
+    uint32_t rigGeneration = 0;
+#endif
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    // Guards the stomp list, as background scans rebuild the slots on the MIDI thread
+    std::mutex stompListMutex;
+    std::condition_variable stompScanFinished;
+    // One bit per slot, set while a background scan waits for the response for that slot
+    uint8_t stompSlotsBeingScanned = 0;
+    bool automaticStompScan = false;
+
+    /** Same as scanStompSlotsAsync, but only for the slots whose bits are set */
+    void scanStompSlotsAsync (uint8_t slotsToScan);
+#endif
+
+    /** Simply fills all 8 slots with empty stomps. */
+    void initializeStompsInCurrentRig();
+
+    /**
+     * Replaces the stomp instance in a slot by a new one matching the stomp type ID received. Must be called with
+     * the stompListMutex held on multithreaded platforms.
+     */
+    void rebuildStompSlot (int8_t slotIndex, int16_t stompTypeID);
+
+    /**
+     * Requests the stomp type of a single slot and rebuilds it if it is outdated. If a background scan is waiting
+     * for this slot, it waits for that response instead.
+     */
+    void updateStompSlotIfNeeded (int8_t slotIndex);
+
+    /** Returns the stomp type of the instance currently held in a slot */
+    StompType stompTypeInSlot (int8_t slotIndex);
+
+    /** Called after each rig or performance change to invalidate everything that belonged to the previous rig */
+    void activeRigChanged();
+
+    /**
+     * Called on the MIDI thread if the amp reports a rig change. Only marks the stomp handles of the previous rig as
+     * outdated, the rest of activeRigChanged takes locks that user threads might hold, so it's left to the rig change
+     * thread. On Arduino, this simply calls activeRigChanged.
+     */
+    void rigChangeReceived();
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    /** Runs activeRigChanged once for all rig changes received since the last run, until the amp is destroyed */
+    void rigChangeThreadLoop();
+
+    void stopRigChangeThread();
+
+    std::thread rigChangeThread;
+    // incremented by the MIDI thread for each rig change received
+    std::atomic<uint32_t> numRigChangesReceived {0};
+    std::atomic<bool> rigChangeThreadShouldExit {false};
+#ifndef KPAPI_ATOMIC_WAIT
+    // only held while checking for rig changes and going to sleep
+    std::mutex rigChangeMutex;
+    std::condition_variable rigChangeReceivedCv;
+#endif
+
+    /** Wakes up the rig change thread after numRigChangesReceived or rigChangeThreadShouldExit changed */
+    void wakeUpRigChangeThread();
+#endif
+
+    /**
+     * Called whenever a parameter of the active rig was changed by a setter. Keeps the parameter mirror and the
+     * prefetched values up to date.
+     */
+    void parameterValueChanged (int8_t page, int8_t parameter, int16_t value);
+
+    /**
+     * Called for every parameter value received from the amp. Values that answer a request are only stored in the
+     * mirror by the requester, which knows if a local write happened since the request was sent.
+     */
+    void parameterValueReceived (int8_t page, int8_t parameter, int16_t value, bool isResponse);
+
+#ifdef KPAPI_PARAMETER_MIRROR
+    // ========== Parameter mirror =============================
+    // The rig, input, amp, eq and cab page as well as all stomp pages are mirrored
+    static const uint8_t numMirroredPages = 5 + numStomps;
+    static const uint8_t numParametersPerPage = 128;
+    static const int16_t mirrorValueUnknown = -1;
+
+#ifdef SIMPLE_MIDI_ARDUINO
+    // Counts the local writes and invalidations. Compared with wrap around, so a request must not stay pending for
+    // 32768 of them
+    typedef uint16_t MirrorSequenceNumber;
+    typedef int16_t MirrorSequenceDifference;
+
+    int16_t parameterMirror[numMirroredPages][numParametersPerPage];
+    MirrorSequenceNumber parameterMirrorLastWrite[numMirroredPages];
+    MirrorSequenceNumber parameterMirrorWriteSequence = 0;
+    bool parameterMirrorEnabled = false;
+#else
+    typedef uint32_t MirrorSequenceNumber;
+    typedef int32_t MirrorSequenceDifference;
+
+    std::atomic<int16_t> parameterMirror[numMirroredPages][numParametersPerPage];
+    // the write sequence number of the last local write to any parameter of a page, or of the last invalidation
+    std::atomic<MirrorSequenceNumber> parameterMirrorLastWrite[numMirroredPages];
+    std::atomic<MirrorSequenceNumber> parameterMirrorWriteSequence {0};
+    std::atomic<bool> parameterMirrorEnabled {false};
+#endif
+
+    /** Returns the index of the mirror table row for a page or -1 if the page isn't mirrored */
+    static int8_t mirrorPageIndex (int8_t page);
+
+    /** Returns the mirrored value or mirrorValueUnknown if the mirror is disabled or the value is unknown */
+    int16_t readParameterMirror (int8_t page, int8_t parameter);
+
+    /** Stores a value in the mirror if the mirror is enabled and the page is mirrored */
+    void writeParameterMirror (int8_t page, int8_t parameter, int16_t value);
+
+    /** Stores a locally written value in the mirror and marks its page as written after all requests sent so far */
+    void writeParameterMirrorLocally (int8_t page, int8_t parameter, int16_t value);
+
+    /**
+     * Stores the value of a response in the mirror unless the page was written locally or the mirror was invalidated
+     * after the request was sent, the amp might have answered with a value that is outdated now.
+     * @param requestSentAt The parameterMirrorWriteSequence read before the request was sent
+     */
+    void writeParameterMirrorResponse (int8_t page, int8_t parameter, int16_t value, MirrorSequenceNumber requestSentAt);
+#endif
+
+#ifndef SIMPLE_MIDI_ARDUINO
+    // ========== State cache ==================================
+    // Layout of the state cache file. It is followed by the parameter mirror table if hasParameterMirror is set
+    struct StateCache {
+        char magic[4];
+        uint16_t version;
+        uint16_t nameLength;
+        uint8_t numStompSlots;
+        uint8_t numNames;
+        uint8_t numParameterValues;
+        uint8_t hasParameterMirror;
+
+        // -1 if the stomp in the slot is unknown
+        int16_t stompTypeIDs[numStomps];
+        // empty if unknown
+        char names[numPrefetchedStrings][stringBufferLength];
+        // -1 if unknown
+        int16_t parameterValues[numPrefetchedParameters];
+    };
+
+    static const uint16_t stateCacheVersion = 1;
+
+    // ========== Rig state snapshots ==========================
+    struct RigStateRange {
+        NRPNPage page;
+        NRPNParameter firstParameter;
+        int8_t numValues;
+    };
+
+    // the amp, EQ and cab page followed by the stomp slots in the order of fxSlotNRPNPageMapping
+    static const int numRigStateRanges = 3 + numStomps;
+    static const int numValuesPerStompSlot = DlyDucking + 1;
+    static const int numRigStateValues = (AmpDirectMix - AmpOnOff + 1) + (EqPresenceGain - EqOnOff + 1) +
+                                         (CabPureCabinet - CabOnOff + 1) + numStomps * numValuesPerStompSlot;
+    static const RigStateRange rigStateRanges[numRigStateRanges];
+
+    static const uint8_t rigStateFormatVersion = 1;
+
+public:
+    struct RigState {
+        // the values of all ranges of rigStateRanges one after another, -1 if unknown
+        int16_t values[numRigStateValues];
+
+        /**
+         * Encodes the state in a compact, versioned binary format. The format describes the parameters it holds, so
+         * states stored by other versions of this library can still be read.
+         */
+        std::vector<uint8_t> serialize() const;
+
+        /**
+         * Decodes a state encoded by serialize. Parameters that are not part of the data are set to -1. Returns false
+         * if the data is no valid state.
+         */
+        bool deserialize (const uint8_t *data, size_t numBytes);
+    };
+
+private:
+#endif
+
+    /**
+     * Searches for a generic stomp instance in a particular stomp slot and returns a pointer to
+     * this instance. If the stompSlot value passed is StompSlot::First, it scans all slots for an
+     * instance of this type and returns a pointer to the first match found. If no instance could be
+     * found in the desired slot or in any slot if searching for StompSlot::First, a nullpointer will
+     * be returned.
+     * This function should only be used if you are searching for a generic stomp type, otherwise
+     * get specificSpecificStompInstance should be used. Generally this will never be used by the user,
+     * because the StompBase pointer won't allow any parameter interaction. The corresponding public
+     * functions that call this function inside will downcast the pointer to the specific class corresponding
+     * to the stomp type so that the user might interact with the stomp.
+     */
+    StompBase *getGenericStompInstance (StompType genericStompType, StompSlot stompSlot);
+
+    /**
+     * Searches for a specific stomp instance in a particular stomp slot and returns a pointer to
+     * this instance. If the stompSlot value passed is StompSlot::First, it scans all slots for an
+     * instance of this type and returns a pointer to the first match found. If no instance could be
+     * found in the desired slot or in any slot if searching for StompSlot::First, a nullpointer will
+     * be returned.
+     * This function should only be used if you are searching for a specific stomp type, otherwise
+     * getGenericSpecificStompInstance should be used. Generally this will never be used by the user,
+     * because the StompBase pointer won't allow any parameter interaction. The corresponding public
+     * functions that call this function inside will downcast the pointer to the specific class corresponding
+     * to the stomp type so that the user might interact with the stomp.
+     */
+    StompBase *getSpecificStompInstance (StompType specificStompType, StompSlot stompSlot);
+
+    /** Calls getGenericStompInstance or getSpecificStompInstance, depending on the stomp type passed */
+    StompBase *getStompInstance (StompType stompType, StompSlot stompSlot);
     
 // ======== SimpleMIDI meber functions ========================
     void receivedControlChange (uint8_t control, uint8_t value) override;